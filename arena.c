@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mymem.h"
+#include "arena.h"
+
+static uintptr_t alignUp(uintptr_t address)
+{
+    return (address + ARENA_ALIGN - 1) & ~(uintptr_t) (ARENA_ALIGN - 1);
+}
+
+/* An arena with room for poolBytes of objects, header and alignment included in its block; NULL
+ * if the pool has no block that large */
+Arena *arena_create(size_t poolBytes)
+{
+    // the pool does not align blocks, so leave room to align the first object
+    Arena *arena = mymalloc(sizeof(Arena) + ARENA_ALIGN - 1 + poolBytes);
+    if (arena == NULL)
+        return NULL;
+
+    arena->base = (char *) alignUp((uintptr_t) (arena + 1));
+    arena->capacity = poolBytes;
+    arena->used = 0;
+    return arena;
+}
+
+/* The next size bytes of the arena, aligned to ARENA_ALIGN, or NULL once it is full */
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size_t start = arena->used;   // base is aligned and so is every object's start offset
+    if (size > arena->capacity - start)
+        return NULL;
+
+    arena->used = alignUp(start + size) <= arena->capacity ? alignUp(start + size) : arena->capacity;
+    return arena->base + start;
+}
+
+/* Where the arena stands now; arena_reset to it frees everything allocated since */
+size_t arena_mark(Arena *arena)
+{
+    return arena->used;
+}
+
+/* Frees every object allocated after mark; a mark of 0 empties the arena */
+void arena_reset(Arena *arena, size_t mark)
+{
+    if (mark < arena->used)
+        arena->used = mark;
+}
+
+void arena_destroy(Arena *arena)
+{
+    if (arena != NULL)
+        myfree(arena);
+}
@@ -0,0 +1,20 @@
+/* Arenas: bump-pointer allocation inside one block taken from the pool with mymalloc. Objects
+ * are never freed one by one; arena_reset drops everything allocated after a mark at once, and
+ * arena_destroy hands the whole block back with a single myfree. Neither walks the MemList.
+ *
+ * Include mymem.h first; an arena lives in whatever pool initmem set up, and initmem discards it.
+ */
+#define ARENA_ALIGN 16   // every object starts on this boundary
+
+typedef struct arena
+{
+    char *base;           // first aligned byte after this header
+    size_t capacity;      // bytes from base to the end of the block
+    size_t used;          // bytes from base to the next object
+} Arena;
+
+Arena *arena_create(size_t poolBytes);
+void *arena_alloc(Arena *arena, size_t size);
+size_t arena_mark(Arena *arena);
+void arena_reset(Arena *arena, size_t mark);
+void arena_destroy(Arena *arena);
@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mymem.h"
+#include "blocktable.h"
+
+/* position of a block: chunk number and index within the chunk */
+typedef struct
+{
+    int chunk;
+    int index;
+} BtPos;
+
+static const BtPos notFound = { -1, -1 };
+
+BlockTable *blocktable_create(size_t poolSize)
+{
+    BlockTable *table = calloc(1, sizeof(BlockTable));
+    BtChunk *first = malloc(sizeof(BtChunk));
+    if (table == NULL || first == NULL) {
+        free(table);
+        free(first);
+        return NULL;
+    }
+
+    table->chunkCapacity = 16;
+    table->chunks = malloc(table->chunkCapacity * sizeof(BtChunk *));
+    if (table->chunks == NULL) {
+        free(table);
+        free(first);
+        return NULL;
+    }
+
+    // one free block covering the whole pool
+    first->count = 1;
+    first->offset[0] = 0;
+    first->size[0] = (int) poolSize;
+    first->alloc[0] = 0;
+
+    table->chunks[0] = first;
+    table->chunkCount = 1;
+    table->blocks = 1;
+    table->poolSize = poolSize;
+    return table;
+}
+
+void blocktable_destroy(BlockTable *table)
+{
+    int c;
+    if (table == NULL)
+        return;
+    for (c = 0; c < table->chunkCount; c++)
+        free(table->chunks[c]);
+    free(table->chunks);
+    free(table);
+}
+
+// opens a slot at pos and returns where it ended up (a full chunk is split in two first)
+static BtPos insertAt(BlockTable *table, BtPos pos)
+{
+    BtChunk *chunk = table->chunks[pos.chunk];
+
+    if (chunk->count == BT_CHUNK) {
+        int half = BT_CHUNK / 2;
+        BtChunk *upper = malloc(sizeof(BtChunk));
+        if (upper == NULL)
+            return notFound;
+        if (table->chunkCount == table->chunkCapacity) {
+            BtChunk **grown = realloc(table->chunks, 2 * table->chunkCapacity * sizeof(BtChunk *));
+            if (grown == NULL) {
+                free(upper);
+                return notFound;
+            }
+            table->chunks = grown;
+            table->chunkCapacity *= 2;
+        }
+
+        upper->count = BT_CHUNK - half;
+        memcpy(upper->offset, chunk->offset + half, upper->count * sizeof(chunk->offset[0]));
+        memcpy(upper->size, chunk->size + half, upper->count * sizeof(chunk->size[0]));
+        memcpy(upper->alloc, chunk->alloc + half, upper->count * sizeof(chunk->alloc[0]));
+        chunk->count = half;
+
+        memmove(table->chunks + pos.chunk + 2, table->chunks + pos.chunk + 1,
+                (table->chunkCount - pos.chunk - 1) * sizeof(BtChunk *));
+        table->chunks[pos.chunk + 1] = upper;
+        table->chunkCount++;
+
+        if (pos.index > half) {
+            pos.chunk++;
+            pos.index -= half;
+            chunk = upper;
+        }
+    }
+
+    int tail = chunk->count - pos.index;
+    memmove(chunk->offset + pos.index + 1, chunk->offset + pos.index, tail * sizeof(chunk->offset[0]));
+    memmove(chunk->size + pos.index + 1, chunk->size + pos.index, tail * sizeof(chunk->size[0]));
+    memmove(chunk->alloc + pos.index + 1, chunk->alloc + pos.index, tail * sizeof(chunk->alloc[0]));
+    chunk->count++;
+    table->blocks++;
+    return pos;
+}
+
+static void removeAt(BlockTable *table, BtPos pos)
+{
+    BtChunk *chunk = table->chunks[pos.chunk];
+    int tail = chunk->count - pos.index - 1;
+
+    memmove(chunk->offset + pos.index, chunk->offset + pos.index + 1, tail * sizeof(chunk->offset[0]));
+    memmove(chunk->size + pos.index, chunk->size + pos.index + 1, tail * sizeof(chunk->size[0]));
+    memmove(chunk->alloc + pos.index, chunk->alloc + pos.index + 1, tail * sizeof(chunk->alloc[0]));
+    chunk->count--;
+    table->blocks--;
+
+    if (chunk->count == 0) {
+        free(chunk);
+        memmove(table->chunks + pos.chunk, table->chunks + pos.chunk + 1,
+                (table->chunkCount - pos.chunk - 1) * sizeof(BtChunk *));
+        table->chunkCount--;
+    }
+}
+
+// the position after pos, or notFound at the end of the table
+static BtPos nextPos(BlockTable *table, BtPos pos)
+{
+    if (++pos.index < table->chunks[pos.chunk]->count)
+        return pos;
+    if (++pos.chunk < table->chunkCount) {
+        pos.index = 0;
+        return pos;
+    }
+    return notFound;
+}
+
+static BtPos prevPos(BlockTable *table, BtPos pos)
+{
+    if (pos.index > 0) {
+        pos.index--;
+        return pos;
+    }
+    if (pos.chunk > 0) {
+        pos.chunk--;
+        pos.index = table->chunks[pos.chunk]->count - 1;
+        return pos;
+    }
+    return notFound;
+}
+
+// the block containing offset, found by binary search over the chunks and then within one
+static BtPos locate(BlockTable *table, unsigned int offset)
+{
+    int lo = 0, hi = table->chunkCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (table->chunks[mid]->offset[0] <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    BtChunk *chunk = table->chunks[lo];
+    int first = 0, last = chunk->count - 1;
+    while (first < last) {
+        int mid = (first + last + 1) / 2;
+        if (chunk->offset[mid] <= offset)
+            first = mid;
+        else
+            last = mid - 1;
+    }
+    return (BtPos) { lo, first };
+}
+
+static BtPos findFirst(BlockTable *table, int requested, BtPos from, BtPos until)
+{
+    int c, i;
+    for (c = from.chunk; c < table->chunkCount; c++) {
+        BtChunk *chunk = table->chunks[c];
+        int end = c == until.chunk ? until.index : chunk->count;
+        for (i = c == from.chunk ? from.index : 0; i < end; i++)
+            if (!chunk->alloc[i] && chunk->size[i] >= requested)
+                return (BtPos) { c, i };
+        if (c == until.chunk)
+            break;
+    }
+    return notFound;
+}
+
+// smallest (best) or largest (worst) free block that fits; the first one wins ties
+static BtPos findExtreme(BlockTable *table, int requested, int largest)
+{
+    BtPos found = notFound;
+    long foundSize = largest ? 0 : (long) table->poolSize + 1;
+    int c, i;
+
+    for (c = 0; c < table->chunkCount; c++) {
+        BtChunk *chunk = table->chunks[c];
+        for (i = 0; i < chunk->count; i++) {
+            int size = chunk->size[i];
+            if (chunk->alloc[i] || size < requested)
+                continue;
+            if (largest ? size > foundSize : size < foundSize) {
+                found = (BtPos) { c, i };
+                foundSize = size;
+            }
+        }
+    }
+    return found;
+}
+
+static BtPos findPos(BlockTable *table, strategies strategy, size_t requested)
+{
+    BtPos start = { 0, 0 }, end = { table->chunkCount - 1, table->chunks[table->chunkCount - 1]->count };
+    BtPos rover, found;
+
+    switch (strategy)
+    {
+        case Best:
+            return findExtreme(table, (int) requested, 0);
+        case Worst:
+            return findExtreme(table, (int) requested, 1);
+        case Next:
+            // from the rover to the end, then from the start up to the rover
+            rover = locate(table, table->rover);
+            found = findFirst(table, (int) requested, rover, end);
+            return found.chunk >= 0 ? found : findFirst(table, (int) requested, start, rover);
+        default:
+            return findFirst(table, (int) requested, start, end);
+    }
+}
+
+/* Offset of the block the strategy would place a request in, or -1 */
+long blocktable_find(BlockTable *table, strategies strategy, size_t requested)
+{
+    BtPos pos = findPos(table, strategy, requested);
+    return pos.chunk < 0 ? -1 : (long) table->chunks[pos.chunk]->offset[pos.index];
+}
+
+/* Places a block like mymalloc does; returns its offset in the pool, or -1 if nothing fits */
+long blocktable_alloc(BlockTable *table, strategies strategy, size_t requested)
+{
+    BtPos pos = findPos(table, strategy, requested);
+    if (pos.chunk < 0)
+        return -1;
+
+    BtChunk *chunk = table->chunks[pos.chunk];
+    unsigned int offset = chunk->offset[pos.index];
+
+    if (chunk->size[pos.index] > requested) {
+        // the left-over part becomes a free block right after the allocated one
+        BtPos rest = insertAt(table, (BtPos) { pos.chunk, pos.index + 1 });
+        if (rest.chunk < 0)
+            return -1;
+        pos = prevPos(table, rest);
+        chunk = table->chunks[pos.chunk];
+        BtChunk *restChunk = table->chunks[rest.chunk];
+        restChunk->offset[rest.index] = offset + requested;
+        restChunk->size[rest.index] = chunk->size[pos.index] - (int) requested;
+        restChunk->alloc[rest.index] = 0;
+        chunk->size[pos.index] = (int) requested;
+    }
+    chunk->alloc[pos.index] = 1;
+
+    // like mymalloc, the next search starts after the block just handed out (wrapping to the start)
+    BtPos after = nextPos(table, pos);
+    table->rover = after.chunk < 0 ? 0 : table->chunks[after.chunk]->offset[after.index];
+    return offset;
+}
+
+/* Frees the block starting at offset and merges it with free neighbours; returns -1 if there is none */
+int blocktable_free(BlockTable *table, long offset)
+{
+    if (offset < 0 || offset >= (long) table->poolSize)
+        return -1;
+
+    BtPos pos = locate(table, (unsigned int) offset);
+    BtChunk *chunk = table->chunks[pos.chunk];
+    if (chunk->offset[pos.index] != offset || !chunk->alloc[pos.index])
+        return -1;
+
+    chunk->alloc[pos.index] = 0;
+
+    BtPos right = nextPos(table, pos);
+    if (right.chunk >= 0 && !table->chunks[right.chunk]->alloc[right.index]) {
+        chunk->size[pos.index] += table->chunks[right.chunk]->size[right.index];
+        removeAt(table, right);
+    }
+
+    BtPos left = prevPos(table, pos);
+    if (left.chunk >= 0 && !table->chunks[left.chunk]->alloc[left.index]) {
+        table->chunks[left.chunk]->size[left.index] += chunk->size[pos.index];
+        removeAt(table, pos);
+    }
+    // a rover inside a merged block keeps pointing at it: Next searches locate() the containing block
+    return 0;
+}
+
+int blocktable_largest_free(BlockTable *table)
+{
+    int c, i, largest = 0;
+    for (c = 0; c < table->chunkCount; c++) {
+        BtChunk *chunk = table->chunks[c];
+        for (i = 0; i < chunk->count; i++)
+            if (!chunk->alloc[i] && chunk->size[i] > largest)
+                largest = chunk->size[i];
+    }
+    return largest;
+}
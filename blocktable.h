@@ -0,0 +1,34 @@
+/* Block table: the same bookkeeping as the MemList chain, but kept in address order in
+ * contiguous struct-of-arrays chunks. A fit search is a linear scan over the size and alloc
+ * arrays, which the hardware prefetcher can follow, instead of a pointer chase through nodes.
+ * Splits and merges shift entries within one chunk of at most BT_CHUNK blocks; a full chunk is
+ * split in two, an empty one is dropped.
+ *
+ * Include mymem.h first; the strategies are the ones mymalloc understands (First, Best, Worst, Next).
+ */
+#define BT_CHUNK 512
+
+typedef struct btChunk
+{
+    int count;
+    unsigned int offset[BT_CHUNK];   // start of each block, relative to the pool
+    int size[BT_CHUNK];
+    char alloc[BT_CHUNK];            // 1 if the block is allocated, 0 if it is free
+} BtChunk;
+
+typedef struct blockTable
+{
+    BtChunk **chunks;     // in address order
+    int chunkCount;
+    int chunkCapacity;
+    int blocks;
+    size_t poolSize;
+    unsigned int rover;   // offset the next-fit search starts from
+} BlockTable;
+
+BlockTable *blocktable_create(size_t poolSize);
+void blocktable_destroy(BlockTable *table);
+long blocktable_alloc(BlockTable *table, strategies strategy, size_t requested);
+int blocktable_free(BlockTable *table, long offset);
+long blocktable_find(BlockTable *table, strategies strategy, size_t requested);
+int blocktable_largest_free(BlockTable *table);
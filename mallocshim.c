@@ -0,0 +1,316 @@
+/*
+ * LD_PRELOAD shim that serves a program's malloc family from the mymem pool.
+ *
+ *   make libmymem.so
+ *   MYMEM_POOL_SIZE=512m MYMEM_STRATEGY=best LD_PRELOAD=./libmymem.so <program>
+ *
+ * Environment:
+ *   MYMEM_POOL_SIZE  pool size in bytes, with an optional k/m/g suffix (default 256m)
+ *   MYMEM_STRATEGY   best, worst, first, next, adaptive, bitmap or lifo (default first)
+ *   MYMEM_QUICKLISTS cache freed blocks of up to this many bytes on quick lists (default 0, off)
+ *   MYMEM_SAMPLE_RATE guard one in this many allocations to catch overflows and uses after free
+ *                    (default 0, off; see mem_set_guarded_sampling)
+ *   MYMEM_HEAP_PROFILE sample one allocation per this many bytes for a heap profile (default 0, off)
+ *   MYMEM_HEAP_PROFILE_FILE where the profile is written at exit (default mymem.heap)
+ *   MYMEM_NUMA       a node number to bind the pool to, "interleave" or "local" (see mem_set_numa_policy)
+ *   MYMEM_MMAP_THRESHOLD map requests of at least this many bytes on their own, with an optional
+ *                    k/m/g suffix (default 0, off; see mem_set_mmap_threshold)
+ *   MYMEM_TELEMETRY  set to 1 to publish live counters for mymemstat in /mymem.<pid>, or to a
+ *                    segment name starting with '/' (see mem_start_telemetry)
+ *   MYMEM_STATS      set to 0 to skip the print_memory_status() style report at exit
+ *
+ * mymem.c keeps its nodes in mmap'ed slabs and its pool in an mmap'ed region, so nothing
+ * below these entry points calls back into malloc. Requests that arrive while the pool is
+ * being set up are served from a small static bootstrap area instead.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mymem.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+#define MALLOC_ALIGN 16
+#define DEFAULT_POOL_SIZE (256UL << 20)
+#define BOOTSTRAP_SIZE (64 << 10)
+
+/* recursive, so a malloc from inside the exit report cannot deadlock */
+static pthread_mutex_t lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static int initialized;
+static int initializing;
+static int reportFd = -1;  /* private copy of stderr for the exit report */
+static int profileFd = -1; /* heap profile output, opened at startup */
+static strategies poolStrategy;
+
+/* Bootstrap allocations carry their size in a header so realloc can copy them out. */
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(MALLOC_ALIGN)));
+static size_t bootstrapUsed;
+
+static int isBootstrap(void *ptr)
+{
+	return (char *) ptr >= bootstrap && (char *) ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+static void *bootstrapAlloc(size_t size)
+{
+	size_t total = MALLOC_ALIGN + ((size + MALLOC_ALIGN - 1) & ~(size_t)(MALLOC_ALIGN - 1));
+	if (total > BOOTSTRAP_SIZE - bootstrapUsed)
+		return NULL;
+	char *block = bootstrap + bootstrapUsed;
+	bootstrapUsed += total;
+	*(size_t *) block = size;
+	return block + MALLOC_ALIGN;
+}
+
+static size_t parseSize(const char *text, size_t fallback)
+{
+	char *end;
+	size_t size;
+
+	if (text == NULL)
+		return fallback;
+	size = strtoull(text, &end, 10);
+	switch (*end)
+	{
+		case 'g': case 'G': size <<= 10; /* fall through */
+		case 'm': case 'M': size <<= 10; /* fall through */
+		case 'k': case 'K': size <<= 10;
+	}
+	/* MemList sizes are ints */
+	return size > 0 && size <= INT32_MAX ? size : fallback;
+}
+
+static void lockForFork(void) { pthread_mutex_lock(&lock); }
+static void unlockForFork(void) { pthread_mutex_unlock(&lock); }
+/* the child's thread does not own the recursive lock its parent took, so start it over; the
+   heap profile file is the parent's, and a second profile appended to it would not parse */
+static void resetAfterFork(void)
+{
+	lock = (pthread_mutex_t) PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+	if (profileFd >= 0) {
+		close(profileFd);
+		profileFd = -1;
+	}
+}
+
+/* called with the lock held */
+static void initialize(void)
+{
+	strategies strategy;
+	const char *name;
+
+	initializing = 1;
+
+	name = getenv("MYMEM_STRATEGY");
+	strategy = name != NULL ? strategyFromString((char *) name) : First;
+	if (strategy == NotSet)
+		strategy = First;
+	name = getenv("MYMEM_STATS");
+	if (name == NULL || strcmp(name, "0") != 0)
+		reportFd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+
+	name = getenv("MYMEM_QUICKLISTS");
+	if (name != NULL)
+		mem_set_quicklists(atoi(name));
+
+	name = getenv("MYMEM_SAMPLE_RATE");
+	if (name != NULL)
+		mem_set_guarded_sampling(atoi(name), 64);
+
+	name = getenv("MYMEM_HEAP_PROFILE");
+	if (name != NULL && atol(name) > 0 && mem_set_heap_profile(atol(name)) == 0) {
+		const char *path = getenv("MYMEM_HEAP_PROFILE_FILE");
+		profileFd = open(path != NULL ? path : "mymem.heap", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+
+	name = getenv("MYMEM_NUMA");
+	if (name != NULL) {
+		if (strcmp(name, "interleave") == 0)
+			mem_set_numa_policy(MEM_NUMA_INTERLEAVE, 0);
+		else if (strcmp(name, "local") == 0)
+			mem_set_numa_policy(MEM_NUMA_LOCAL, 0);
+		else
+			mem_set_numa_policy(MEM_NUMA_BIND, atoi(name));
+	}
+
+	name = getenv("MYMEM_MMAP_THRESHOLD");
+	if (name != NULL)
+		mem_set_mmap_threshold(parseSize(name, 0));
+
+	name = getenv("MYMEM_TELEMETRY");
+	if (name != NULL && (name[0] == '/' || strcmp(name, "1") == 0))
+		mem_start_telemetry(name[0] == '/' ? name : NULL);
+
+	poolStrategy = strategy;
+	initmem(strategy, parseSize(getenv("MYMEM_POOL_SIZE"), DEFAULT_POOL_SIZE));
+	pthread_atfork(lockForFork, unlockForFork, resetAfterFork);
+
+	initializing = 0;
+	initialized = 1;
+}
+
+static void *allocate(size_t alignment, size_t size)
+{
+	void *ptr;
+
+	/* MemList sizes are ints; checked before rounding, which would wrap a size near SIZE_MAX */
+	if (size > INT32_MAX - (MALLOC_ALIGN - 1)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	/* every block size is a multiple of MALLOC_ALIGN, so every block start stays aligned */
+	size = size == 0 ? MALLOC_ALIGN : (size + MALLOC_ALIGN - 1) & ~(size_t)(MALLOC_ALIGN - 1);
+
+	pthread_mutex_lock(&lock);
+	if (initializing) {
+		ptr = bootstrapAlloc(size);
+		pthread_mutex_unlock(&lock);
+		return ptr;
+	}
+	if (!initialized)
+		initialize();
+	ptr = alignment <= MALLOC_ALIGN ? mymalloc(size) : mymemalign(alignment, size);
+	pthread_mutex_unlock(&lock);
+
+	if (ptr == NULL)
+		errno = ENOMEM;
+	return ptr;
+}
+
+/* usable size of a block, or 0 for pointers we did not hand out */
+static size_t blockSize(void *ptr)
+{
+	size_t size;
+
+	if (isBootstrap(ptr))
+		return *(size_t *) ((char *) ptr - MALLOC_ALIGN);
+
+	pthread_mutex_lock(&lock);
+	size = mem_block_size(ptr);
+	pthread_mutex_unlock(&lock);
+	return size;
+}
+
+EXPORT void *malloc(size_t size)
+{
+	return allocate(MALLOC_ALIGN, size);
+}
+
+EXPORT void free(void *ptr)
+{
+	if (ptr == NULL || isBootstrap(ptr))
+		return;
+	pthread_mutex_lock(&lock);
+	myfree(ptr);
+	pthread_mutex_unlock(&lock);
+}
+
+EXPORT void *calloc(size_t count, size_t size)
+{
+	void *ptr;
+
+	if (size != 0 && count > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	ptr = allocate(MALLOC_ALIGN, count * size);
+	if (ptr != NULL)
+		memset(ptr, 0, count * size); /* pool memory is recycled, so it is not zeroed */
+	return ptr;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+	size_t oldSize;
+	void *moved;
+
+	if (ptr == NULL)
+		return malloc(size);
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	oldSize = blockSize(ptr);
+	if (oldSize >= size && !isBootstrap(ptr))
+		return ptr;
+
+	moved = malloc(size);
+	if (moved == NULL)
+		return NULL;
+	memcpy(moved, ptr, oldSize < size ? oldSize : size);
+	free(ptr);
+	return moved;
+}
+
+EXPORT int posix_memalign(void **result, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void *) != 0)
+		return EINVAL;
+	ptr = allocate(alignment, size);
+	if (ptr == NULL)
+		return ENOMEM;
+	*result = ptr;
+	return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return allocate(alignment, size);
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+	return aligned_alloc(alignment, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+	return allocate(4096, size);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+	return ptr != NULL ? blockSize(ptr) : 0;
+}
+
+/* Same figures as print_memory_status(), but on a copy of stderr taken at startup: stdout may be
+ * the program's real output, and many programs close both streams before destructors run. */
+__attribute__((destructor))
+static void reportAtExit(void)
+{
+	struct mem_stats stats = { .small_size = 0 };
+
+	if (!initialized)
+		return;
+	pthread_mutex_lock(&lock);
+	mem_stop_telemetry(); // the segment goes with the process
+	if (profileFd >= 0)
+		mem_write_heap_profile(profileFd);
+	if (reportFd < 0) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	mem_snapshot(&stats);
+	dprintf(reportFd, "mymem (%s) at exit:\n", strategy_name(poolStrategy));
+	dprintf(reportFd, "%d out of %d bytes allocated.\n", stats.allocated_bytes, mem_total());
+	dprintf(reportFd, "%d bytes are free in %d holes; maximum allocatable block is %d bytes.\n", stats.free_bytes, stats.holes, stats.largest_free);
+	dprintf(reportFd, "Average hole size is %f.\n", ((float) stats.free_bytes) / stats.holes);
+	dprintf(reportFd, "External fragmentation is %f; %d nodes use %zu bytes of metadata.\n", stats.fragmentation, stats.nodes, stats.metadata_bytes);
+	if (stats.direct_blocks > 0)
+		dprintf(reportFd, "%d blocks are mapped on their own, in %zu bytes.\n", stats.direct_blocks, stats.direct_bytes);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,1220 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mymem.h"
+#include "blocktable.h"
+#include "arena.h"
+#include "objpool.h"
+#include "sharedpool.h"
+#include "perfcount.h"
+#include "testrunner.h"
+
+/* Benchmarks for the allocator. Run "membench <benchmark> <strategy>"; results go to stdout.
+ * They reuse the testrunner, so "all" runs every benchmark and "-j N" runs them side by side.
+ */
+
+#define BLOCK 16
+#define SCAN_STEPS 20000000L   // blocks visited per measurement, spread over repeated searches
+
+static double now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/* Average cost of one search of the strategy that visits every block (nothing fits), per block */
+static double time_list_scan(strategies strategy, int blocks)
+{
+	long reps = SCAN_STEPS / blocks + 1, r;
+	MemList *found = NULL;
+	double start = now_ns();
+
+	for (r = 0; r < reps; r++)
+	{
+		switch (strategy)
+		{
+			case Best: found = findBestFit(2 * BLOCK); break;
+			case Worst: found = findWorstFit(2 * BLOCK); break;
+			default: found = findFirstFit(2 * BLOCK); break;
+		}
+	}
+	if (found != NULL)
+		printf("unexpected fit\n");
+	return (now_ns() - start) / reps / blocks;
+}
+
+static double time_table_scan(BlockTable *table, strategies strategy, int blocks)
+{
+	long reps = SCAN_STEPS / blocks + 1, r;
+	long found = -1;
+	double start = now_ns();
+
+	for (r = 0; r < reps; r++)
+		found = blocktable_find(table, strategy, 2 * BLOCK);
+	if (found != -1)
+		printf("unexpected fit\n");
+	return (now_ns() - start) / reps / blocks;
+}
+
+/* MemList chain vs. struct-of-arrays block table.
+ * Both hold the same heap: blocks of BLOCK bytes filling the pool, every other one free, so a
+ * request for 2*BLOCK bytes makes each fit search walk the whole heap.
+ * The list's nodes come from the slab allocator in build order, which is the friendliest
+ * layout a list can have; on a long-running heap they are scattered and each step costs more.
+ */
+int bench_blocktable(int argc, char **argv)
+{
+	int sizes[] = { 1000, 100000, 1000000 };
+	strategies strategies[] = { First, Best, Worst };
+	int s, k, i;
+
+	printf("\n%10s %8s %14s %14s %8s\n", "blocks", "fit", "list ns/block", "table ns/block", "speedup");
+	for (s = 0; s < 3; s++)
+	{
+		int blocks = sizes[s];
+		MemList **nodes = malloc(blocks * sizeof(MemList *));
+		BlockTable *table = blocktable_create((size_t) blocks * BLOCK);
+
+		/* placing with next-fit keeps building O(1) per block */
+		initmem(First, (size_t) blocks * BLOCK);
+		mem_reserve_nodes(blocks); // nodes[] must not move while the heap is built
+		for (i = 0; i < blocks; i++)
+		{
+			nodes[i] = findNextFit(BLOCK);
+			allocateMem(nodes[i], BLOCK);
+			blocktable_alloc(table, Next, BLOCK);
+		}
+		for (i = 1; i < blocks; i += 2)
+		{
+			releaseBlock(nodes[i]);
+			blocktable_free(table, (long) i * BLOCK);
+		}
+
+		for (k = 0; k < 3; k++)
+		{
+			double list = time_list_scan(strategies[k], blocks);
+			double array = time_table_scan(table, strategies[k], blocks);
+			printf("%10d %8s %14.3f %14.3f %7.2fx\n", blocks, strategy_name(strategies[k]), list, array, list / array);
+		}
+
+		free(nodes);
+		blocktable_destroy(table);
+	}
+	printf("metadata per block: list %zu bytes, table %zu bytes\n\n", sizeof(MemList),
+	       sizeof(int) + sizeof(unsigned int) + sizeof(char));
+	return 0;
+}
+
+/* set by bench_counters: time_workload then also counts its loop with these */
+static PerfCounters workloadCounters;
+static int workloadCounting;
+
+/* One of the stress suite's randomized workloads, without the per-iteration statistics walk:
+ * allocate while less than fillRatio of the pool is requested, otherwise (or after a failure)
+ * free a random block. Returns the average time per mymalloc/myfree call in ns. */
+static double time_workload(strategies strategy, int poolSize, float fillRatio, int minBlock, int maxBlock, int iterations)
+{
+	static void *pointers[100000];
+	static int sizes[100000];
+	int stored = 0, i;
+	long requested = 0;
+	int force_free = 0;
+	double start;
+
+	initmem(strategy, poolSize);
+	srand(1);
+	if (workloadCounting)
+	{
+		perfcount_reset(&workloadCounters);
+		perfcount_resume(&workloadCounters);
+	}
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+	{
+		if (!force_free && requested < poolSize * fillRatio && stored < 100000)
+		{
+			int size = rand() % (maxBlock - minBlock + 1) + minBlock;
+			void *pointer = mymalloc(size);
+			if (pointer == NULL)
+				force_free = 1;
+			else {
+				pointers[stored] = pointer;
+				sizes[stored++] = size;
+				requested += size;
+			}
+		}
+		else if (stored > 0)
+		{
+			int chosen = rand() % stored;
+			force_free = 0;
+			myfree(pointers[chosen]);
+			requested -= sizes[chosen];
+			pointers[chosen] = pointers[--stored];
+			sizes[chosen] = sizes[stored];
+		}
+	}
+	double took = (now_ns() - start) / iterations;
+	if (workloadCounting)
+	{
+		perfcount_pause(&workloadCounters);
+		perfcount_read(&workloadCounters);
+	}
+	return took;
+}
+
+/* Bitmap strategy (both kernels) against First on the stress suite's workloads, on the stress
+ * suite's 10000 byte pool and on a pool 100 times larger with the same block sizes.
+ */
+int bench_bitmap(int argc, char **argv)
+{
+	struct { float fill; int min, max; } workloads[] = {
+		{ 0.25, 1, 1000 }, { 0.25, 1000, 2000 }, { 0.5, 1, 2000 }, { 0.5, 1000, 1000 },
+		{ 0.75, 1, 1000 }, { 0.75, 500, 1000 }, { 0.9, 1, 500 },
+	};
+	int pools[] = { 10000, 1000000 };
+	int avx2 = mem_set_bitmap_kernel(MEM_KERNEL_AVX2) == MEM_KERNEL_AVX2;
+	int p, w;
+
+	printf("\n%8s %5s %10s %10s %14s %14s\n", "pool", "fill", "sizes", "first ns", "bitmap ns", "bitmap avx2 ns");
+	for (p = 0; p < 2; p++)
+	{
+		for (w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+		{
+			char sizes[24];
+			double first = time_workload(First, pools[p], workloads[w].fill, workloads[w].min, workloads[w].max, 200000);
+			mem_set_bitmap_kernel(MEM_KERNEL_SCALAR);
+			double scalar = time_workload(Bitmap, pools[p], workloads[w].fill, workloads[w].min, workloads[w].max, 200000);
+			double simd = 0;
+			if (avx2) {
+				mem_set_bitmap_kernel(MEM_KERNEL_AVX2);
+				simd = time_workload(Bitmap, pools[p], workloads[w].fill, workloads[w].min, workloads[w].max, 200000);
+			}
+
+			snprintf(sizes, sizeof(sizes), "%d-%d", workloads[w].min, workloads[w].max);
+			printf("%8d %5.2f %10s %10.1f %14.1f ", pools[p], workloads[w].fill, sizes, first, scalar);
+			if (avx2)
+				printf("%14.1f\n", simd);
+			else
+				printf("%14s\n", "n/a");
+		}
+	}
+	printf("granule %d bytes\n\n", mem_set_granule(0));
+	mem_set_bitmap_kernel(MEM_KERNEL_SCALAR);
+	return 0;
+}
+
+/* First and Next with the fit index against the list walks, on the stress workloads' mix of
+ * block sizes in pools of growing size, so the number of blocks grows with the pool.
+ */
+int bench_fitindex(int argc, char **argv)
+{
+	int pools[] = { 10000, 1000000, 10000000 };
+	strategies strategies[] = { First, Next };
+	int p, k;
+
+	printf("\n%10s %8s %12s %12s %8s\n", "pool", "fit", "list ns", "index ns", "speedup");
+	for (p = 0; p < 3; p++)
+	{
+		for (k = 0; k < 2; k++)
+		{
+			mem_set_fit_index(0);
+			double list = time_workload(strategies[k], pools[p], 0.75, 1, 1000, 100000);
+			mem_set_fit_index(1);
+			double index = time_workload(strategies[k], pools[p], 0.75, 1, 1000, 100000);
+			printf("%10d %8s %12.1f %12.1f %7.2fx\n", pools[p], strategy_name(strategies[k]), list, index, list / index);
+		}
+	}
+	printf("\n");
+	return 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+/* Cost of guarded sampling at a range of rates, on one of the stress workloads in a 1MB pool.
+ * Every round times each rate right next to a run with sampling off, in alternating order, and
+ * keeps the ratio of the two; a rate's overhead is its median ratio over GUARDED_RUNS rounds.
+ * Pairing the runs cancels drift in the machine's speed, which is larger than the 1% to be shown.
+ * "off" is paired with another run with sampling off: its overhead is the noise that is left.
+ */
+#define GUARDED_RUNS 301
+#define GUARDED_RATES 6
+
+static double median_of(double *runs, int count)
+{
+	qsort(runs, count, sizeof(double), compare_doubles);
+	return runs[count / 2];
+}
+
+int bench_guarded(int argc, char **argv)
+{
+	int rates[GUARDED_RATES] = { 0, 100, 1000, 3000, 10000, 100000 };
+	static double ratios[GUARDED_RATES][GUARDED_RUNS];
+	double overhead[GUARDED_RATES];
+	int r, round, under = 0;
+
+	for (round = 0; round < GUARDED_RUNS; round++)
+	{
+		for (r = 0; r < GUARDED_RATES; r++)
+		{
+			double ns[2];
+			int first = round % 2;
+			mem_set_guarded_sampling(first ? rates[r] : 0, 64);
+			ns[first] = time_workload(First, 1 << 20, 0.5, 1, 1000, 50000);
+			mem_set_guarded_sampling(first ? 0 : rates[r], 64);
+			ns[!first] = time_workload(First, 1 << 20, 0.5, 1, 1000, 50000);
+			ratios[r][round] = ns[1] / ns[0];
+		}
+	}
+	mem_set_guarded_sampling(0, 0);
+
+	printf("\n%8s %10s\n", "rate", "overhead");
+	for (r = 0; r < GUARDED_RATES; r++)
+	{
+		overhead[r] = (median_of(ratios[r], GUARDED_RUNS) - 1) * 100;
+		if (r == 0)
+			printf("%8s %9.2f%%  (noise)\n", "off", overhead[r]);
+		else
+			printf("%8d %9.2f%%\n", rates[r], overhead[r]);
+	}
+	// the densest rate from which on every rate measured stays under 1%, noise included
+	for (r = GUARDED_RATES - 1; r > 0 && overhead[r] + fabs(overhead[0]) < 1; r--)
+		under = rates[r];
+	if (under > 0)
+		printf("overhead under 1%% at one in %d allocations or fewer\n\n", under);
+	else
+		printf("overhead not under 1%% at any rate measured\n\n");
+	return 0;
+}
+
+/* Producer/consumer handoff: the owner allocates every buffer and passes it to one of the freeing
+ * threads through a single-producer, single-consumer ring; the freeing threads give it back to
+ * the pool either with myfree behind a mutex the owner's mymalloc also takes, or with a remote
+ * free that the owner applies on its next mymalloc.
+ */
+#define HANDOFF_SIZE 1024
+#define HANDOFF_BUFFERS 1000000
+#define MAX_FREERS 8
+
+struct handoff {
+	void *slots[HANDOFF_SIZE];
+	atomic_long head, tail;     // head: next to take (freeing thread), tail: next to fill (owner)
+	pthread_mutex_t *lock;      // NULL with remote frees
+};
+
+static void *freeing_thread(void *arg)
+{
+	struct handoff *ring = arg;
+	for (;;)
+	{
+		long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		if (head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+			sched_yield();
+			continue;
+		}
+		void *buffer = ring->slots[head % HANDOFF_SIZE];
+		atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+		if (buffer == NULL)
+			return NULL;
+		if (ring->lock != NULL)
+			pthread_mutex_lock(ring->lock);
+		myfree(buffer);
+		if (ring->lock != NULL)
+			pthread_mutex_unlock(ring->lock);
+	}
+}
+
+static void handoff_put(struct handoff *ring, void *buffer)
+{
+	long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == HANDOFF_SIZE)
+		sched_yield();
+	ring->slots[tail % HANDOFF_SIZE] = buffer;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// buffers per second through the pool with the given number of freeing threads
+static double time_handoff(int freers, int remote)
+{
+	static struct handoff rings[MAX_FREERS];
+	pthread_t threads[MAX_FREERS];
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	int i, t;
+
+	mem_set_remote_frees(remote);
+	initmem(First, 1 << 20);
+	for (t = 0; t < freers; t++)
+	{
+		atomic_store(&rings[t].head, 0);
+		atomic_store(&rings[t].tail, 0);
+		rings[t].lock = remote ? NULL : &lock;
+		pthread_create(&threads[t], NULL, freeing_thread, &rings[t]);
+	}
+
+	double start = now_ns();
+	for (i = 0; i < HANDOFF_BUFFERS; i++)
+	{
+		void *buffer;
+		for (;;)
+		{
+			if (!remote)
+				pthread_mutex_lock(&lock);
+			buffer = mymalloc(64 + i % 64);
+			if (!remote)
+				pthread_mutex_unlock(&lock);
+			if (buffer != NULL)
+				break;
+			sched_yield(); // the pool is full of buffers still waiting to be freed
+		}
+		handoff_put(&rings[i % freers], buffer);
+	}
+	for (t = 0; t < freers; t++)
+		handoff_put(&rings[t], NULL);
+	for (t = 0; t < freers; t++)
+		pthread_join(threads[t], NULL);
+	double elapsed = now_ns() - start;
+
+	mem_set_remote_frees(0);
+	return HANDOFF_BUFFERS / (elapsed / 1e9);
+}
+
+int bench_remotefree(int argc, char **argv)
+{
+	int freers;
+
+	printf("\n%8s %16s %16s\n", "freers", "mutex buf/s", "remote buf/s");
+	for (freers = 1; freers <= MAX_FREERS; freers *= 2)
+		printf("%8d %16.0f %16.0f\n", freers, time_handoff(freers, 0), time_handoff(freers, 1));
+	printf("\n");
+	return 0;
+}
+
+/* Per-request data freed all at once: each request allocates objects of 16 to 256 bytes and
+ * drops them at its end, either with one myfree per object or with a single arena_reset. A few
+ * long-lived blocks stay in the pool so the searches have something to walk past.
+ */
+#define ARENA_REQUESTS 2000
+#define ARENA_OBJECTS 1000
+
+static double time_requests(strategies strategy, int useArena)
+{
+	static void *objects[ARENA_OBJECTS];
+	Arena *arena;
+	int r, i;
+
+	initmem(strategy, 8 << 20);
+	for (i = 0; i < 1000; i++)
+		mymalloc(64 + i % 64);
+	arena = useArena ? arena_create(ARENA_OBJECTS * 256) : NULL;
+
+	srand(1);
+	double start = now_ns();
+	for (r = 0; r < ARENA_REQUESTS; r++)
+	{
+		for (i = 0; i < ARENA_OBJECTS; i++)
+		{
+			size_t size = 16 + rand() % 241;
+			objects[i] = useArena ? arena_alloc(arena, size) : mymalloc(size);
+		}
+		if (useArena)
+			arena_reset(arena, 0);
+		else
+			for (i = 0; i < ARENA_OBJECTS; i++)
+				myfree(objects[i]);
+	}
+	return (now_ns() - start) / ((double) ARENA_REQUESTS * ARENA_OBJECTS);
+}
+
+int bench_arena(int argc, char **argv)
+{
+	strategies strategies[] = { First, Best, Next, Bitmap };
+	int k;
+
+	printf("\n%8s %14s %14s %8s\n", "fit", "myfree ns/obj", "arena ns/obj", "speedup");
+	for (k = 0; k < 4; k++)
+	{
+		double each = time_requests(strategies[k], 0);
+		double arena = time_requests(strategies[k], 1);
+		printf("%8s %14.1f %14.1f %7.1fx\n", strategy_name(strategies[k]), each, arena, each / arena);
+	}
+	printf("\n");
+	return 0;
+}
+
+/* Many objects of one size: a working set of OBJPOOL_LIVE 32 byte objects in which a random one
+ * is replaced at each step, with mymalloc/myfree and with an object pool.
+ */
+#define OBJPOOL_LIVE 100000
+#define OBJPOOL_STEPS 2000000
+
+static double time_objects(strategies strategy, int usePool)
+{
+	static void *objects[OBJPOOL_LIVE];
+	ObjPool *pool;
+	long step;
+	int i;
+
+	initmem(strategy, 16 << 20);
+	pool = usePool ? objpool_create(32, 1000) : NULL;
+	for (i = 0; i < OBJPOOL_LIVE; i++)
+		objects[i] = usePool ? objpool_alloc(pool) : mymalloc(32);
+
+	srand(1);
+	double start = now_ns();
+	for (step = 0; step < OBJPOOL_STEPS; step++)
+	{
+		i = rand() % OBJPOOL_LIVE;
+		if (usePool) {
+			objpool_free(pool, objects[i]);
+			objects[i] = objpool_alloc(pool);
+		} else {
+			myfree(objects[i]);
+			objects[i] = mymalloc(32);
+		}
+	}
+	return (now_ns() - start) / OBJPOOL_STEPS;
+}
+
+int bench_objpool(int argc, char **argv)
+{
+	strategies strategies[] = { First, Next, Bitmap };
+	int k;
+
+	printf("\n%8s %14s %14s %8s\n", "fit", "mymalloc ns", "objpool ns", "speedup");
+	for (k = 0; k < 3; k++)
+	{
+		double each = time_objects(strategies[k], 0);
+		double pooled = time_objects(strategies[k], 1);
+		printf("%8s %14.1f %14.1f %7.1fx\n", strategy_name(strategies[k]), each, pooled, each / pooled);
+	}
+	printf("\n");
+	return 0;
+}
+
+/* Metadata the list keeps for the stress suite's workloads, in a 1MB pool left in the state
+ * the workload ends in: bytes per block, and as a share of the bytes handed out.
+ */
+int bench_metadata(int argc, char **argv)
+{
+	int maxBlocks[] = { 16, 64, 256, 1000 };
+	int k;
+
+	printf("\n%10s %8s %12s %14s %10s\n", "blocks", "nodes", "bytes/node", "metadata", "overhead");
+	for (k = 0; k < 4; k++)
+	{
+		struct mem_stats stats = { .small_size = 0 };
+		time_workload(First, 1 << 20, 0.75, 1, maxBlocks[k], 200000);
+		mem_snapshot(&stats);
+		printf("%5d-%-4d %8d %12.1f %14zu %9.1f%%\n", 1, maxBlocks[k], stats.nodes,
+		       (double) stats.metadata_bytes / stats.nodes, stats.metadata_bytes,
+		       100.0 * stats.metadata_bytes / stats.allocated_bytes);
+	}
+	printf("\n");
+	return 0;
+}
+
+/* Under each NUMA placement: the stress workload in a 64MB pool, then a pass writing the whole
+ * pool (which places every page) and the pages per node the pool ended up with. Remote pages
+ * show in the write pass. On a single-node machine every policy lands on node 0.
+ */
+int bench_numa(int argc, char **argv)
+{
+	int policies[] = { MEM_NUMA_DEFAULT, MEM_NUMA_BIND, MEM_NUMA_INTERLEAVE, MEM_NUMA_LOCAL };
+	char *names[] = { "default", "bind 0", "interleave", "local" };
+	int pages[8];
+	int p, node;
+
+	printf("\n%12s %12s %10s %10s  %s\n", "asked", "got", "ns/op", "write GB/s", "pages per node");
+	for (p = 0; p < 4; p++)
+	{
+		mem_set_numa_policy(policies[p], 0);
+		double ns = time_workload(First, 64 << 20, 0.5, 1, 4096, 300000);
+		double start = now_ns();
+		memset(mem_pool(), 1, mem_total());
+		double write = mem_total() / (now_ns() - start);
+		int nodes = mem_numa_placement(pages, 8);
+		printf("%12s %12s %10.1f %10.2f ", names[p], names[mem_numa_policy()], ns, write);
+		if (nodes < 0)
+			printf(" (not reported)");
+		for (node = 0; node < nodes && node < 8; node++)
+			printf(" %d:%d", node, pages[node]);
+		printf("\n");
+	}
+	mem_set_numa_policy(MEM_NUMA_DEFAULT, 0);
+	printf("\n");
+	return 0;
+}
+
+/* time_workload's randomized mix, timing every mymalloc/myfree call on its own; fills latencies
+ * (which the caller sorts) and returns the number of calls */
+static int time_each_call(strategies strategy, int maintenance, double *latencies, int iterations)
+{
+	static void *pointers[100000];
+	int stored = 0, i, calls = 0;
+
+	initmem(strategy, 64 << 20);
+	if (maintenance)
+		mem_start_maintenance(1000, 256);
+	srand(1);
+	for (i = 0; i < iterations; i++)
+	{
+		double start = now_ns();
+		if (stored < 100000 && (stored == 0 || rand() % 2))
+		{
+			void *pointer = mymalloc(rand() % 4096 + 1);
+			latencies[calls++] = now_ns() - start;
+			if (pointer != NULL)
+				pointers[stored++] = pointer;
+		}
+		else
+		{
+			int chosen = rand() % stored;
+			start = now_ns();
+			myfree(pointers[chosen]);
+			latencies[calls++] = now_ns() - start;
+			pointers[chosen] = pointers[--stored];
+		}
+	}
+	mem_stop_maintenance();
+	return calls;
+}
+
+/* Latency of single calls with and without the maintenance thread: with it, myfree only queues
+ * the block and coalescing and trimming happen between ticks, so the tail should come down. */
+int bench_maintenance(int argc, char **argv)
+{
+	static double latencies[1000000];
+	strategies strategy;
+	int lbound = 1, ubound = 7, on;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	printf("\n%10s %12s %10s %10s %10s %10s\n", "strategy", "maintenance", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+	for (strategy = lbound; strategy <= ubound; strategy++)
+		for (on = 0; on < 2; on++)
+		{
+			int calls = time_each_call(strategy, on, latencies, 1000000);
+			qsort(latencies, calls, sizeof(double), compare_doubles);
+			printf("%10s %12s %10.0f %10.0f %10.0f %10.0f\n", strategy_name(strategy), on ? "thread" : "inline",
+			       latencies[calls / 2], latencies[calls * 99 / 100], latencies[calls * 999 / 1000], latencies[calls - 1]);
+		}
+	printf("\n");
+	return 0;
+}
+
+/* Scaling curves: the per-call cost of each hot function on heaps of 10 to 1M blocks of BLOCK
+ * bytes that fill the pool, with one block in every freeEvery free (MEMBENCH_FREE_EVERY picks one
+ * shape; by default 2, 4 and 16 are run). No two free blocks touch, so a request for 2*BLOCK makes
+ * every fit search visit the whole heap. Rows go to MEMBENCH_CSV (default scaling.csv) as
+ * strategy,index,free_every,blocks,operation,ns_per_call,calls.
+ */
+#define SCALING_MIN_NS 2e6     // each measurement runs for at least this long
+#define SCALING_BITMAP_MAX 100000  // building a bitmap heap block by block is quadratic
+
+static void **scalingPtrs;
+static MemList **scalingNodes;
+static strategies scalingStrategy;
+static int scalingBlocks, scalingFreeEvery;
+
+static void build_heap()
+{
+	int i;
+
+	initmem(scalingStrategy, (size_t) scalingBlocks * BLOCK);
+	if (scalingStrategy != Bitmap)
+		mem_reserve_nodes(2 * (size_t) scalingBlocks); // scalingNodes[] stay put through the splits too
+	for (i = 0; i < scalingBlocks; i++)
+	{
+		if (scalingStrategy == Bitmap)
+			scalingPtrs[i] = mymalloc(BLOCK);
+		else {
+			/* the rover sits on the tail, so placing with next-fit keeps building O(1) per block */
+			scalingNodes[i] = findNextFit(BLOCK);
+			scalingPtrs[i] = allocateMem(scalingNodes[i], BLOCK);
+		}
+	}
+	for (i = 0; i < scalingBlocks; i += scalingFreeEvery)
+		if (scalingStrategy == Bitmap)
+			myfree(scalingPtrs[i]);
+		else
+			releaseBlock(scalingNodes[i]);
+}
+
+enum scaling_op { OP_GETSTRUCTPTR, OP_FIND, OP_HOLES, OP_ALLOCATED, OP_FREE, OP_LARGEST_FREE, OP_SMALL_FREE,
+                  OP_IS_ALLOC, OP_BLOCK_SIZE, OP_SPLIT, OP_FREE_NONE, OP_FREE_LEFT, OP_FREE_RIGHT, OP_FREE_BOTH };
+
+/* one call of a query that leaves the heap as it is; i picks a block */
+static long query(enum scaling_op op, int i)
+{
+	switch (op)
+	{
+		case OP_GETSTRUCTPTR: return (long) getStructPtr(scalingPtrs[i]);
+		case OP_FIND:
+			switch (scalingStrategy)
+			{
+				case Best: return (long) findBestFit(2 * BLOCK);
+				case Worst: return (long) findWorstFit(2 * BLOCK);
+				case Next: return (long) findNextFit(2 * BLOCK);
+				default: return (long) findFirstFit(2 * BLOCK);
+			}
+		case OP_HOLES: return mem_holes();
+		case OP_ALLOCATED: return mem_allocated();
+		case OP_FREE: return mem_free();
+		case OP_LARGEST_FREE: return mem_largest_free();
+		case OP_SMALL_FREE: return mem_small_free(BLOCK);
+		case OP_IS_ALLOC: return mem_is_alloc(scalingPtrs[i]);
+		default: return mem_block_size(scalingPtrs[i]);
+	}
+}
+
+/* ns per call of a query, in doubling batches until SCALING_MIN_NS have gone by */
+static double time_query(enum scaling_op op, long *calls)
+{
+	long batch, total = 0, sink = 0, k;
+	double elapsed = 0;
+
+	srand(1);
+	for (batch = 1; elapsed < SCALING_MIN_NS; batch *= 2)
+	{
+		double start = now_ns();
+		for (k = 0; k < batch; k++)
+			sink += query(op, rand() % scalingBlocks);
+		elapsed += now_ns() - start;
+		total += batch;
+	}
+	*calls = total + (sink == 42); // keeps the calls from being optimized away
+	return elapsed / total;
+}
+
+/* The blocks a changing operation is timed on, by their number in the heap: the free blocks that
+ * allocateMem splits, or the allocated blocks whose myfree finds no free neighbour, a free left
+ * or right one, or both (the block to the right is freed beforehand). Needs freeEvery >= 4 for
+ * the myfree cases. */
+static int pick_blocks(enum scaling_op op, int *picked)
+{
+	int i, count = 0;
+
+	for (i = 0; i < scalingBlocks; i++)
+	{
+		int phase = i % scalingFreeEvery;
+		if ((op == OP_FREE_RIGHT || op == OP_FREE_BOTH) && i + 1 == scalingBlocks)
+			break; // no block to the right
+		if ((op == OP_SPLIT && phase == 0) || (op == OP_FREE_NONE && phase == 2) ||
+		    ((op == OP_FREE_LEFT || op == OP_FREE_BOTH) && phase == 1) ||
+		    (op == OP_FREE_RIGHT && phase == scalingFreeEvery - 1))
+			picked[count++] = i;
+	}
+	return count;
+}
+
+static void prepare_blocks(enum scaling_op op, int *picked, int count)
+{
+	int k;
+
+	build_heap();
+	if (op != OP_FREE_BOTH)
+		return;
+	for (k = 0; k < count; k++)
+	{
+		if (scalingStrategy == Bitmap)
+			myfree(scalingPtrs[picked[k] + 1]);
+		else
+			releaseBlock(scalingNodes[picked[k] + 1]); // myfree would search for the node
+	}
+}
+
+/* ns per call of allocateMem splitting a free block or of a myfree case, in doubling batches over
+ * the picked blocks; the heap is built again whenever they run out */
+static double time_change(enum scaling_op op, int *picked, long *calls)
+{
+	int count = pick_blocks(op, picked), next = 0, k;
+	long batch, total = 0;
+	double elapsed = 0;
+
+	*calls = 0;
+	if (count == 0)
+		return -1;
+	srand(1);
+	for (k = count - 1; k > 0; k--)
+	{
+		// in random order, so a search that starts at the head of the list walks half of it on average
+		int other = rand() % (k + 1), swap = picked[k];
+		picked[k] = picked[other];
+		picked[other] = swap;
+	}
+	prepare_blocks(op, picked, count);
+	for (batch = 1; elapsed < SCALING_MIN_NS; batch *= 2)
+	{
+		long n = batch < count - next ? batch : count - next;
+		double start = now_ns();
+		if (op == OP_SPLIT)
+			for (k = next; k < next + n; k++)
+				allocateMem(scalingNodes[picked[k]], BLOCK / 2);
+		else
+			for (k = next; k < next + n; k++)
+				myfree(scalingPtrs[picked[k]]);
+		elapsed += now_ns() - start;
+		total += n;
+		next += n;
+		if (next == count)
+		{
+			prepare_blocks(op, picked, count);
+			next = 0;
+		}
+	}
+	*calls = total;
+	return elapsed / total;
+}
+
+int bench_scaling(int argc, char **argv)
+{
+	static const char *names[] = { "getStructPtr", "find", "mem_holes", "mem_allocated", "mem_free",
+		"mem_largest_free", "mem_small_free", "mem_is_alloc", "mem_block_size", "allocateMem_split",
+		"myfree_no_merge", "myfree_merge_left", "myfree_merge_right", "myfree_merge_both" };
+	int sizes[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+	int shapes[] = { 2, 4, 16 };
+	const char *path = getenv("MEMBENCH_CSV") != NULL ? getenv("MEMBENCH_CSV") : "scaling.csv";
+	int shapeCount = 3, lbound = 1, ubound = 7, rows = 0;
+	int index, shape, size, op;
+	int *picked;
+	FILE *csv;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+	if (getenv("MEMBENCH_FREE_EVERY") != NULL && atoi(getenv("MEMBENCH_FREE_EVERY")) >= 2)
+	{
+		shapes[0] = atoi(getenv("MEMBENCH_FREE_EVERY"));
+		shapeCount = 1;
+	}
+	if ((csv = fopen(path, "w")) == NULL)
+	{
+		printf("Cannot write %s\n", path);
+		return 1;
+	}
+	scalingPtrs = malloc(1000000 * sizeof(void *));
+	scalingNodes = malloc(1000000 * sizeof(MemList *));
+	picked = malloc(1000000 * sizeof(int));
+
+	fprintf(csv, "strategy,index,free_every,blocks,operation,ns_per_call,calls\n");
+	for (scalingStrategy = lbound; scalingStrategy <= ubound; scalingStrategy++)
+		for (index = 0; index < (scalingStrategy == Bitmap ? 1 : 2); index++)
+		{
+			mem_set_fit_index(index);
+			for (shape = 0; shape < shapeCount; shape++)
+				for (size = 0; size < 6; size++)
+				{
+					scalingFreeEvery = shapes[shape];
+					scalingBlocks = sizes[size];
+					if (scalingStrategy == Bitmap && scalingBlocks > SCALING_BITMAP_MAX)
+						continue;
+					build_heap();
+					for (op = OP_GETSTRUCTPTR; op <= OP_FREE_BOTH; op++)
+					{
+						long calls;
+						double ns;
+
+						// the list functions do not apply to Bitmap, and Adaptive has no search of its own
+						if (scalingStrategy == Bitmap && (op == OP_GETSTRUCTPTR || op == OP_FIND || op == OP_SPLIT))
+							continue;
+						if (scalingStrategy == Adaptive && op == OP_FIND)
+							continue;
+						if (op >= OP_SPLIT)
+						{
+							if (op > OP_SPLIT && scalingFreeEvery < 4)
+								continue;
+							ns = time_change(op, picked, &calls);
+							if (ns < 0)
+								continue; // the heap is too small to hold the case
+						}
+						else
+							ns = time_query(op, &calls);
+						fprintf(csv, "%s,%d,%d,%d,%s,%.1f,%ld\n", strategy_name(scalingStrategy), index,
+						        scalingFreeEvery, scalingBlocks, op == OP_FIND ? (scalingStrategy == Best ? "findBestFit" :
+						        scalingStrategy == Worst ? "findWorstFit" : scalingStrategy == Next ? "findNextFit" :
+						        "findFirstFit") : names[op], ns, calls);
+						rows++;
+					}
+					fflush(csv);
+				}
+		}
+	mem_set_fit_index(1);
+
+	fclose(csv);
+	free(scalingPtrs);
+	free(scalingNodes);
+	free(picked);
+	printf("\n%d rows written to %s\n\n", rows, path);
+	return 0;
+}
+
+/* Mostly small blocks with a few large ones among them: one request in 20 is 64KB-1MB. With the
+ * mmap threshold at 64KB the large ones are mapped on their own, so they neither break up the
+ * pool nor lengthen the list every search walks. ns per call, list length and fragmentation at
+ * the end.
+ */
+#define DIRECT_LIVE 4000
+#define DIRECT_STEPS 200000
+
+static double time_mixed_sizes(strategies strategy, size_t threshold, struct mem_stats *stats)
+{
+	static void *blocks[DIRECT_LIVE];
+	long step;
+	int i;
+
+	mem_set_mmap_threshold(threshold);
+	initmem(strategy, 256 << 20);
+	memset(blocks, 0, sizeof(blocks));
+	srand(1);
+	double start = now_ns();
+	for (step = 0; step < DIRECT_STEPS; step++)
+	{
+		i = rand() % DIRECT_LIVE;
+		if (blocks[i] != NULL)
+			myfree(blocks[i]);
+		blocks[i] = mymalloc(rand() % 20 == 0 ? (64 << 10) + rand() % (960 << 10) : 16 + rand() % 1008);
+	}
+	double ns = (now_ns() - start) / (2 * DIRECT_STEPS);
+	stats->small_size = 0;
+	mem_snapshot(stats);
+	mem_set_mmap_threshold(0);
+	return ns;
+}
+
+int bench_direct(int argc, char **argv)
+{
+	strategies strategies[] = { First, Best, Next, Bitmap };
+	struct mem_stats pooled, direct;
+	int k;
+
+	printf("\n%8s %12s %12s %8s %8s %8s %8s %8s\n", "fit", "pool ns/op", "mmap ns/op", "nodes", "nodes", "frag", "frag", "mapped");
+	for (k = 0; k < 4; k++)
+	{
+		double inPool = time_mixed_sizes(strategies[k], 0, &pooled);
+		double mapped = time_mixed_sizes(strategies[k], 64 << 10, &direct);
+		printf("%8s %12.1f %12.1f %8d %8d %8.3f %8.3f %8d\n", strategy_name(strategies[k]), inPool, mapped,
+		       pooled.nodes, direct.nodes, pooled.fragmentation, direct.fragmentation, direct.direct_blocks);
+	}
+	printf("\n");
+	return 0;
+}
+
+/* What publishing telemetry (mem_start_telemetry) adds to each mymalloc/myfree, on a stress
+ * workload with cheap searches (first and next fit with the fit index).
+ */
+int bench_telemetry(int argc, char **argv)
+{
+	strategies strategies[] = { First, Next };
+	int k;
+
+	printf("\n%8s %12s %12s %10s\n", "fit", "off ns/op", "on ns/op", "overhead");
+	for (k = 0; k < 2; k++)
+	{
+		double off = time_workload(strategies[k], 64 << 20, 0.5, 1, 4096, 2000000);
+		mem_start_telemetry("/membench.telemetry");
+		double on = time_workload(strategies[k], 64 << 20, 0.5, 1, 4096, 2000000);
+		mem_stop_telemetry();
+		printf("%8s %12.1f %12.1f %9.1f%%\n", strategy_name(strategies[k]), off, on, 100 * (on - off) / off);
+	}
+	printf("\n");
+	return 0;
+}
+
+/* Two processes hand buffers from producer to consumer: through a shared pool, where only the
+ * offset goes down a pipe and the consumer reads the buffer in place and frees it, and by copying
+ * the bytes through a pipe. The producer fills each buffer and the consumer sums it either way.
+ */
+#define EXCHANGE_BYTES (512L << 20)   // per buffer size
+
+static long sum_words(const long *words, size_t bytes)
+{
+	long sum = 0;
+	size_t i;
+	for (i = 0; i < bytes / sizeof(long); i++)
+		sum += words[i];
+	return sum;
+}
+
+static double time_exchange(size_t size, int shared)
+{
+	const char *name = "/membench.sharedpool";
+	long count = EXCHANGE_BYTES / size, n, offset, sum = 0;
+	char *buffer = malloc(size);
+	SharedPool *pool = NULL;
+	int channel[2];
+	pid_t child;
+
+	sharedpool_unlink(name);
+	if (shared && (pool = sharedpool_create(name, 64 << 20)) == NULL)
+		return -1;
+	if (pipe(channel) != 0)
+		return -1;
+	double start = now_ns();
+	if ((child = fork()) == 0)
+	{
+		close(channel[1]);
+		if (shared)
+		{
+			SharedPool *mine = sharedpool_open(name);
+			while (read(channel[0], &offset, sizeof(offset)) == sizeof(offset))
+			{
+				sum += sum_words(sharedpool_ptr(mine, offset), size);
+				sharedpool_free(mine, offset);
+			}
+		}
+		else
+			for (n = 0; n < count; n++)
+			{
+				size_t got = 0;
+				ssize_t r;
+				while (got < size && (r = read(channel[0], buffer + got, size - got)) > 0)
+					got += r;
+				sum += sum_words((long *) buffer, size);
+			}
+		_exit(sum == 42);
+	}
+	close(channel[0]);
+	for (n = 0; n < count; n++)
+	{
+		if (shared)
+		{
+			while ((offset = sharedpool_alloc(pool, size)) < 0)
+				sched_yield(); // the consumer is behind
+			memset(sharedpool_ptr(pool, offset), (int) n, size);
+			if (write(channel[1], &offset, sizeof(offset)) != sizeof(offset))
+				break;
+		}
+		else
+		{
+			memset(buffer, (int) n, size);
+			if (write(channel[1], buffer, size) != (ssize_t) size)
+				break;
+		}
+	}
+	close(channel[1]);
+	waitpid(child, NULL, 0);
+	double seconds = (now_ns() - start) / 1e9;
+
+	free(buffer);
+	if (shared)
+	{
+		sharedpool_close(pool);
+		sharedpool_unlink(name);
+	}
+	return EXCHANGE_BYTES / seconds / (1 << 20);
+}
+
+int bench_sharedpool(int argc, char **argv)
+{
+	size_t sizes[] = { 4 << 10, 64 << 10, 1 << 20 };
+	int k;
+
+	printf("\n%10s %12s %12s %8s\n", "buffer", "pipe MB/s", "shared MB/s", "speedup");
+	for (k = 0; k < 3; k++)
+	{
+		double copied = time_exchange(sizes[k], 0);
+		double shared = time_exchange(sizes[k], 1);
+		printf("%10zu %12.0f %12.0f %7.1fx\n", sizes[k], copied, shared, shared / copied);
+	}
+	printf("\n");
+	return 0;
+}
+
+/* Hardware counters per mymalloc/myfree call for each strategy, on a stress workload in the
+ * stress suite's 10000 byte pool and in a pool 100 times larger, to tell whether a strategy's
+ * time goes on instructions, cache misses or mispredicted branches. The loop's rand() calls
+ * are counted too, the same for every strategy. Where the kernel gives no counters, only the
+ * times are printed.
+ */
+int bench_counters(int argc, char **argv)
+{
+	int pools[] = { 10000, 1000000 };
+	int lbound = 1;
+	int ubound = 7;
+	int p, strategy;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	mem_set_adaptive_log(NULL); /* adaptive's policy switches would break up the table */
+	workloadCounting = perfcount_open(&workloadCounters) >= 0;
+	if (!workloadCounting)
+		printf("\nhardware counters unavailable (%s); times only", strerror(errno));
+	printf("\n%8s %10s %8s %10s %12s %10s %10s %10s\n", "pool", "strategy", "ns/op", "cycles", "instructions",
+	       "L1d miss", "LLC miss", "br miss");
+	for (p = 0; p < 2; p++)
+	{
+		for (strategy = lbound; strategy <= ubound; strategy++)
+		{
+			double took = time_workload(strategy, pools[p], 0.75, 1, pools[p] / 100, 100000);
+			printf("%8d %10s %8.1f", pools[p], strategy_name(strategy), took);
+			for (int event = 0; event < PERF_EVENTS; event++)
+			{
+				double value = perfcount_per_op(&workloadCounters, event, 100000);
+				int width = event == PERF_INSTRUCTIONS ? 13 : 11;
+				if (value < 0)
+					printf("%*s", width, "n/a");
+				else
+					printf("%*.2f", width, value);
+			}
+			printf("\n");
+		}
+	}
+	printf("\n");
+	if (workloadCounting)
+		perfcount_close(&workloadCounters);
+	workloadCounting = 0;
+	return 0;
+}
+
+/* Touching what is handed out: a 32MB pool holds a background of 1-2KB blocks with every other
+ * one freed, and each step allocates a 64-1024 byte buffer, writes and reads all of it, and
+ * frees the buffer allocated LIFO_BUFFERS steps earlier; every LIFO_CHURN steps one random
+ * background block is replaced (and written), so frees also land all over the pool. Lifo hands
+ * a block freed a moment ago straight back out; First and Best place by address and size.
+ * Per step: time and, where the kernel gives them, counters for the whole step, touching
+ * included.
+ */
+#define LIFO_POOL (32 << 20)
+#define LIFO_BACKGROUND 8000
+#define LIFO_BUFFERS 8
+#define LIFO_CHURN 16
+#define LIFO_STEPS 50000
+
+// a background block of 1-2KB, written as a long-lived object would have been
+static void *background_block()
+{
+	int size = 1024 + rand() % 1024;
+	void *block = mymalloc(size);
+	if (block != NULL)
+		memset(block, 1, size);
+	return block;
+}
+
+static double time_touch(strategies strategy, long *checksum)
+{
+	static void *background[LIFO_BACKGROUND];
+	void *buffers[LIFO_BUFFERS] = { NULL };
+	int i, step;
+
+	initmem(strategy, LIFO_POOL);
+	srand(1);
+	for (i = 0; i < LIFO_BACKGROUND; i++)
+		background[i] = background_block();
+	for (i = 0; i < LIFO_BACKGROUND; i += 2)
+	{
+		myfree(background[i]);
+		background[i] = NULL;
+	}
+
+	if (workloadCounting)
+	{
+		perfcount_reset(&workloadCounters);
+		perfcount_resume(&workloadCounters);
+	}
+	double start = now_ns();
+	for (step = 0; step < LIFO_STEPS; step++)
+	{
+		int size = 64 + rand() % 961;
+		unsigned char *buffer = mymalloc(size);
+		if (buffer != NULL)
+		{
+			memset(buffer, step, size);
+			for (i = 0; i < size; i += 64)
+				*checksum += buffer[i];
+		}
+		myfree(buffers[step % LIFO_BUFFERS]);
+		buffers[step % LIFO_BUFFERS] = buffer;
+
+		if (step % LIFO_CHURN == 0)
+		{
+			int chosen = rand() % LIFO_BACKGROUND;
+			myfree(background[chosen]);
+			background[chosen] = background_block();
+		}
+	}
+	double took = (now_ns() - start) / LIFO_STEPS;
+	if (workloadCounting)
+	{
+		perfcount_pause(&workloadCounters);
+		perfcount_read(&workloadCounters);
+	}
+	return took;
+}
+
+int bench_lifo(int argc, char **argv)
+{
+	strategies strategies[] = { First, Best, Lifo };
+	long checksum = 0;
+	int k;
+
+	workloadCounting = perfcount_open(&workloadCounters) >= 0;
+	if (!workloadCounting)
+		printf("\nhardware counters unavailable (%s); times only", strerror(errno));
+	printf("\n%10s %9s %10s %12s %10s %10s\n", "strategy", "ns/step", "cycles", "instructions", "L1d miss", "LLC miss");
+	for (k = 0; k < 3; k++)
+	{
+		if (strategyFromString(*(argv+1)) > 0 && strategyFromString(*(argv+1)) != strategies[k])
+			continue;
+		double took = time_touch(strategies[k], &checksum);
+		printf("%10s %9.1f", strategy_name(strategies[k]), took);
+		for (int event = PERF_CYCLES; event <= PERF_LLC_MISSES; event++)
+		{
+			double value = perfcount_per_op(&workloadCounters, event, LIFO_STEPS);
+			int width = event == PERF_INSTRUCTIONS ? 13 : 11;
+			if (value < 0)
+				printf("%*s", width, "n/a");
+			else
+				printf("%*.2f", width, value);
+		}
+		printf("\n");
+	}
+	printf("(checksum %ld)\n\n", checksum);
+	if (workloadCounting)
+		perfcount_close(&workloadCounters);
+	workloadCounting = 0;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	testentry_t benches[] = {
+		{"blocktable","layout",bench_blocktable},
+		{"bitmap","strategy",bench_bitmap},
+		{"fitindex","strategy",bench_fitindex},
+		{"remotefree","threads",bench_remotefree},
+		{"guarded","strategy",bench_guarded},
+		{"arena","strategy",bench_arena},
+		{"objpool","strategy",bench_objpool},
+		{"metadata","layout",bench_metadata},
+		{"numa","placement",bench_numa},
+		{"maintenance","threads",bench_maintenance},
+		{"scaling","curves",bench_scaling},
+		{"direct","strategy",bench_direct},
+		{"telemetry","strategy",bench_telemetry},
+		{"sharedpool","processes",bench_sharedpool},
+		{"counters","strategy",bench_counters},
+		{"lifo","strategy",bench_lifo},
+	};
+
+	if (argc < 3)
+	{
+		printf("Usage: membench [-j N] <benchmark> <strategy>\n");
+		return 0;
+	}
+	set_testrunner_default_timeout(600);
+	return run_testrunner(argc,argv,benches,sizeof(benches)/sizeof(testentry_t));
+}
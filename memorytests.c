@@ -1,12 +1,26 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
 #include <time.h>
 #include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #include "mymem.h"
+#include "blocktable.h"
+#include "arena.h"
+#include "objpool.h"
+#include "sharedpool.h"
+#include "perfcount.h"
 #include "testrunner.h"
 
 /* performs a randomized test:
@@ -17,26 +31,44 @@
 		If a block cannot be allocated, this is tallied and a random block is freed immediately thereafter in the next iteration
 	minBlockSize, maxBlockSize == size for allocated blocks is picked uniformly at random between these two numbers, inclusive
 	*/
+/* set by do_stress_tests_aged: each strategy's run then starts from this checkpoint of an aged
+   pool of totalSize bytes, whose allocated blocks are at agedOffsets from mem_pool() */
+static void *agedHeap;
+static size_t agedHeapSize;
+static long agedOffsets[10000];
+static int agedCount;
+
 void do_randomized_test(int strategyToUse, int totalSize, float fillRatio, int minBlockSize, int maxBlockSize, int iterations)
 {
 	void * pointers[10000];
 	int storedPointers = 0;
 	int strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 	int smallBlockSize = maxBlockSize/10;
+	/* per-strategy results, for comparing adaptive, bitmap and lifo against the others */
+	double took[8], avg_largest_free[8], avg_small[8];
+	int failed[8];
+	/* with MYMEM_PERF set, hardware counters around each mymalloc and myfree call */
+	PerfCounters counters;
+	int counting = getenv("MYMEM_PERF") != NULL;
 
 	if (strategyToUse>0)
 		lbound=ubound=strategyToUse;
 
 	FILE *log;
-	log = fopen("tests.log","a");
+	log = fopen(get_testrunner_log_file(),"a");
 	if(log == NULL) {
 	  perror("Can't append to log file.\n");
 	  return;
 	}
 
 	fprintf(log,"Running randomized tests: pool size == %d, fill ratio == %f, block size is from %d to %d, %d iterations\n",totalSize,fillRatio,minBlockSize,maxBlockSize,iterations);
+	if (counting && perfcount_open(&counters) < 0)
+	{
+		fprintf(log,"Hardware counters unavailable: %s\n",strerror(errno));
+		counting = 0;
+	}
 
 	fclose(log);
 
@@ -47,12 +79,43 @@ void do_randomized_test(int strategyToUse, int totalSize, float fillRatio, int m
 		double sum_allocated = 0;
 		int failed_allocations = 0;
 		double sum_small = 0;
+		double sum_nodes = 0;
+		double sum_slack = 0;
 		struct timespec execstart, execend;
 		int force_free = 0;
 		int i;
+		long operations = 0;
+		struct mem_stats stats = { .small_size = smallBlockSize };
 		storedPointers = 0;
 
-		initmem(strategy,totalSize);
+		log = fopen(get_testrunner_log_file(),"a");
+		if(log == NULL) {
+		  perror("Can't append to log file.\n");
+		  return;
+		}
+
+		fprintf(log,"\t=== %s ===\n",strategy_name(strategy));
+		mem_set_adaptive_log(log); /* adaptive's policy switches are listed under its heading */
+
+		if (agedHeap == NULL)
+			initmem(strategy,totalSize);
+		else if (mem_restore(agedHeap,agedHeapSize,strategy) == 0)
+		{
+			for (i = 0; i < agedCount; i++)
+				pointers[i] = (char *) mem_pool() + agedOffsets[i];
+			storedPointers = agedCount;
+		}
+		else
+		{
+			fprintf(log,"\tCannot start from the aged heap; skipped.\n");
+			took[strategy] = avg_largest_free[strategy] = avg_small[strategy] = failed[strategy] = 0;
+			mem_set_adaptive_log(NULL);
+			fclose(log);
+			continue;
+		}
+		mem_snapshot(&stats);
+		if (counting)
+			perfcount_reset(&counters);
 
 		clock_gettime(CLOCK_REALTIME, &execstart);
 
@@ -60,11 +123,16 @@ void do_randomized_test(int strategyToUse, int totalSize, float fillRatio, int m
 		{
 			if ( (i % 10000)==0 )
 				srand ( time(NULL) );
-			if (!force_free && (mem_free() > (totalSize * (1-fillRatio))))
+			if (!force_free && (stats.free_bytes > (totalSize * (1-fillRatio))))
 			{
 				int newBlockSize = (rand()%(maxBlockSize-minBlockSize+1))+minBlockSize;
 				/* allocate */
+				if (counting)
+					perfcount_resume(&counters);
 				void * pointer = mymalloc(newBlockSize);
+				if (counting)
+					perfcount_pause(&counters);
+				operations++;
 				if (pointer != NULL)
 					pointers[storedPointers++] = pointer;
 				else
@@ -90,73 +158,217 @@ void do_randomized_test(int strategyToUse, int totalSize, float fillRatio, int m
 
 				storedPointers--;
 
+				if (counting)
+					perfcount_resume(&counters);
 				myfree(pointer);
+				if (counting)
+					perfcount_pause(&counters);
+				operations++;
 			}
 
-			sum_largest_free += mem_largest_free();
-			sum_hole_size += (mem_free() / mem_holes());
-			sum_allocated += mem_allocated();
-			sum_small += mem_small_free(smallBlockSize);
+			/* one walk per iteration; stats also drives the alloc/free decision above */
+			mem_snapshot(&stats);
+			sum_largest_free += stats.largest_free;
+			sum_hole_size += stats.holes > 0 ? stats.free_bytes / stats.holes : 0;
+			sum_allocated += stats.allocated_bytes;
+			sum_small += stats.small_holes;
+			sum_nodes += stats.nodes;
+			sum_slack += stats.slack_bytes;
 		}
 
 		clock_gettime(CLOCK_REALTIME, &execend);
 
-		log = fopen("tests.log","a");
+		took[strategy] = (execend.tv_sec - execstart.tv_sec) * 1000 + (execend.tv_nsec - execstart.tv_nsec) / 1000000.0;
+		avg_largest_free[strategy] = sum_largest_free/iterations;
+		avg_small[strategy] = sum_small/iterations;
+		failed[strategy] = failed_allocations;
+
+		fprintf(log,"\tTest took %.2fms.\n", took[strategy]);
+		fprintf(log,"\tAverage hole size: %f\n",sum_hole_size/iterations);
+		fprintf(log,"\tAverage largest free block: %f\n",avg_largest_free[strategy]);
+		fprintf(log,"\tAverage allocated bytes: %f\n",sum_allocated/iterations);
+		fprintf(log,"\tAverage number of small blocks: %f\n",avg_small[strategy]);
+		fprintf(log,"\tAverage number of nodes: %f\n",sum_nodes/iterations);
+		fprintf(log,"\tAverage slack bytes: %f\n",sum_slack/iterations);
+		fprintf(log,"\tFailed allocations: %d\n",failed_allocations);
+		if (counting)
+		{
+			char perOp[256];
+			perfcount_read(&counters);
+			perfcount_format(&counters, operations, perOp, sizeof(perOp));
+			fprintf(log,"\tPer mymalloc/myfree call: %s\n",perOp);
+		}
+		mem_set_adaptive_log(NULL);
+		fclose(log);
+
+
+	}
+	if (counting)
+		perfcount_close(&counters);
+
+	if (lbound == 1 && ubound >= Adaptive)
+	{
+		int best_largest = 1, best_small = 1, best_failed = 1, best_time = 1;
+
+		/* the best fixed strategy for each metric */
+		for (strategy = 2; strategy < Adaptive; strategy++)
+		{
+			if (avg_largest_free[strategy] > avg_largest_free[best_largest]) best_largest = strategy;
+			if (avg_small[strategy] < avg_small[best_small]) best_small = strategy;
+			if (failed[strategy] < failed[best_failed]) best_failed = strategy;
+			if (took[strategy] < took[best_time]) best_time = strategy;
+		}
+
+		log = fopen(get_testrunner_log_file(),"a");
 		if(log == NULL) {
 		  perror("Can't append to log file.\n");
 		  return;
 		}
-		
-		fprintf(log,"\t=== %s ===\n",strategy_name(strategy));
-		fprintf(log,"\tTest took %.2fms.\n", (execend.tv_sec - execstart.tv_sec) * 1000 + (execend.tv_nsec - execstart.tv_nsec) / 1000000.0);
-		fprintf(log,"\tAverage hole size: %f\n",sum_hole_size/iterations);
-		fprintf(log,"\tAverage largest free block: %f\n",sum_largest_free/iterations);
-		fprintf(log,"\tAverage allocated bytes: %f\n",sum_allocated/iterations);
-		fprintf(log,"\tAverage number of small blocks: %f\n",sum_small/iterations);
-		fprintf(log,"\tFailed allocations: %d\n",failed_allocations);
+		fprintf(log,"\t=== adaptive vs best fixed strategy ===\n");
+		fprintf(log,"\tTest took: %.2fms vs %.2fms (%s)\n",took[Adaptive],took[best_time],strategy_name(best_time));
+		fprintf(log,"\tAverage largest free block: %f vs %f (%s)\n",avg_largest_free[Adaptive],avg_largest_free[best_largest],strategy_name(best_largest));
+		fprintf(log,"\tAverage number of small blocks: %f vs %f (%s)\n",avg_small[Adaptive],avg_small[best_small],strategy_name(best_small));
+		fprintf(log,"\tFailed allocations: %d vs %d (%s)\n",failed[Adaptive],failed[best_failed],strategy_name(best_failed));
+		fclose(log);
+	}
+
+	if (lbound == 1 && ubound >= Bitmap && agedHeap == NULL)
+	{
+		log = fopen(get_testrunner_log_file(),"a");
+		if(log == NULL) {
+		  perror("Can't append to log file.\n");
+		  return;
+		}
+		fprintf(log,"\t=== bitmap (%d byte granules) vs first ===\n",mem_set_granule(0));
+		fprintf(log,"\tTest took: %.2fms vs %.2fms\n",took[Bitmap],took[First]);
+		fprintf(log,"\tAverage largest free block: %f vs %f\n",avg_largest_free[Bitmap],avg_largest_free[First]);
+		fprintf(log,"\tAverage number of small blocks: %f vs %f\n",avg_small[Bitmap],avg_small[First]);
+		fprintf(log,"\tFailed allocations: %d vs %d\n",failed[Bitmap],failed[First]);
 		fclose(log);
+	}
+}
 
+/* run randomized tests against the various strategies with various parameters.
+   The workloads are split by fill ratio into separate tests, so "-j" can run them side by side;
+   the testrunner merges their logs into tests.log in this order. */
+static void do_stress_tests(char **argv, float fillRatio)
+{
+	int strategy = strategyFromString(*(argv+1));
 
+	if (fillRatio == 0.25f) {
+		do_randomized_test(strategy,10000,0.25,1,1000,10000);
+		do_randomized_test(strategy,10000,0.25,1,2000,10000);
+		do_randomized_test(strategy,10000,0.25,1000,2000,10000);
+		do_randomized_test(strategy,10000,0.25,1,3000,10000);
+		do_randomized_test(strategy,10000,0.25,1,4000,10000);
+		do_randomized_test(strategy,10000,0.25,1,5000,10000);
+	} else if (fillRatio == 0.5f) {
+		do_randomized_test(strategy,10000,0.5,1,1000,10000);
+		do_randomized_test(strategy,10000,0.5,1,2000,10000);
+		do_randomized_test(strategy,10000,0.5,1000,2000,10000);
+		do_randomized_test(strategy,10000,0.5,1,3000,10000);
+		do_randomized_test(strategy,10000,0.5,1,4000,10000);
+		do_randomized_test(strategy,10000,0.5,1,5000,10000);
+
+		do_randomized_test(strategy,10000,0.5,1000,1000,10000); /* watch what happens with this test!...why? */
+	} else if (fillRatio == 0.75f) {
+		do_randomized_test(strategy,10000,0.75,1,1000,10000);
+		do_randomized_test(strategy,10000,0.75,500,1000,10000);
+		do_randomized_test(strategy,10000,0.75,1,2000,10000);
+	} else {
+		do_randomized_test(strategy,10000,0.9,1,500,10000);
 	}
 }
 
-/* run randomized tests against the various strategies with various parameters */
-int do_stress_tests(int argc, char **argv)
+/* the same workloads under split policies that keep more and more of the leftovers attached:
+   fewer nodes and small holes (so shorter searches), against more slack */
+int do_stress_tests_split(int argc, char **argv)
 {
+	int policies[][2] = { {1,0}, {8,0}, {16,32}, {64,128} };
 	int strategy = strategyFromString(*(argv+1));
+	int p;
+
+	for (p = 0; p < 4; p++)
+	{
+		FILE *log = fopen(get_testrunner_log_file(),"a");
+		if(log == NULL) {
+		  perror("Can't append to log file.\n");
+		  return 1;
+		}
+		fprintf(log,"Split policy: granule %d, minimum remainder %d\n",policies[p][0],policies[p][1]);
+		fclose(log);
 
-	unlink("tests.log");  // We want a new log file
+		mem_set_split_policy(policies[p][0],policies[p][1]);
+		do_randomized_test(strategy,10000,0.5,1,1000,10000);
+		do_randomized_test(strategy,10000,0.75,1,1000,10000);
+		do_randomized_test(strategy,10000,0.9,1,500,10000);
+	}
+	mem_set_split_policy(1,0);
+	return 0;
+}
 
-	do_randomized_test(strategy,10000,0.25,1,1000,10000);
-	do_randomized_test(strategy,10000,0.25,1,2000,10000);
-	do_randomized_test(strategy,10000,0.25,1000,2000,10000);
-	do_randomized_test(strategy,10000,0.25,1,3000,10000);
-	do_randomized_test(strategy,10000,0.25,1,4000,10000); 
-	do_randomized_test(strategy,10000,0.25,1,5000,10000);
+/* the same workloads, but every strategy starts from one pool aged by a long first-fit run of
+   mixed sizes instead of from an empty one, as a long-running program's pool would be */
+int do_stress_tests_aged(int argc, char **argv)
+{
+	static void *pointers[10000];
+	int strategy = strategyFromString(*(argv+1));
+	int stored = 0, i;
 
-	do_randomized_test(strategy,10000,0.5,1,1000,10000);
-	do_randomized_test(strategy,10000,0.5,1,2000,10000);
-	do_randomized_test(strategy,10000,0.5,1000,2000,10000);
-	do_randomized_test(strategy,10000,0.5,1,3000,10000); 
-	do_randomized_test(strategy,10000,0.5,1,4000,10000);
-	do_randomized_test(strategy,10000,0.5,1,5000,10000);
+	initmem(First,10000);
+	srand(1);
+	for (i = 0; i < 200000; i++)
+	{
+		void *pointer = mem_free() > 10000 / 4 && stored < 10000 ? mymalloc(rand() % 1000 + 1) : NULL;
+		if (pointer != NULL)
+			pointers[stored++] = pointer;
+		else if (stored > 0)
+		{
+			int chosen = rand() % stored;
+			myfree(pointers[chosen]);
+			pointers[chosen] = pointers[--stored];
+		}
+	}
+	for (i = 0; i < stored; i++)
+		agedOffsets[i] = (char *) pointers[i] - (char *) mem_pool();
+	agedCount = stored;
+	agedHeapSize = mem_checkpoint_size();
+	agedHeap = malloc(agedHeapSize);
+	if (agedHeap == NULL || mem_checkpoint(agedHeap,agedHeapSize) < 0)
+	{
+		free(agedHeap);
+		agedHeap = NULL;
+		return 1;
+	}
 
-	do_randomized_test(strategy,10000,0.5,1000,1000,10000); /* watch what happens with this test!...why? */
+	FILE *log = fopen(get_testrunner_log_file(),"a");
+	if(log == NULL) {
+	  perror("Can't append to log file.\n");
+	  return 1;
+	}
+	fprintf(log,"Aged heap: %d blocks allocated, %d bytes free in %d holes (bitmap cannot start from it)\n",agedCount,mem_free(),mem_holes());
+	fclose(log);
 
+	do_randomized_test(strategy,10000,0.5,1,1000,10000);
 	do_randomized_test(strategy,10000,0.75,1,1000,10000);
-	do_randomized_test(strategy,10000,0.75,500,1000,10000);
-	do_randomized_test(strategy,10000,0.75,1,2000,10000); 
+	do_randomized_test(strategy,10000,0.9,1,500,10000);
 
-	do_randomized_test(strategy,10000,0.9,1,500,10000); 
-
-	return 0; /* you nominally pass for surviving without segfaulting */
+	free(agedHeap);
+	agedHeap = NULL;
+	return 0;
 }
 
+/* you nominally pass for surviving without segfaulting */
+int do_stress_tests_25(int argc, char **argv) { do_stress_tests(argv, 0.25f); return 0; }
+int do_stress_tests_50(int argc, char **argv) { do_stress_tests(argv, 0.5f); return 0; }
+int do_stress_tests_75(int argc, char **argv) { do_stress_tests(argv, 0.75f); return 0; }
+int do_stress_tests_90(int argc, char **argv) { do_stress_tests(argv, 0.9f); return 0; }
+
 /* basic sequential allocation of single byte blocks */
 int test_alloc_1(int argc, char **argv) {
 	strategies strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 
 	if (strategyFromString(*(argv+1))>0)
 		lbound=ubound=strategyFromString(*(argv+1));
@@ -169,6 +381,8 @@ int test_alloc_1(int argc, char **argv) {
 		int i;
 
 		void* lastPointer = NULL;
+		if (strategy == Bitmap)
+			continue; /* byte-granular layouts do not apply; see test_bitmap */
 		initmem(strategy,100);
 		for (i = 0; i < 100; i++)
 		{
@@ -209,7 +423,7 @@ int test_alloc_1(int argc, char **argv) {
 int test_alloc_2(int argc, char **argv) {
 	strategies strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 
 	if (strategyFromString(*(argv+1))>0)
 		lbound=ubound=strategyFromString(*(argv+1));
@@ -225,6 +439,8 @@ int test_alloc_2(int argc, char **argv) {
 		void* third;
 		int correctThird;
 
+		if (strategy == Bitmap)
+			continue; /* byte-granular layouts do not apply; see test_bitmap */
 		initmem(strategy,100);
 
 		first = mymalloc(10);
@@ -239,7 +455,7 @@ int test_alloc_2(int argc, char **argv) {
 		}
 
 		correct_alloc = 2;
-		correct_small = (strategy == First || strategy == Best);
+		correct_small = (strategy == First || strategy == Best || strategy == Adaptive || strategy == Lifo);
 
 		switch (strategy)
 		{
@@ -263,7 +479,18 @@ int test_alloc_2(int argc, char **argv) {
 				correct_holes = 2;
 				correct_largest_free = 88;
 				break;
+			case Adaptive: /* starts out placing like first-fit */
+				correctThird = (third == first);
+				correct_holes = 2;
+				correct_largest_free = 89;
+				break;
+			case Lifo: /* the freed block is the most recent, and first-fit would pick it too */
+				correctThird = (third == first);
+				correct_holes = 2;
+				correct_largest_free = 89;
+				break;
 		        case NotSet:
+		        case Bitmap: /* byte-granular layouts do not apply; see test_bitmap */
 			        break;
 		}
 
@@ -307,7 +534,7 @@ int test_alloc_2(int argc, char **argv) {
 int test_alloc_3(int argc, char **argv) {
 	strategies strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 
 	if (strategyFromString(*(argv+1))>0)
 		lbound=ubound=strategyFromString(*(argv+1));
@@ -320,6 +547,8 @@ int test_alloc_3(int argc, char **argv) {
 		int i;
 
 		void* lastPointer = NULL;
+		if (strategy == Bitmap)
+			continue; /* byte-granular layouts do not apply; see test_bitmap */
 		initmem(strategy,100);
 		for (i = 0; i < 100; i++)
 		{
@@ -377,7 +606,7 @@ int test_alloc_3(int argc, char **argv) {
 int test_alloc_4(int argc, char **argv) {
 	strategies strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 
 	if (strategyFromString(*(argv+1))>0)
 		lbound=ubound=strategyFromString(*(argv+1));
@@ -390,6 +619,8 @@ int test_alloc_4(int argc, char **argv) {
 		int i;
 
 		void* lastPointer = NULL;
+		if (strategy == Bitmap)
+			continue; /* byte-granular layouts do not apply; see test_bitmap */
 		initmem(strategy,100);
 		for (i = 0; i < 100; i++)
 		{
@@ -406,6 +637,7 @@ int test_alloc_4(int argc, char **argv) {
 		{
 			myfree(mem_pool() + i);
 		}
+		mem_flush_quicklists(); // Lifo would hand the holes back newest first
 
 		for (i = 1; i < 100; i+=2)
 		{
@@ -441,22 +673,1678 @@ int test_alloc_4(int argc, char **argv) {
 	return 0;
 }
 
+/* mem_snapshot must agree with the individual mem_* queries */
+int test_snapshot(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		struct mem_stats stats = { .small_size = 2 };
+		int i;
+
+		if (strategy == Bitmap)
+			continue; /* byte-granular layouts do not apply; see test_bitmap */
+		initmem(strategy,100);
+		for (i = 0; i < 10; i++)
+			mymalloc(i+1);
+		for (i = 0; i < 10; i+= 2)
+			myfree(mem_pool() + i*(i+1)/2);
+
+		mem_snapshot(&stats);
+
+		if (stats.holes != mem_holes() || stats.free_bytes != mem_free() ||
+		    stats.allocated_bytes != mem_allocated() || stats.largest_free != mem_largest_free() ||
+		    stats.small_holes != mem_small_free(2))
+		{
+			printf("Snapshot disagrees with mem_* queries with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* sizes 1,3,5,7,9 and the 45 byte tail are free; 2,4,6,8,10 are allocated */
+		if (stats.nodes != 11 || stats.hole_hist[0] != 1 || stats.hole_hist[1] != 1 || stats.hole_hist[2] != 2 ||
+		    stats.hole_hist[3] != 1 || stats.hole_hist[5] != 1 || stats.alloc_hist[1] != 1 || stats.alloc_hist[2] != 2 || stats.alloc_hist[3] != 2)
+		{
+			printf("Snapshot histograms are wrong with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* aligned allocation gives the padding around the block back to the pool */
+int test_memalign(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		void* first;
+		void* aligned;
+
+		if (strategy == Bitmap)
+			continue; /* byte-granular layouts do not apply; see test_bitmap */
+		initmem(strategy,100);
+		first = mymalloc(3);
+		aligned = mymemalign(16,10);
+
+		if (aligned != mem_pool()+16 || first != mem_pool())
+		{
+			printf("Aligned allocation placed at offset %ld with %s\n", (long)(aligned - mem_pool()), strategy_name(strategy));
+			return 1;
+		}
+
+		if (mem_allocated() != 13 || mem_holes() != 2 || mem_largest_free() != 74)
+		{
+			printf("Padding around aligned block not released with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		myfree(aligned);
+		mem_flush_quicklists(); // Lifo parks the block instead of coalescing it
+		if (mem_holes() != 1 || mem_largest_free() != 97)
+		{
+			printf("Aligned block did not coalesce on free with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* each of adaptive's rules switches it: next-fit once searches get long, best-fit once requests
+   fail, worst-fit once holes are smaller than requests */
+int test_adaptive(int argc, char **argv) {
+	void *blocks[20];
+	int i;
+
+	initmem(Adaptive,100000);
+	mem_set_adaptive_log(NULL);
+
+	for (i = 0; i < 2000; i++)
+	{
+		if (mymalloc(8) != mem_pool() + i*8)
+		{
+			printf("Adaptive allocation %d was not sequential\n", i);
+			return 1;
+		}
+		if (i == 256 && mem_adaptive_policy() != First)
+		{
+			printf("Adaptive switched policy before it was confirmed\n");
+			return 1;
+		}
+	}
+
+	if (mem_adaptive_policy() != Next)
+	{
+		printf("Adaptive policy is %s after long searches, should be next\n", strategy_name(mem_adaptive_policy()));
+		return 1;
+	}
+
+	/* requests that keep failing move it to best-fit */
+	initmem(Adaptive,10000);
+	for (i = 0; i < 1000; i++)
+		mymalloc(20000);
+	if (mem_adaptive_policy() != Best)
+	{
+		printf("Adaptive policy is %s after failed allocations, should be best\n", strategy_name(mem_adaptive_policy()));
+		return 1;
+	}
+
+	/* holes in front of the end of the pool that are smaller than the requests move it to
+	   worst-fit; the list stays short enough that searches do not count as long */
+	initmem(Adaptive,100000);
+	for (i = 0; i < 20; i++)
+		blocks[i] = mymalloc(16);
+	for (i = 0; i < 20; i += 2)
+		myfree(blocks[i]);
+	for (i = 0; i < 1000; i++)
+		myfree(mymalloc(64));
+	if (mem_adaptive_policy() != Worst)
+	{
+		printf("Adaptive policy is %s with holes smaller than requests, should be worst\n", strategy_name(mem_adaptive_policy()));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* small blocks are parked on quick lists when freed, but still reported as free */
+int test_quicklists(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 5;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	mem_set_quicklists(16);
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		void *a, *b, *c;
+
+		initmem(strategy,100);
+		a = mymalloc(8);
+		b = mymalloc(8);
+		c = mymalloc(8);
+		myfree(b);
+
+		if (mem_holes() != 2 || mem_free() != 84 || mem_allocated() != 16 || mem_is_alloc(b))
+		{
+			printf("Cached block not reported as free with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		if (mymalloc(8) != b)
+		{
+			printf("Cached block not reused with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		myfree(a);
+		myfree(b);
+		mem_flush_quicklists();
+		if (mem_holes() != 2 || mem_largest_free() != 76 || mem_small_free(16) != 1)
+		{
+			printf("Flushed blocks were not coalesced with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* a request that only fits once the cached blocks are merged flushes them */
+		myfree(c);
+		initmem(strategy,1000);
+		a = mymalloc(16);
+		b = mymalloc(16);
+		mymalloc(968);
+		myfree(a);
+		myfree(b);
+		if (mymalloc(32) != mem_pool())
+		{
+			printf("Cached blocks not flushed under pressure with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+	mem_set_quicklists(0);
+
+	return 0;
+}
+
+/* the block table places and frees blocks exactly like the MemList chain */
+int test_blocktable(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 4;
+
+	if (strategyFromString(*(argv+1))>0 && strategyFromString(*(argv+1))<=4)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		void *pointers[1000];
+		int stored = 0;
+		int i;
+		BlockTable *table = blocktable_create(10000);
+
+		initmem(strategy,10000);
+		srand(strategy);
+		for (i = 0; i < 20000; i++)
+		{
+			if (stored == 0 || (stored < 1000 && rand() % 2))
+			{
+				int size = rand() % 500 + 1;
+				void *pointer = mymalloc(size);
+				long offset = blocktable_alloc(table, strategy, size);
+				if (offset != (pointer == NULL ? -1 : pointer - mem_pool()))
+				{
+					printf("Block table placed a block at %ld, list at %ld with %s\n", offset, pointer == NULL ? -1L : (long)(pointer - mem_pool()), strategy_name(strategy));
+					return 1;
+				}
+				if (pointer != NULL)
+					pointers[stored++] = pointer;
+			}
+			else
+			{
+				int chosen = rand() % stored;
+				blocktable_free(table, pointers[chosen] - mem_pool());
+				myfree(pointers[chosen]);
+				pointers[chosen] = pointers[--stored];
+			}
+		}
+		if (table->blocks != mem_holes() + stored || blocktable_largest_free(table) != mem_largest_free())
+		{
+			printf("Block table disagrees with the list with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		blocktable_destroy(table);
+	}
+
+	return 0;
+}
+
+
+/* with requests rounded to whole granules, the Bitmap strategy places every block where First does */
+int test_bitmap(int argc, char **argv) {
+	int granules[] = { 16, 64 };
+	int kernel, g, i;
+
+	for (kernel = MEM_KERNEL_SCALAR; kernel <= MEM_KERNEL_AVX2; kernel++)
+	{
+		if (mem_set_bitmap_kernel(kernel) != kernel)
+			continue; /* no AVX2 on this machine */
+
+		for (g = 0; g < 2; g++)
+		{
+			int granule = mem_set_granule(granules[g]);
+			int poolSize = 1000 * granule;
+			void *pointers[1000];
+			long offsets[5000];
+			int sizes[5000];
+			int stored = 0;
+			char *pool;
+
+			srand(granule + kernel);
+			/* record a sequence on First, then replay it on Bitmap */
+			initmem(First,poolSize);
+			for (i = 0; i < 5000; i++)
+			{
+				if (stored == 0 || (stored < 1000 && rand() % 2))
+				{
+					int size = (rand() % 40 + 1) * granule;
+					void *pointer = mymalloc(size);
+					sizes[i] = size;
+					offsets[i] = pointer == NULL ? -1 : pointer - mem_pool();
+					if (pointer != NULL)
+						pointers[stored++] = pointer;
+				}
+				else
+				{
+					int chosen = rand() % stored;
+					sizes[i] = -chosen;
+					myfree(pointers[chosen]);
+					pointers[chosen] = pointers[--stored];
+				}
+			}
+			int holes = mem_holes(), largest = mem_largest_free(), allocated = mem_allocated();
+
+			initmem(Bitmap,poolSize);
+			pool = mem_pool();
+			stored = 0;
+			for (i = 0; i < 5000; i++)
+			{
+				if (sizes[i] > 0)
+				{
+					/* an odd size still takes its whole last granule */
+					void *pointer = mymalloc(sizes[i] - granule + 1);
+					if ((pointer == NULL ? -1 : (char *) pointer - pool) != offsets[i])
+					{
+						printf("Bitmap (%d byte granules, kernel %d) placed block %d at %ld instead of %ld\n", granule, kernel, i, pointer == NULL ? -1L : (long) ((char *) pointer - pool), offsets[i]);
+						return 1;
+					}
+					if (pointer != NULL)
+						pointers[stored++] = pointer;
+				}
+				else
+				{
+					myfree(pointers[-sizes[i]]);
+					myfree(pointers[-sizes[i]]); /* a second free is ignored */
+					pointers[-sizes[i]] = pointers[--stored];
+				}
+			}
+			if (mem_holes() != holes || mem_largest_free() != largest || mem_allocated() != allocated
+			    || mem_free() != poolSize - allocated)
+			{
+				printf("Bitmap (%d byte granules) statistics differ from first\n", granule);
+				return 1;
+			}
+
+			/* aligned blocks, and pointers into the middle of a block are not blocks */
+			initmem(Bitmap,poolSize);
+			mymalloc(1);
+			char *aligned = mymemalign(4 * granule, 3 * granule);
+			if ((aligned - pool) % (4 * granule) != 0 || mem_block_size(aligned) != 3 * granule || mem_holes() != 2)
+			{
+				printf("Bitmap (%d byte granules) did not align a block\n", granule);
+				return 1;
+			}
+			myfree(aligned + granule);
+			if (!mem_is_alloc(aligned + granule) || mem_allocated() != 4 * granule)
+			{
+				printf("Bitmap (%d byte granules) freed a block from an inner pointer\n", granule);
+				return 1;
+			}
+		}
+	}
+	mem_set_granule(16);
+	mem_set_bitmap_kernel(MEM_KERNEL_SCALAR);
+
+	return 0;
+}
+
+/* the fit index places, finds and frees every block exactly like the list walks do.
+   (Adaptive is left out: its policy switches depend on how long the searches take.) */
+int test_fitindex(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 4;
+
+	if (strategyFromString(*(argv+1))>0 && strategyFromString(*(argv+1))<=4)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		static long offsets[20000];
+		void *pointers[1000];
+		int indexed, stored, i;
+
+		/* record the sequence by walking the list, then replay it with the index */
+		for (indexed = 0; indexed <= 1; indexed++)
+		{
+			mem_set_fit_index(indexed);
+			initmem(strategy,100000);
+			srand(strategy);
+			stored = 0;
+			for (i = 0; i < 20000; i++)
+			{
+				if (stored == 0 || (stored < 1000 && rand() % 3))
+				{
+					int size = rand() % 400 + 1;
+					void *pointer = rand() % 10 ? mymalloc(size) : mymemalign(64, size);
+					long offset = pointer == NULL ? -1 : pointer - mem_pool();
+					if (indexed && offset != offsets[i])
+					{
+						printf("Fit index placed block %d at %ld instead of %ld with %s\n", i, offset, offsets[i], strategy_name(strategy));
+						return 1;
+					}
+					offsets[i] = offset;
+					if (pointer != NULL)
+						pointers[stored++] = pointer;
+				}
+				else
+				{
+					int chosen = rand() % stored;
+					myfree(pointers[chosen]);
+					if (mem_is_alloc(pointers[chosen]))
+					{
+						printf("Block %d was not freed with %s\n", i, strategy_name(strategy));
+						return 1;
+					}
+					pointers[chosen] = pointers[--stored];
+				}
+			}
+		}
+	}
+	mem_set_fit_index(1);
+
+	return 0;
+}
+
+#define REMOTE_THREADS 4
+#define REMOTE_BLOCKS 2000
+
+struct remote_work {
+	void **blocks;
+	int count;
+};
+
+static void *free_remotely(void *arg)
+{
+	struct remote_work *work = arg;
+	int i;
+	for (i = 0; i < work->count; i++)
+		myfree(work->blocks[i]);
+	return NULL;
+}
+
+/* blocks freed by other threads are queued, and given back to the pool by the owner */
+int test_remotefree(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	mem_set_remote_frees(1);
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		static void *blocks[REMOTE_THREADS][REMOTE_BLOCKS];
+		struct remote_work work[REMOTE_THREADS];
+		pthread_t threads[REMOTE_THREADS];
+		int t, i, drained = 0;
+
+		initmem(strategy,REMOTE_THREADS*REMOTE_BLOCKS*16);
+		for (t = 0; t < REMOTE_THREADS; t++)
+			for (i = 0; i < REMOTE_BLOCKS; i++)
+				blocks[t][i] = mymalloc(16);
+
+		/* more frees than the queue holds, so the threads wait for the owner to drain it */
+		for (t = 0; t < REMOTE_THREADS; t++)
+		{
+			work[t].blocks = blocks[t];
+			work[t].count = REMOTE_BLOCKS;
+			pthread_create(&threads[t], NULL, free_remotely, &work[t]);
+		}
+		while (drained < REMOTE_THREADS*REMOTE_BLOCKS)
+		{
+			int batch = mem_drain_remote_frees();
+			if (batch == 0)
+				sched_yield();
+			drained += batch;
+		}
+		for (t = 0; t < REMOTE_THREADS; t++)
+			pthread_join(threads[t], NULL);
+
+		mem_flush_quicklists(); // Lifo parks freed blocks instead of coalescing them
+		if (mem_holes() != 1 || mem_allocated() != 0 || mem_largest_free() != mem_total())
+		{
+			printf("Remotely freed blocks were not coalesced with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* a remote free shows up at the owner's next mymalloc */
+		void *a = mymalloc(16);
+		work[0].blocks = &a;
+		work[0].count = 1;
+		pthread_create(&threads[0], NULL, free_remotely, &work[0]);
+		pthread_join(threads[0], NULL);
+		if (!mem_is_alloc(a) || mymalloc(16) != a)
+		{
+			printf("Remote free was not applied by mymalloc with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+	mem_set_remote_frees(0);
+
+	return 0;
+}
+
+/* leftovers below the minimum remainder stay with the block and are counted as slack */
+int test_splitpolicy(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0 && strategyFromString(*(argv+1))!=Bitmap)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	if (mem_set_split_policy(3,0) != -1 || mem_set_split_policy(16,65535) != -1)
+	{
+		printf("Split policy accepted a granule that is not a power of two, or too much slack\n");
+		return 1;
+	}
+
+	mem_set_split_policy(16,32);
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		struct mem_stats stats = { .small_size = 0 };
+		void *a;
+
+		if (strategy == Bitmap)
+			continue; /* byte-granular layouts do not apply; see test_bitmap */
+		initmem(strategy,1000);
+		a = mymalloc(10);
+		mem_snapshot(&stats);
+		if (stats.allocated_bytes != 16 || stats.slack_bytes != 6 || stats.holes != 1)
+		{
+			printf("Block was not rounded up to the granule with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* 960 bytes would leave a 24 byte hole, so the block takes all of it */
+		mymalloc(950);
+		mem_snapshot(&stats);
+		if (stats.allocated_bytes != 1000 || stats.slack_bytes != 40 || stats.holes != 0 || stats.nodes != 2)
+		{
+			printf("Small leftover was split off with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		myfree(a);
+		if (mymalloc(1) != a || mem_allocated() != 1000 || mem_free() != 0)
+		{
+			printf("Freed block was not reused whole with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+	mem_set_split_policy(1,0);
+
+	return 0;
+}
+
+/* runs bad_access(block) in a child process; returns 1 if it died of SIGSEGV and reported expected on stderr */
+static int faults_with_report(void (*bad_access)(char *), char *block, const char *expected)
+{
+	char report[512] = "";
+	int pipefd[2], status;
+	pid_t child;
+
+	if (pipe(pipefd) != 0)
+		return 0;
+	child = fork();
+	if (child == 0)
+	{
+		dup2(pipefd[1], STDERR_FILENO);
+		bad_access(block);
+		_exit(0);
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0], report, sizeof(report) - 1) < 0)
+		report[0] = '\0';
+	close(pipefd[0]);
+	waitpid(child, &status, 0);
+	return WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV && strstr(report, expected) != NULL;
+}
+
+static void write_past_end(char *block) { block[10] = 1; }
+static void write_after_free(char *block) { myfree(block); block[0] = 1; }
+static void write_to(char *address) { *address = 1; }
+
+/* a program's own SIGSEGV handler, which recovers from one fault and lets the next one kill */
+static sigjmp_buf recovery;
+static volatile sig_atomic_t recovering;
+static void recover_once(int signal)
+{
+	if (recovering)
+		siglongjmp(recovery, 1);
+	sigaction(SIGSEGV, &(struct sigaction) { .sa_handler = SIG_DFL }, NULL);
+}
+
+/* the program recovers from a fault of its own, then overflows a guarded block */
+static void overflow_after_recovered_fault(char *foreign)
+{
+	char *sampled = NULL;
+	int i;
+
+	sigaction(SIGSEGV, &(struct sigaction) { .sa_handler = recover_once }, NULL);
+	initmem(First,1024);
+	for (i = 0; i < 4; i++)
+		sampled = mymalloc(10);
+	if (sigsetjmp(recovery, 1) == 0)
+	{
+		recovering = 1;
+		*foreign = 1;
+	}
+	recovering = 0;
+	sampled[10] = 1;
+}
+
+/* sampled blocks live between guard pages: overflows and uses after free fault */
+int test_guarded(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	char *sampled = NULL;
+	int i;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	mem_set_guarded_sampling(4,2);
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		char *blocks[12];
+
+		initmem(strategy,1024);
+		for (i = 0; i < 12; i++)
+			blocks[i] = mymalloc(10);
+
+		/* the 4th and 8th were sampled; with both slots taken the 12th comes from the pool */
+		if (mem_guarded_blocks() != 2 || mem_allocated() < 100 || mem_allocated() > 160
+		    || !mem_is_alloc(blocks[3]) || mem_block_size(blocks[7]) != 10 || blocks[11] == NULL)
+		{
+			printf("Guarded blocks were not sampled one in four with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		memset(blocks[3], 'x', 10);
+
+		if (!faults_with_report(write_past_end, blocks[3], "buffer overflow"))
+		{
+			printf("Overflow of a guarded block was not caught with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		if (!faults_with_report(write_after_free, blocks[7], "use after free"))
+		{
+			printf("Use after free of a guarded block was not caught with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		myfree(blocks[3]);
+		if (mem_guarded_blocks() != 1 || mem_is_alloc(blocks[3]))
+		{
+			printf("Guarded block was not freed with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	/* the page of a slot that was never used holds no block to report on */
+	mem_set_guarded_sampling(4,4);
+	initmem(First,1024);
+	for (i = 0; i < 4; i++)
+		sampled = mymalloc(10);
+	long page = sysconf(_SC_PAGESIZE);
+	char *unused = (char *) ((uintptr_t) sampled & ~(uintptr_t) (page - 1)) + 6 * page; /* slot 3 */
+	if (mem_guarded_blocks() != 1 || !faults_with_report(write_to, unused, "wild access"))
+	{
+		printf("Access to an unused guarded slot was not reported as a wild access\n");
+		return 1;
+	}
+
+	/* a fault outside the region goes to the program's handler and leaves reporting in place */
+	char *foreign = mmap(NULL, page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (foreign == MAP_FAILED || !faults_with_report(overflow_after_recovered_fault, foreign, "buffer overflow"))
+	{
+		printf("A fault the program recovered from turned off guarded reporting\n");
+		return 1;
+	}
+	munmap(foreign, page);
+	mem_set_guarded_sampling(0,0);
+
+	return 0;
+}
+
+/* two distinct call sites for the heap profile */
+__attribute__((noinline)) static void *profiled_small(void) { return mymalloc(100); }
+__attribute__((noinline)) static void *profiled_large(void) { return mymalloc(200); }
+
+int test_heapprofile(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	/* with one sample per byte on average, every allocation of 100 bytes or more is sampled */
+	if (mem_set_heap_profile(1) != 0)
+	{
+		printf("Heap profile could not be enabled\n");
+		return 1;
+	}
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		long liveCount, liveBytes, totalCount, totalBytes, rate;
+		char line[1024];
+		void *small[10];
+		int i, sites = 0, mapped = 0;
+		FILE *profile;
+
+		initmem(strategy,4000);
+		for (i = 0; i < 10; i++)
+			small[i] = profiled_small();
+		for (i = 0; i < 5; i++)
+			profiled_large();
+		for (i = 0; i < 5; i++)
+			myfree(small[i]);
+
+		profile = tmpfile();
+		if (profile == NULL || mem_write_heap_profile(fileno(profile)) != 0)
+		{
+			printf("Heap profile could not be written with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		rewind(profile);
+		if (fgets(line, sizeof(line), profile) == NULL
+		    || sscanf(line, "heap profile: %ld: %ld [%ld: %ld] @ heap_v2/%ld", &liveCount, &liveBytes, &totalCount, &totalBytes, &rate) != 5
+		    || liveCount != 10 || liveBytes != 1500 || totalCount != 15 || totalBytes != 2000 || rate != 1)
+		{
+			printf("Heap profile header was wrong with %s: %s", strategy_name(strategy), line);
+			fclose(profile);
+			return 1;
+		}
+		while (fgets(line, sizeof(line), profile) != NULL)
+		{
+			if (strcmp(line, "MAPPED_LIBRARIES:\n") == 0)
+				mapped = 1;
+			else if (!mapped && strstr(line, "] @ 0x") != NULL)
+				sites++;
+		}
+		fclose(profile);
+		if (sites != 2 || !mapped)
+		{
+			printf("Heap profile had %d call sites instead of 2 with %s\n", sites, strategy_name(strategy));
+			return 1;
+		}
+	}
+	mem_set_heap_profile(0);
+
+	return 0;
+}
+
+int test_arena(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		Arena *arena;
+		char *first, *second, *third;
+		size_t mark;
+		int allocated;
+
+		initmem(strategy,2000);
+		if (arena_create(2000) != NULL)
+		{
+			printf("Arena larger than the pool was created with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		arena = arena_create(1000);
+		allocated = mem_allocated();
+		first = arena_alloc(arena, 10);
+		mark = arena_mark(arena);
+		second = arena_alloc(arena, 100);
+		third = arena_alloc(arena, 1);
+		if (first == NULL || second != first + ARENA_ALIGN || third != second + 112
+		    || ((uintptr_t) first % ARENA_ALIGN) != 0 || mem_allocated() != allocated)
+		{
+			printf("Arena objects were not bump allocated with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		memset(first, 'a', 10);
+		memset(second, 'b', 100);
+
+		arena_reset(arena, mark);
+		if (arena_alloc(arena, 900) != second || arena_alloc(arena, 1000) != NULL || first[9] != 'a')
+		{
+			printf("Arena was not reset to its mark with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		arena_reset(arena, 0);
+		if (arena_alloc(arena, 1000) != first)
+		{
+			printf("Arena was not emptied with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		arena_destroy(arena);
+		if (mem_allocated() != 0 || mem_holes() != 1)
+		{
+			printf("Arena block was not returned to the pool with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int test_objpool(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		char *objects[45];
+		ObjPool *pool;
+		int i, j;
+
+		initmem(strategy,1<<16);
+		pool = objpool_create(20, 10);
+		/* 24 byte objects after a 32 byte header in 512 byte slabs */
+		if (pool == NULL || pool->objSize != 24 || pool->slabBytes != 512 || pool->perSlab != 20)
+		{
+			printf("Object pool was not laid out as expected with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		for (i = 0; i < 45; i++)
+		{
+			objects[i] = objpool_alloc(pool);
+			if (objects[i] == NULL || (uintptr_t) objects[i] % sizeof(void *) != 0)
+			{
+				printf("Object pool returned a bad object with %s\n", strategy_name(strategy));
+				return 1;
+			}
+			memset(objects[i], i, 20);
+		}
+		for (i = 0; i < 45; i++)
+			for (j = 0; j < 20; j++)
+				if (objects[i][j] != (char) i)
+				{
+					printf("Objects overlap with %s\n", strategy_name(strategy));
+					return 1;
+				}
+		if (pool->slabCount != 3)
+		{
+			printf("Object pool used %d slabs for 45 objects with %s\n", pool->slabCount, strategy_name(strategy));
+			return 1;
+		}
+
+		/* the first slab to empty stays for reuse, the other two go back to the pool */
+		for (i = 0; i < 45; i++)
+			objpool_free(pool, objects[i]);
+		if (pool->slabCount != 1 || pool->emptySlabs != 1)
+		{
+			printf("Empty slabs were not returned with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		if (objpool_alloc(pool) != objects[19])
+		{
+			printf("Kept slab was not reused with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		objpool_destroy(pool);
+		if (mem_allocated() != 0)
+		{
+			printf("Object pool left %d bytes allocated with %s\n", mem_allocated(), strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int test_checkpoint(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		struct mem_stats before = { .small_size = 100 }, after = { .small_size = 100 };
+		long offsets[20];
+		char path[] = "/tmp/mymem-checkpointXXXXXX";
+		char *heap;
+		size_t size;
+		int i, fd;
+
+		initmem(strategy,4000);
+		for (i = 0; i < 20; i++)
+		{
+			char *block = mymalloc(16 + 8 * i);
+			memset(block, 'a' + i, 16);
+			offsets[i] = block - (char *) mem_pool();
+		}
+		for (i = 0; i < 20; i += 3)
+			myfree((char *) mem_pool() + offsets[i]);
+		mem_snapshot(&before);
+
+		size = mem_checkpoint_size();
+		heap = malloc(size);
+		if (heap == NULL || mem_checkpoint(heap, size - 1) != -1 || mem_checkpoint(heap, size) <= 0)
+		{
+			printf("Checkpoint was not taken with %s\n", strategy_name(strategy));
+			free(heap);
+			return 1;
+		}
+
+		initmem(strategy,100);
+		mymalloc(10);
+		if (mem_restore(heap, size, NotSet) != 0)
+		{
+			printf("Checkpoint was not restored with %s\n", strategy_name(strategy));
+			free(heap);
+			return 1;
+		}
+		mem_snapshot(&after);
+		if (after.nodes != before.nodes || after.holes != before.holes || after.free_bytes != before.free_bytes
+		    || after.largest_free != before.largest_free || after.small_holes != before.small_holes || mem_total() != 4000)
+		{
+			printf("Restored pool differs from the checkpoint with %s\n", strategy_name(strategy));
+			free(heap);
+			return 1;
+		}
+		for (i = 1; i < 20; i += 3)
+			if (*((char *) mem_pool() + offsets[i]) != 'a' + i || !mem_is_alloc((char *) mem_pool() + offsets[i]))
+			{
+				printf("Restored block %d lost its contents with %s\n", i, strategy_name(strategy));
+				free(heap);
+				return 1;
+			}
+
+		/* the restored blocks can be freed, and every list strategy can start from a list checkpoint */
+		for (i = 0; i < 20; i++)
+			if (i % 3 != 0)
+				myfree((char *) mem_pool() + offsets[i]);
+		mem_flush_quicklists(); // Lifo parks freed blocks instead of coalescing them
+		if (mem_holes() != 1 || mem_free() != 4000
+		    || mem_restore(heap, size, strategy == Bitmap ? First : Bitmap) != -1
+		    || (strategy != Bitmap && (mem_restore(heap, size, strategy % 4 + 1) != 0 || mem_holes() != before.holes)))
+		{
+			printf("Restored pool did not behave like the original with %s\n", strategy_name(strategy));
+			free(heap);
+			return 1;
+		}
+
+		/* a header whose pool size disagrees with its length is refused, and the pool is kept;
+		 * the size follows the magic number and the strategy */
+		((size_t *) heap)[1] = (size_t) 1 << 40;
+		if (mem_restore(heap, size, NotSet) != -1 || mem_total() != 4000)
+		{
+			printf("Corrupted checkpoint was restored with %s\n", strategy_name(strategy));
+			free(heap);
+			return 1;
+		}
+		free(heap);
+
+		fd = mkstemp(path);
+		if (fd >= 0)
+			close(fd);
+		mymalloc(100);
+		mem_snapshot(&before);
+		if (fd < 0 || mem_checkpoint_file(path) != 0)
+		{
+			printf("Checkpoint was not written to a file with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		initmem(strategy,100);
+		if (mem_restore_file(path, NotSet) != 0 || mem_free() != before.free_bytes || mem_holes() != before.holes)
+		{
+			printf("Checkpoint was not restored from a file with %s\n", strategy_name(strategy));
+			unlink(path);
+			return 1;
+		}
+		unlink(path);
+	}
+
+	/* a node table that does not hold together is refused once copied in, leaving an empty pool;
+	 * with nothing freed the last node is the tail hole, its offset two fields from the end */
+	if (lbound <= First && ubound >= First)
+	{
+		char *heap;
+		size_t size;
+		int i;
+
+		initmem(First,4000);
+		for (i = 0; i < 5; i++)
+			mymalloc(100);
+		size = mem_checkpoint_size();
+		heap = malloc(size);
+		if (heap == NULL || mem_checkpoint(heap, size) != (long) size)
+		{
+			printf("Checkpoint was not taken\n");
+			free(heap);
+			return 1;
+		}
+		((unsigned int *) (heap + size))[-2] = 8000;
+		if (mem_restore(heap, size, NotSet) != -1 || mem_total() != 4000 || mem_free() != 4000 || mem_holes() != 1)
+		{
+			printf("Checkpoint with a broken node table was restored\n");
+			free(heap);
+			return 1;
+		}
+		free(heap);
+	}
+
+	return 0;
+}
+
+int test_numa(int argc, char **argv) {
+	int policies[] = { MEM_NUMA_BIND, MEM_NUMA_INTERLEAVE, MEM_NUMA_LOCAL };
+	int pages[64];
+	int p;
+
+	if (mem_set_numa_policy(7, 0) != -1 || mem_set_numa_policy(MEM_NUMA_BIND, -1) != -1)
+	{
+		printf("NUMA policy accepted an unknown policy or node\n");
+		return 1;
+	}
+
+	/* a node that is not online falls back to first touch */
+	mem_set_numa_policy(MEM_NUMA_BIND, 1000);
+	initmem(First, 1 << 16);
+	if (mem_numa_policy() != MEM_NUMA_DEFAULT || mymalloc(100) == NULL)
+	{
+		printf("Pool bound to a missing node did not fall back to first touch\n");
+		return 1;
+	}
+
+	for (p = 0; p < 3; p++)
+	{
+		int node, placed = 0;
+
+		mem_set_numa_policy(policies[p], 0);
+		initmem(First, 1 << 16);
+		memset(mymalloc(1 << 16), 1, 1 << 16);
+		/* node 0 is online everywhere, but a sandbox may still refuse mbind */
+		if (mem_numa_policy() != policies[p] && mem_numa_policy() != MEM_NUMA_DEFAULT)
+		{
+			printf("Pool got NUMA policy %d instead of %d\n", mem_numa_policy(), policies[p]);
+			return 1;
+		}
+		if (mem_numa_placement(pages, 64) < 0)
+			continue; // the kernel does not report placement
+		for (node = 0; node < 64; node++)
+			placed += pages[node];
+		if (placed != (1 << 16) / sysconf(_SC_PAGESIZE)
+		    || (mem_numa_policy() == MEM_NUMA_BIND && pages[0] != placed))
+		{
+			printf("Pool pages were not placed as asked for with NUMA policy %d\n", policies[p]);
+			return 1;
+		}
+	}
+	mem_set_numa_policy(MEM_NUMA_DEFAULT, 0);
+
+	return 0;
+}
+
+int test_direct(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	mem_set_mmap_threshold(64 << 10);
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		struct mem_stats stats = { .small_size = 0 };
+		unsigned char resident;
+		char *big, *aligned, *small, *blocks[300];
+		int i;
+
+		initmem(strategy,1<<20);
+		big = mymalloc(256 << 10);
+		aligned = mymemalign(1 << 20, 100 << 10);
+		small = mymalloc(1000);
+		mem_snapshot(&stats);
+		if (big == NULL || aligned == NULL || (uintptr_t) aligned % (1 << 20) != 0 || small == NULL
+		    || mem_allocated() != mem_block_size(small) || stats.direct_blocks != 2 || stats.direct_bytes < (356 << 10))
+		{
+			printf("Large blocks were not mapped on their own with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		memset(big, 1, 256 << 10);
+		if (!mem_is_alloc(big + 200000) || mem_block_size(big) < (256 << 10) || mem_block_size(big + 16) != 0)
+		{
+			printf("Direct block is not known to the queries with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		myfree(big);
+		mem_snapshot(&stats);
+		if (stats.direct_blocks != 1 || mem_is_alloc(big) || mincore(big, 1, &resident) == 0)
+		{
+			printf("Freed direct block was not unmapped with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* more blocks than the pool holds, freed in another order than they came */
+		for (i = 0; i < 300; i++)
+			if ((blocks[i] = mymalloc((64 << 10) + i)) == NULL)
+			{
+				printf("Direct allocation %d failed with %s\n", i, strategy_name(strategy));
+				return 1;
+			}
+		for (i = 0; i < 300; i++)
+			myfree(blocks[(i * 7) % 300]);
+		myfree(aligned);
+		mem_snapshot(&stats);
+		if (stats.direct_blocks != 0 || stats.direct_bytes != 0 || mem_allocated() != mem_block_size(small))
+		{
+			printf("Direct blocks were left behind with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* a new pool takes the old one's direct blocks with it */
+		mymalloc(1 << 20);
+		initmem(strategy,1<<20);
+		mem_snapshot(&stats);
+		if (stats.direct_blocks != 0)
+		{
+			printf("Direct block outlived initmem with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	/* with the bypass off, large blocks come from the pool again */
+	mem_set_mmap_threshold(0);
+	initmem(First,1<<20);
+	if ((char *) mymalloc(256 << 10) != mem_pool())
+	{
+		printf("Large block did not come from the pool with the bypass off\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int test_telemetry(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	char name[64];
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	snprintf(name, sizeof(name), "/mymem.test.%d", (int) getpid());
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		const struct mem_telemetry *shared;
+		struct mem_telemetry t;
+		void *blocks[10];
+		long searches = 0;
+		pid_t child;
+		int i, fd;
+
+		initmem(strategy,1<<16);
+		if (mem_start_telemetry(name) != 0 || (fd = shm_open(name, O_RDONLY, 0)) < 0)
+		{
+			printf("Telemetry segment was not created with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		shared = mmap(NULL, sizeof(struct mem_telemetry), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		for (i = 0; i < 10; i++)
+			blocks[i] = mymalloc(1000);
+		mymalloc(1<<17);
+		for (i = 0; i < 10; i += 2)
+			myfree(blocks[i]);
+
+		/* nothing else writes, so seq is even and a plain copy is consistent */
+		t = *shared;
+		for (i = 0; i < MEM_HIST_BUCKETS; i++)
+			searches += t.search_hist[i];
+		if (t.magic != MEM_TELEMETRY_MAGIC || t.pid != getpid() || t.seq % 2 != 0 || t.strategy != strategy
+		    || t.mallocs != 11 || t.failed != 1 || t.frees != 5 || t.pool_bytes != (1<<16)
+		    || t.allocated_bytes != mem_allocated() || t.free_bytes != mem_free()
+		    || (strategy != Bitmap && (t.holes != mem_holes() || t.largest_free != mem_largest_free() || searches != 11)))
+		{
+			printf("Telemetry does not match the pool with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* counters run on across initmem, the gauges follow the new pool */
+		initmem(strategy,1<<15);
+		if (shared->pool_bytes != (1<<15) || shared->free_bytes != (1<<15) || shared->mallocs != 11)
+		{
+			printf("Telemetry did not follow initmem with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* a forked child neither counts into the parent's segment nor removes it */
+		child = fork();
+		if (child == 0)
+		{
+			initmem(strategy,1<<14);
+			mymalloc(100);
+			mem_stop_telemetry();
+			_exit(0);
+		}
+		waitpid(child, NULL, 0);
+		if (child < 0 || shared->mallocs != 11 || shared->pool_bytes != (1<<15) || (fd = shm_open(name, O_RDONLY, 0)) < 0)
+		{
+			printf("Forked child wrote to or removed the telemetry segment with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		close(fd);
+
+		munmap((void *) shared, sizeof(struct mem_telemetry));
+		mem_stop_telemetry();
+		if (shm_open(name, O_RDONLY, 0) >= 0)
+		{
+			printf("Telemetry segment outlived mem_stop_telemetry with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* in a child, takes the shared pool's lock and dies holding it, having started splitting the
+   free block at the head (broken 0) or sent the list round in a circle (broken 1) */
+static int die_holding_shared_lock(const char *name, int broken)
+{
+	int status;
+	pid_t child = fork();
+
+	if (child == 0)
+	{
+		SharedPool *other = sharedpool_open(name);
+		MemList *head;
+		if (other == NULL)
+			_exit(1);
+		pthread_mutex_lock(&other->header->lock);
+		head = &other->nodes[other->header->head];
+		if (broken)
+			head->next = other->header->head;
+		else
+		{
+			/* the new block is linked in, but the head is not shrunk yet */
+			unsigned int rest = other->header->nodeUsed++;
+			other->nodes[rest] = (MemList) { 0, 0, 640, head->sizeAlloc - 640 }; /* head is free: no alloc bit */
+			head->next = rest;
+		}
+		_exit(0);
+	}
+	if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status))
+		return -1;
+	return WEXITSTATUS(status);
+}
+
+int test_sharedpool(int argc, char **argv) {
+	char name[64];
+	SharedPool *pool;
+	long first, second, third, passed;
+	int channel[2], status;
+	pid_t child;
+
+	snprintf(name, sizeof(name), "/mymem.shared.%d", (int) getpid());
+	pool = sharedpool_create(name, 1 << 20);
+	if (pool == NULL || sharedpool_create(name, 1 << 20) != NULL)
+	{
+		printf("Shared pool was not created once\n");
+		return 1;
+	}
+
+	first = sharedpool_alloc(pool, 100);
+	second = sharedpool_alloc(pool, 1000);
+	third = sharedpool_alloc(pool, 64);
+	if (first != 0 || second != SHARED_ALIGN * 2 || third != SHARED_ALIGN * 18 || sharedpool_alloc(pool, 1 << 20) != -1
+	    || sharedpool_free_bytes(pool) != (1 << 20) - SHARED_ALIGN * 19 || sharedpool_holes(pool) != 1)
+	{
+		printf("Shared pool blocks were not placed first-fit in whole units\n");
+		return 1;
+	}
+	memset(sharedpool_ptr(pool, second), 7, 1000);
+
+	/* another process maps it by name, frees a block this one allocated and hands back one of its own */
+	if (pipe(channel) != 0 || (child = fork()) < 0)
+		return 1;
+	if (child == 0)
+	{
+		SharedPool *other = sharedpool_open(name);
+		long mine;
+		if (other == NULL || ((char *) sharedpool_ptr(other, second))[999] != 7 || sharedpool_free(other, first) != 0)
+			_exit(1);
+		mine = sharedpool_alloc(other, 5000);
+		strcpy(sharedpool_ptr(other, mine), "from the child");
+		if (write(channel[1], &mine, sizeof(mine)) != sizeof(mine))
+			_exit(1);
+		/* die holding the lock: the parent must still get in */
+		pthread_mutex_lock(&other->header->lock);
+		_exit(0);
+	}
+	waitpid(child, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || read(channel[0], &passed, sizeof(passed)) != sizeof(passed)
+	    || strcmp(sharedpool_ptr(pool, passed), "from the child") != 0)
+	{
+		printf("Shared pool was not usable from another process\n");
+		return 1;
+	}
+	close(channel[0]);
+	close(channel[1]);
+
+	if (sharedpool_free(pool, passed) != 0 || pool->header->ownerDeaths != 1 || sharedpool_free(pool, first) != -1
+	    || sharedpool_free(pool, second + 1) != -1)
+	{
+		printf("Shared pool did not recover its lock or accepted a bad free\n");
+		return 1;
+	}
+	sharedpool_free(pool, second);
+	sharedpool_free(pool, third);
+	if (sharedpool_free_bytes(pool) != 1 << 20 || sharedpool_holes(pool) != 1 || sharedpool_alloc(pool, 1 << 20) != 0)
+	{
+		printf("Shared pool blocks were not merged back into one\n");
+		return 1;
+	}
+
+	/* a process that dies halfway through a split leaves a list the next one repairs */
+	sharedpool_free(pool, 0);
+	if (die_holding_shared_lock(name, 0) != 0 || sharedpool_alloc(pool, 64) != 0 || pool->header->ownerDeaths != 2
+	    || sharedpool_free_bytes(pool) != (1 << 20) - 64 || sharedpool_holes(pool) != 1 || sharedpool_free(pool, 640) != -1
+	    || sharedpool_alloc(pool, (1 << 20) - 64) != 64)
+	{
+		printf("Shared pool list was not repaired after a process died in a split\n");
+		return 1;
+	}
+
+	/* and one it cannot follow makes the pool fail from then on */
+	if (die_holding_shared_lock(name, 1) != 0 || sharedpool_alloc(pool, 64) != -1 || sharedpool_free(pool, 0) != -1
+	    || sharedpool_free(pool, 64) != -1 || pool->header->ownerDeaths != 2)
+	{
+		printf("Shared pool was used after a process left it unrepairable\n");
+		return 1;
+	}
+
+	sharedpool_close(pool);
+	sharedpool_unlink(name);
+	if (sharedpool_open(name) != NULL)
+	{
+		printf("Shared pool outlived sharedpool_unlink\n");
+		return 1;
+	}
+	return 0;
+}
+
+/* hardware counters either count a loop of mymalloc/myfree calls or, where the kernel gives
+   none (as in most containers), report every event as not counted */
+int test_perfcount(int argc, char **argv) {
+	PerfCounters counters;
+	char perOp[256];
+	int opened, i;
+
+	initmem(First,100000);
+	opened = perfcount_open(&counters);
+	perfcount_reset(&counters);
+	for (i = 0; i < 1000; i++)
+	{
+		perfcount_resume(&counters);
+		myfree(mymalloc(100));
+		perfcount_pause(&counters);
+	}
+	perfcount_read(&counters);
+	perfcount_format(&counters, 2000, perOp, sizeof(perOp));
+
+	if (opened < 0)
+	{
+		for (i = 0; i < PERF_EVENTS; i++)
+			if (counters.counts[i] != -1 || perfcount_per_op(&counters, i, 2000) != -1)
+			{
+				printf("Counter %d has a count without perf_event_open\n", i);
+				return 1;
+			}
+		if (strstr(perOp, "n/a cycles") == NULL || strstr(perOp, "n/a branch misses") == NULL)
+		{
+			printf("Unavailable counters were formatted as \"%s\"\n", perOp);
+			return 1;
+		}
+	}
+	else if (opened > PERF_EVENTS || counters.counts[PERF_CYCLES] <= 0 || strstr(perOp, "cycles") == NULL)
+	{
+		printf("%d counters opened but the calls counted as \"%s\"\n", opened, perOp);
+		return 1;
+	}
+	perfcount_close(&counters);
+	return 0;
+}
+
+/* Lifo hands out the most recently freed block that fits, parks the rest of a split block on
+   top again, falls back to first-fit, and coalesces blocks once they drop off its stack */
+int test_lifo(int argc, char **argv) {
+	struct mem_stats stats = { .small_size = 0 };
+	void *pointers[40];
+	char *pool;
+	int i;
+
+	initmem(Lifo,100000);
+	pool = mem_pool();
+	for (i = 0; i < 4; i++)
+		pointers[i] = mymalloc(100);
+	myfree(pointers[0]);
+	myfree(pointers[2]);
+	if (mymalloc(50) != pointers[2] || mymalloc(50) != (char *) pointers[2] + 50 || mymalloc(100) != pointers[0])
+	{
+		printf("Lifo did not reuse the most recently freed blocks first\n");
+		return 1;
+	}
+	if (mymalloc(200) != pool + 400 || mem_allocated() != 600)
+	{
+		printf("Lifo did not fall back to first-fit\n");
+		return 1;
+	}
+
+	/* 40 adjacent blocks freed in address order: the 8 oldest drop off the stack and merge */
+	initmem(Lifo,100000);
+	for (i = 0; i < 40; i++)
+		pointers[i] = mymalloc(10);
+	for (i = 0; i < 40; i++)
+		myfree(pointers[i]);
+	mem_snapshot(&stats);
+	if (stats.cached_blocks != 32 || stats.holes != 34 || stats.free_bytes != 100000 || mem_largest_free() != 100000 - 400)
+	{
+		printf("Lifo kept %d blocks parked in %d holes, should be 32 in 34\n", stats.cached_blocks, stats.holes);
+		return 1;
+	}
+	mem_flush_quicklists();
+	if (mem_holes() != 1 || mem_largest_free() != 100000)
+	{
+		printf("Lifo blocks were not coalesced when flushed\n");
+		return 1;
+	}
+
+	/* a request the parked blocks block gets them back first */
+	initmem(Lifo,1000);
+	for (i = 0; i < 10; i++)
+		pointers[i] = mymalloc(100);
+	for (i = 0; i < 10; i += 2)
+		myfree(pointers[i]);
+	for (i = 1; i < 10; i += 2)
+		myfree(pointers[i]);
+	if (mymalloc(1000) != mem_pool())
+	{
+		printf("Lifo did not release its parked blocks for a request that needed them\n");
+		return 1;
+	}
+
+	/* and so does an aligned one */
+	initmem(Lifo,4096);
+	for (i = 0; i < 8; i++)
+		pointers[i] = mymalloc(512);
+	myfree(pointers[3]);
+	pointers[8] = mymemalign(16, 256);
+	if (pointers[8] == NULL || (char *) pointers[8] < (char *) pointers[3] || (char *) pointers[8] + 256 > (char *) pointers[3] + 512)
+	{
+		printf("Lifo did not release its parked blocks for an aligned request\n");
+		return 1;
+	}
+	return 0;
+}
+
+/* the node table grows with the heap: a large pool fits under an address-space limit that a
+   table for one node per byte would not, and blocks stay intact as the table moves */
+int test_nodetable(int argc, char **argv) {
+	struct rlimit limit = { 1L << 30, 1L << 30 };
+	void *pointers[20000];
+	int status, i;
+	pid_t child;
+
+	child = fork();
+	if (child == 0)
+	{
+		/* a 256MB pool would have reserved 4.6GB of node table */
+		setrlimit(RLIMIT_AS, &limit);
+		initmem(First,256 << 20);
+		_exit(mymalloc(1000) != NULL ? 0 : 1);
+	}
+	waitpid(child, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		printf("A 256MB pool could not be set up under a 1GB address-space limit\n");
+		return 1;
+	}
+
+	initmem(First,1 << 20);
+	for (i = 0; i < 20000; i++)
+	{
+		pointers[i] = mymalloc(16);
+		*(int *) pointers[i] = i;
+		if (i % 2 == 1)
+			myfree(pointers[i - 1]);
+	}
+	for (i = 1; i < 20000; i += 2)
+		if (*(int *) pointers[i] != i || mem_block_size(pointers[i]) != 16)
+		{
+			printf("Block %d was lost when the node table grew\n", i);
+			return 1;
+		}
+	for (i = 1; i < 20000; i += 2)
+		myfree(pointers[i]);
+	if (mem_holes() != 1 || mem_free() != 1 << 20)
+	{
+		printf("Blocks did not coalesce after the node table grew\n");
+		return 1;
+	}
+	return 0;
+}
+
+/* polls the maintenance thread's statistics until allocated bytes drop to allocated, for up to a second */
+static int wait_for_maintenance(int allocated, struct mem_stats *stats, size_t *trimmed)
+{
+	struct timespec pause = { 0, 1000000 };
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++)
+	{
+		if (mem_maintenance_stats(stats, trimmed) > 0 && stats->allocated_bytes == allocated)
+			return 1;
+		nanosleep(&pause, NULL);
+	}
+	return 0;
+}
+
+int test_maintenance(int argc, char **argv) {
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		struct mem_stats stats;
+		unsigned char resident[128];
+		size_t trimmed = 0;
+		long page = sysconf(_SC_PAGESIZE);
+		char *big, *small, *blocks[200];
+		int i, kept;
+
+		initmem(strategy,1<<20);
+		if (mem_start_maintenance(1000, 64) != 0 || mem_start_maintenance(1000, 64) != -1)
+		{
+			printf("Maintenance thread did not start once with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		big = mymalloc(512 << 10);
+		small = mymalloc(100);
+		memset(big, 1, 512 << 10);
+		myfree(big);
+		if (!wait_for_maintenance(mem_block_size(small), &stats, &trimmed))
+		{
+			printf("Deferred free was not applied by the maintenance thread with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* the hole's whole pages go back to the OS (list strategies only) */
+		if (strategy != Bitmap)
+		{
+			char *first = (char *) (((uintptr_t) big + page - 1) & ~(uintptr_t) (page - 1));
+			for (i = 0; i < 1000 && trimmed < (size_t) 64 * page; i++)
+			{
+				struct timespec pause = { 0, 1000000 };
+				nanosleep(&pause, NULL);
+				mem_maintenance_stats(&stats, &trimmed);
+			}
+			if (trimmed < (size_t) 64 * page || mincore(first, 64 * page, resident) != 0 || resident[0] & 1 || resident[63] & 1)
+			{
+				printf("Large hole was not trimmed with %s (%zu bytes)\n", strategy_name(strategy), trimmed);
+				return 1;
+			}
+		}
+
+		/* foreground work goes on while the thread runs; frees are applied in the background */
+		for (i = 0, kept = 0; i < 200; i++)
+		{
+			blocks[i] = mymalloc(1000 + i);
+			if (blocks[i] == NULL)
+			{
+				printf("Allocation failed while maintenance ran with %s\n", strategy_name(strategy));
+				return 1;
+			}
+			if (i % 2)
+				myfree(blocks[i]);
+			else
+				kept += mem_block_size(blocks[i]);
+		}
+		mem_stop_maintenance();
+		if (mem_maintenance_stats(&stats, NULL) != -1 || mem_allocated() != kept + mem_block_size(small))
+		{
+			printf("Frees queued at stop were not applied with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* a mymalloc that would fail applies the queued frees first */
+		initmem(strategy,1<<16);
+		mem_start_maintenance(1000000, 64);
+		big = mymalloc(1<<16);
+		myfree(big);
+		if (mymalloc(1<<16) != big)
+		{
+			printf("Queued free was not applied for a failing allocation with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		initmem(strategy,100); /* stops the thread */
+	}
+
+	return 0;
+}
+
+int run_memory_tests(int argc, char **argv)
+{
+	int i;
 
-int run_memory_tests(int argc, char **argv)
-{
 	if (argc < 3)
 	{
-	        printf("Usage: mem -test <test> <strategy> \n");
+	        printf("Usage: mem -test [-j N] <test> <strategy> \n");
 		return 0;
 	}
+	/* The stress tests used to be one test, "stress", in suite "suite3"; they are the "stress"
+	 * suite now, and "suite3" still names it. */
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+		if (strcmp(argv[i], "-j") == 0)
+			i++;
+	if (i < argc && strcmp(argv[i], "suite3") == 0)
+		argv[i] = "stress";
 	set_testrunner_default_timeout(20);
-	/* Tests can be invoked by matching their name or their suite name or 'all'*/
+	/* Tests can be invoked by matching their name or their suite name or 'all'. suite1 and suite2
+	 * are the original allocation tests; the features added since have suites of their own. */
 	testentry_t tests[] = {
 		{"alloc1","suite1",test_alloc_1},
 		{"alloc2","suite2",test_alloc_2},
 		{"alloc3","suite1",test_alloc_3},
 		{"alloc4","suite2",test_alloc_4},
-		{"stress","suite3",do_stress_tests},
+		{"snapshot","observability",test_snapshot},
+		{"memalign","placement",test_memalign},
+		{"adaptive","placement",test_adaptive},
+		{"quicklists","placement",test_quicklists},
+		{"blocktable","pools",test_blocktable},
+		{"bitmap","placement",test_bitmap},
+		{"fitindex","placement",test_fitindex},
+		{"remotefree","threads",test_remotefree},
+		{"splitpolicy","placement",test_splitpolicy},
+		{"guarded","observability",test_guarded},
+		{"heapprofile","observability",test_heapprofile},
+		{"arena","pools",test_arena},
+		{"objpool","pools",test_objpool},
+		{"checkpoint","pools",test_checkpoint},
+		{"numa","pools",test_numa},
+		{"maintenance","threads",test_maintenance},
+		{"direct","placement",test_direct},
+		{"telemetry","observability",test_telemetry},
+		{"sharedpool","pools",test_sharedpool},
+		{"perfcount","observability",test_perfcount},
+		{"lifo","placement",test_lifo},
+		{"nodetable","placement",test_nodetable},
+		{"stress25","stress",do_stress_tests_25},
+		{"stress50","stress",do_stress_tests_50},
+		{"stress75","stress",do_stress_tests_75},
+		{"stress90","stress",do_stress_tests_90},
+		{"stresssplit","stress",do_stress_tests_split},
+		{"stressaged","stress",do_stress_tests_aged},
 	};
 
  	return run_testrunner(argc,argv,tests,sizeof(tests)/sizeof(testentry_t));
@@ -465,7 +2353,7 @@ int run_memory_tests(int argc, char **argv)
 int main(int argc, char **argv)
 {
   if( argc < 2) {
-    printf("Usage: mem -test <test> <strategy> | mem -try <arg1> <arg2> ... \n");
+    printf("Usage: mem -test [-j N] <test> <strategy> | mem -try <arg1> <arg2> ... \n");
     exit(-1);
   }
   else if (!strcmp(argv[1],"-test"))
@@ -474,7 +2362,7 @@ int main(int argc, char **argv)
     try_mymem(argc-1,argv+1);
     return 0;
   } else {
-    printf("Usage: mem -test <test> <strategy> | mem -try <arg1> <arg2> ... \n");
+    printf("Usage: mem -test [-j N] <test> <strategy> | mem -try <arg1> <arg2> ... \n");
     exit(-1);
   }
 
@@ -1,7 +1,23 @@
+#define _GNU_SOURCE // mremap
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <math.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include "mymem.h"
 
 
@@ -14,6 +30,523 @@ static MemList *head;
 static MemList *tail;
 static MemList *next;
 
+/* Kept up to date by allocateMem/releaseBlock, so they are cheap to consult on every call */
+static int freeBytes;
+static int holeCount;
+static int nodeCount;
+static int lastSearchLength;   // nodes visited by the most recent find*Fit call
+
+/* The Adaptive strategy places blocks with one of the fixed policies and re-evaluates the choice
+ * every ADAPTIVE_WINDOW allocations from what it saw during the window:
+ *   - failed allocations            -> Best  (keeps the largest blocks intact)
+ *   - long searches                 -> Next  (starts where the last search stopped)
+ *     (a search counts the nodes an address-ordered walk would visit, with the fit index on or
+ *      off; while on Next, searches are short by design, so half the list length stands in)
+ *   - holes smaller than requests   -> Worst (carves from the largest block, leaving usable holes)
+ *     (the hole at the end of the pool is not counted; see adaptiveAverageHole)
+ *   - otherwise                     -> First
+ * To avoid flapping, a new policy must be proposed by ADAPTIVE_CONFIRM windows in a row, and
+ * no switch happens within ADAPTIVE_MIN_DWELL windows of the previous one.
+ */
+#define ADAPTIVE_WINDOW 128
+#define ADAPTIVE_CONFIRM 3
+#define ADAPTIVE_MIN_DWELL 4
+#define ADAPTIVE_SEARCH_LIMIT 32
+
+static strategies adaptivePolicy;
+static strategies adaptiveCandidate;
+static int adaptiveVotes;        // consecutive windows that proposed adaptiveCandidate
+static int adaptiveDwell;        // windows since the last switch
+static int windowAllocs, windowFailures;
+static long windowSteps, windowRequested;
+static long adaptiveAllocs;
+static FILE *adaptiveLog;
+static int adaptiveLogSet;       // stderr is used until mem_set_adaptive_log is called
+
+/* Quick lists: a freed block of at most quickMax bytes is parked (alloc == 2) on a LIFO stack for
+ * its exact size instead of being coalesced, and the next request of that size pops it in O(1).
+ * Parked blocks count as free in every statistic, but searches and coalescing pass them by.
+ * All of them go back to the general pool when an allocation would otherwise fail, when they
+ * hold more than 1/QUICKLIST_PRESSURE of the pool, or every QUICKLIST_FLUSH_PERIOD pushes.
+ */
+#define QUICKLIST_MAX 128
+#define QUICKLIST_DEPTH 16
+#define QUICKLIST_PRESSURE 8
+#define QUICKLIST_FLUSH_PERIOD 4096
+
+static int quickMax;             // 0 when quick lists are off
+static MemList *quickLists[QUICKLIST_MAX + 1][QUICKLIST_DEPTH];
+static int quickDepth[QUICKLIST_MAX + 1];
+static int cachedBytes, cachedBlocks;
+static int quickPushes;          // since the last flush
+
+/* The Lifo strategy: a freed block is parked (alloc == 2, as on the quick lists) on top of a
+ * stack of the LIFO_DEPTH most recently freed blocks instead of being coalesced, and mymalloc
+ * takes the most recent one that fits, so memory that is probably still in L1/L2 is handed out
+ * again first. A larger block is split and its rest parked again on top. When nothing parked
+ * fits, the request is placed first-fit. Blocks that drop off the bottom of the stack, or that
+ * take the parked bytes past 1/QUICKLIST_PRESSURE of the pool, have gone cold: they are released
+ * then and coalesced with their free neighbours. Parked blocks count in cachedBlocks/cachedBytes.
+ */
+#define LIFO_DEPTH 32
+
+static MemList *lifoStack[LIFO_DEPTH];   // oldest first
+static int lifoDepth;
+
+/* Split policy (see mem_set_split_policy): an allocated block is rounded up to a multiple of
+ * splitGranule bytes, and a leftover smaller than splitMinRemainder stays attached to it rather
+ * than becoming a hole of its own. The bytes a block holds beyond the request are its slack.
+ * The defaults (1 and 0) split off every leftover, however small.
+ */
+#define SPLIT_MAX_SLACK 65535    // slack is kept in an unsigned short (see nodeExtra)
+
+static int splitGranule = 1;
+static int splitMinRemainder = 0;
+
+/* Guarded sampling (see mem_set_guarded_sampling), after GWP-ASan: every guardRate-th mymalloc
+ * of at most a page is served from a separate region instead of the pool. The region is a row
+ * of slot pages with an inaccessible guard page on either side of each; the block is placed at
+ * the very end of its slot page, so the first byte written past it faults. A freed slot is made
+ * inaccessible again and queued behind every other free slot, so it is reused as late as
+ * possible and a use after free faults too. A SIGSEGV handler reports faults in the region and
+ * then lets the signal take its normal course. When every slot is taken, the request simply
+ * goes to the pool.
+ */
+#define GUARD_MAX_SLOTS 256
+
+typedef struct
+{
+    char *ptr;
+    int size;
+    char state;          // 0 never used, 1 allocated, 2 freed (inaccessible, in the quarantine)
+} GuardSlot;
+
+static int guardRate;                    // settings, read by initmem
+static int guardSlotsWanted = 16;
+static char *guardRegion;                // NULL when sampling is off
+static size_t guardPage;
+static int guardSlotCount;
+static int guardCountdown;               // mymalloc calls until the next sampled one
+static GuardSlot guardSlots[GUARD_MAX_SLOTS];
+static int guardQueue[GUARD_MAX_SLOTS];  // available slots, least recently freed first
+static int guardQueueHead, guardQueueLength;
+static struct sigaction guardPreviousAction;  // the SIGSEGV action guardFault passes other faults to
+
+/* Direct mappings (see mem_set_mmap_threshold): a request of at least mmapThreshold bytes gets
+ * an mmap of its own instead of a block of the pool, so it never splits the pool or adds a node
+ * to the list, and myfree gives its pages straight back with munmap. The blocks are found by
+ * address in directTable, an open-addressed hash table kept apart from the pool (mmap'ed, and
+ * doubled when half full), which myfree only looks at while there are direct blocks. initmem
+ * unmaps any that are left, like every other block of the old pool.
+ */
+#define DIRECT_MIN_CAPACITY 64
+
+#define TELEMETRY_NONE 0     // what telemetryRecord counts
+#define TELEMETRY_MALLOC 1
+#define TELEMETRY_FAILED 2
+#define TELEMETRY_FREE 3
+
+typedef struct
+{
+    char *ptr;                           // NULL for an unused entry
+    size_t mapped;                       // length of the mapping, which starts at ptr
+} DirectBlock;
+
+static size_t mmapThreshold;             // 0 when the bypass is off; outlives initmem
+static DirectBlock *directTable;
+static long directCapacity;              // power of two
+static long directCount;
+static size_t directBytes;               // mapped for all direct blocks
+
+/* Telemetry (see mem_start_telemetry): every mymalloc, mymemalign and myfree that reaches the
+ * pool bumps its counter in a struct mem_telemetry in a POSIX shared memory segment and copies
+ * the gauges the pool keeps as counters anyway, so an update is a few stores and no walk. The
+ * updates are wrapped in a seqlock (seq is odd while one is under way), so mymemstat, or anything
+ * else that maps the segment, can read a consistent copy without taking a lock the pool uses.
+ */
+static struct mem_telemetry *telemetry;  // NULL when telemetry is off; outlives initmem
+static char telemetryName[64];
+static pid_t telemetryOwner;             // the process the segment belongs to
+
+/* Heap profile (see mem_set_heap_profile): on average one allocation per profileRate bytes
+ * requested is sampled, with exponentially distributed gaps so that no allocation pattern can
+ * line up with the sampling. A sampled allocation records its call stack (one site per distinct
+ * stack) and stays in profileLive until it is freed, so each site has sampled live and total
+ * figures. mem_write_heap_profile writes them in the heap_v2 text format pprof reads, which
+ * scales the sampled figures back up by the rate. Both tables are mmap'ed and fixed in size;
+ * samples that do not fit are dropped.
+ */
+#define PROFILE_DEPTH 32
+#define PROFILE_SITES 4096           // powers of two
+#define PROFILE_LIVE (1 << 16)
+
+typedef struct
+{
+    int depth;                       // 0 for an unused entry
+    void *stack[PROFILE_DEPTH];
+    long liveCount, liveBytes;
+    long totalCount, totalBytes;
+} ProfileSite;
+
+typedef struct
+{
+    void *ptr;                       // NULL for an unused entry
+    int site;
+    int size;
+} ProfileSample;
+
+static long profileRate;             // 0 when profiling is off
+static long profileCountdown;        // bytes until the next sample
+static unsigned long profileRandom = 88172645463325252UL;
+static ProfileSite *profileSites;
+static ProfileSample *profileLive;
+static long profileLiveCount;        // samples in profileLive
+static int profileBusy;              // set while sampling, so allocations made by backtrace are not
+
+/* NUMA placement (see mem_set_numa_policy): right after mapping the pool, before any page of
+ * it is touched, initmem binds it to one node or interleaves it over every online node with
+ * mbind, called through syscall() so there is no libnuma to link. If the kernel refuses (no
+ * NUMA support, a node that is not online, a sandbox), the pool keeps first-touch placement and
+ * numaApplied says so. The node table is left to first touch.
+ */
+#define NUMA_MAX_NODES 1024
+
+static int numaPolicy = MEM_NUMA_DEFAULT;   // settings, read by initmem
+static int numaNode;
+static int numaApplied = MEM_NUMA_DEFAULT;  // what the current pool got
+
+/* Maintenance thread (see mem_start_maintenance): while it runs, myfree only pushes the block
+ * onto maintDeferred, a lock-free FreeQueue, and every tick the thread takes the pool lock and
+ * spends at most its budget on: applying queued frees (coalescing and all), then giving the
+ * pages inside free blocks of at least MAINT_TRIM_MIN bytes back to the OS (madvise, found
+ * through the fit index from a cursor that sweeps the pool), and finally publishing O(1)
+ * statistics for other threads. So myfree never waits for a tick, and a tick holds the lock
+ * for at most budget units of work. mymalloc and the mem_* queries take the lock only while the
+ * thread runs. A mymalloc that would fail applies every queued free first, and so does a myfree
+ * that finds the queue full.
+ */
+#define MAINT_TRIM_MIN (64 << 10)
+#define NODE_TRIMMED 0xFFFE      // nodeExtra of a free block whose pages have been given back
+
+static pthread_mutex_t maintLock;       // recursive: mem_* queries call each other
+static pthread_mutex_t maintPublishLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t maintThread;
+static int maintRunning;                 // only changed by the pool's owner
+static atomic_int maintStop;
+static long maintTickNs;
+static int maintBudget;
+static long maintCursor;                 // next fit index bucket to look for holes to trim
+static long maintTicks;
+static size_t maintTrimmed;              // bytes given back so far
+static struct mem_stats maintStats;      // published by every tick, with maintShownTrimmed
+static size_t maintShownTrimmed;
+
+/* Checkpoints (see mem_checkpoint): this header, the pool's bytes, and then either the used
+ * part of the node tables (nodeUsed nodes, followed by as many extras if extraUsed is set) or
+ * the two bitmaps. Nodes name each other and their blocks by number and offset, so they are
+ * copied as they are and mean the same in any pool of the same size.
+ */
+#define CHECKPOINT_MAGIC 0x4b43594d   // "MYCK"
+
+typedef struct
+{
+    unsigned int magic;
+    strategies strategy;
+    size_t poolSize;
+    size_t bytes;                    // the whole checkpoint, header included
+    int freeBytes, holeCount, nodeCount, extraUsed;
+    unsigned int nodeUsed, freeNodes;
+    unsigned int head, tail, next;   // node numbers
+    int bitmapGranule;
+    long bitmapHint;
+} Checkpoint;
+
+/* Remote frees (see mem_set_remote_frees): the thread that last called initmem owns the pool.
+ * A myfree from any other thread only pushes the pointer onto a bounded lock-free queue with
+ * many producers and one consumer; the owner drains it in one batch at the start of its next
+ * mymalloc and does the real freeing and coalescing there. Each slot carries a sequence number
+ * (Vyukov's bounded queue): a producer claims a position with one compare-and-swap on the
+ * queue's tail and publishes the slot by advancing its sequence. A producer that finds the
+ * queue full yields until the owner has drained it. The maintenance thread's queue of deferred
+ * frees is a FreeQueue too.
+ */
+#define FREE_QUEUE_SIZE 4096   // a power of two
+
+typedef struct
+{
+    atomic_size_t seq;   // position + 1 once published; position + FREE_QUEUE_SIZE once drained
+    void *ptr;
+} FreeSlot;
+
+typedef struct
+{
+    FreeSlot slots[FREE_QUEUE_SIZE];
+    atomic_size_t tail;                  // next position a producer claims
+    size_t head;                         // next position the consumer drains
+} FreeQueue;
+
+static int remoteFrees;                  // outlives initmem
+static FreeQueue remoteQueue;
+static FreeQueue maintDeferred;          // the owner pushes, whoever holds maintLock drains
+static atomic_uint poolGeneration;       // bumped by every initmem
+static _Thread_local unsigned ownedGeneration;   // the generation this thread set up, if any
+
+/* The Bitmap strategy does not use the MemList chain at all. The pool is cut into granules of
+ * bitmapGranule bytes; bit i of bitmapUsed is set while granule i is allocated, and bit i of
+ * bitmapLast marks the last granule of an allocated block, which is all myfree needs to find
+ * the block's end. Requests are rounded up to whole granules and placed in the lowest-addressed
+ * run of free granules that is long enough; freeing clears the bits, with no coalescing to do.
+ * The run search skips whole words of set (or clear) bits at a time, and the AVX2 kernel skips
+ * four words per step. Bits past the last whole granule are kept set so they are never free.
+ */
+#define BITMAP_DEFAULT_GRANULE 16
+#define BITMAP_WORD_BITS 64
+
+static int bitmapGranule = BITMAP_DEFAULT_GRANULE;   // outlives initmem, like the quick list setting
+static int bitmapKernel = MEM_KERNEL_SCALAR;
+static uint64_t *bitmapUsed;
+static uint64_t *bitmapLast;
+static long bitmapGranules;
+static long bitmapWords;
+static long bitmapHint;          // no word below this one has a free bit
+
+static void remoteReset();
+static void profileAlloc(void *ptr, size_t requested);
+static void profileFree(void *ptr);
+static void profileReset();
+static void *placeBlock(size_t requested);
+static void *placeAligned(size_t alignment, size_t requested);
+static void guardInit();
+static void numaApply();
+static void *maintPlace(size_t alignment, size_t requested);
+static void maintDefer(void *ptr);
+static void maintEnter();
+static void maintLeave();
+static char isAlloc(void *ptr);
+static int blockSize(void *ptr);
+static void *guardedMalloc(size_t requested);
+static int guardedFree(void *ptr);
+static GuardSlot *guardSlotOf(void *ptr);
+static void *directMalloc(size_t alignment, size_t requested);
+static int directFree(void *ptr);
+static DirectBlock *directOf(void *ptr, int inside);
+static void directReset();
+static void telemetryRecord(int op);
+static void freeOwned(void *block);
+static size_t splitKeep(size_t blockSize, size_t requested);
+static void remotePush(void *ptr);
+static void freeLocal(void *block);
+static void bitmapInit();
+static void *bitmapMalloc(size_t alignment, size_t requested);
+static void bitmapFree(void *ptr);
+static void bitmapSnapshot(struct mem_stats *stats);
+static int histBucket(int size);
+
+/* Fit index: the pool is split into address buckets of 2^indexShift bytes. For each bucket we
+ * keep the lowest-addressed node that starts in it, and a max segment tree over the buckets
+ * holds the largest free (alloc == 0) block starting in each. First-fit descends the tree to
+ * the leftmost bucket that can take the request and scans only that bucket's nodes; next-fit
+ * does the same from the rover's bucket onwards and, failing that, from the start of the pool.
+ * getStructPtr scans a single bucket too. Both give exactly what the list walks give.
+ * Buckets are 16 bytes wide, or wider so there are at most INDEX_MAX_BUCKETS of them.
+ */
+#define INDEX_MIN_SHIFT 4
+#define INDEX_MAX_BUCKETS (1 << 16)
+
+static int fitIndexEnabled = 1;  // outlives initmem; see mem_set_fit_index
+static int indexShift;
+static long indexBuckets;
+static long indexLeaves;         // power of two >= indexBuckets
+static MemList **indexFirst;     // NULL while the index is not built
+static int *indexMax;            // segment tree: root at 1, leaf of bucket b at indexLeaves + b
+static int *indexNodes;          // nodes starting in each subtree, laid out like indexMax; Adaptive only
+
+static void indexInit();
+static long indexNodesBefore(long bucket);
+static void indexRefresh(long bucket);
+static long indexBucket(void *ptr);
+
+/* MemList nodes live in a table per pool, mmap'ed (nothing below mymalloc calls malloc; see
+ * mallocshim.c) and handed out from the front. Nodes name each other by their number in the
+ * table, 0 being none, and their blocks by offset from myMemory, which keeps a node at 16 bytes.
+ * Slack and quick-list parking, which most blocks never have, are kept in a parallel table of
+ * shorts that is only written once one of them is used. Released nodes are kept on a free list,
+ * chained through their next numbers, and reused before the table grows.
+ *
+ * The tables start at NODE_MIN_CAPACITY entries and double with mremap, up to the most nodes
+ * the pool can need (one per byte), so the address space they take follows the heap rather
+ * than the pool size. A move changes every node's address but not its number: nodeReserve
+ * rebases the globals that hold nodes, and is called where a mymalloc or mymemalign starts,
+ * before any caller holds a node across the newNode calls that follow.
+ */
+#define NODE_ALLOC 0x80000000u   // sizeAlloc bit of an allocated block
+#define NODE_PARKED 0xFFFF       // nodeExtra of a free block parked on a quick list
+#define NODE_MIN_CAPACITY 4096
+
+static MemList *nodeTable;
+static unsigned short *nodeExtra;   // slack of an allocated block, or NODE_PARKED
+static size_t nodeLimit;            // entries mapped in nodeTable
+static size_t extraLimit;           // entries mapped in nodeExtra, at least nodeLimit
+static size_t nodeMax;              // the most entries the pool can need
+static unsigned int nodeUsed;       // entries handed out from the front, number 0 included
+static unsigned int freeNodes;
+static int extraUsed;               // set once nodeExtra has been written to
+
+static inline MemList *nodeAt(unsigned int number)
+{
+    return number != 0 ? nodeTable + number : NULL;
+}
+
+static inline unsigned int nodeNumber(MemList *node)
+{
+    return node != NULL ? (unsigned int) (node - nodeTable) : 0;
+}
+
+static inline MemList *nodeNext(MemList *node) { return nodeAt(node->next); }
+static inline MemList *nodePrev(MemList *node) { return nodeAt(node->prev); }
+static inline void setNodeNext(MemList *node, MemList *after) { node->next = nodeNumber(after); }
+static inline void setNodePrev(MemList *node, MemList *before) { node->prev = nodeNumber(before); }
+
+static inline void *nodePtr(MemList *node) { return (char *) myMemory + node->offset; }
+static inline void setNodePtr(MemList *node, void *ptr) { node->offset = (unsigned int) ((char *) ptr - (char *) myMemory); }
+
+static inline int nodeSize(MemList *node) { return (int) (node->sizeAlloc & ~NODE_ALLOC); }
+static inline void setNodeSize(MemList *node, int size) { node->sizeAlloc = (node->sizeAlloc & NODE_ALLOC) | (unsigned int) size; }
+
+static inline void setNodeExtra(MemList *node, unsigned short extra)
+{
+    unsigned short *entry = nodeExtra + nodeNumber(node);
+    if (*entry != extra) { // a table that holds only zeroes is never touched
+        *entry = extra;
+        extraUsed = 1;
+    }
+}
+
+// 1 if the block is allocated, 0 if it is free, 2 if it is free but parked on a quick list
+static inline int nodeAlloc(MemList *node)
+{
+    if (node->sizeAlloc & NODE_ALLOC)
+        return 1;
+    return extraUsed && nodeExtra[nodeNumber(node)] == NODE_PARKED ? 2 : 0;
+}
+
+// also clears the slack
+static inline void setNodeAlloc(MemList *node, int alloc)
+{
+    node->sizeAlloc = alloc == 1 ? node->sizeAlloc | NODE_ALLOC : node->sizeAlloc & ~NODE_ALLOC;
+    setNodeExtra(node, alloc == 2 ? NODE_PARKED : 0);
+}
+
+static inline int nodeSlack(MemList *node)
+{
+    return node->sizeAlloc & NODE_ALLOC ? nodeExtra[nodeNumber(node)] : 0;
+}
+
+static inline void setNodeSlack(MemList *node, int slack) { setNodeExtra(node, (unsigned short) slack); }
+
+// maps the node tables for a pool of mySize bytes; returns 0 if they could not be mapped
+static int nodeInit()
+{
+    nodeMax = mySize + 2; // every block but the last is at least a byte, and number 0 is never used
+    nodeLimit = extraLimit = nodeMax < NODE_MIN_CAPACITY ? nodeMax : NODE_MIN_CAPACITY;
+    nodeTable = mmap(NULL, nodeLimit * sizeof(MemList), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    nodeExtra = mmap(NULL, extraLimit * sizeof(unsigned short), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (nodeTable == MAP_FAILED || nodeExtra == MAP_FAILED) {
+        if (nodeTable != MAP_FAILED)
+            munmap(nodeTable, nodeLimit * sizeof(MemList));
+        if (nodeExtra != MAP_FAILED)
+            munmap(nodeExtra, extraLimit * sizeof(unsigned short));
+        nodeTable = NULL;
+        nodeExtra = NULL;
+        return 0;
+    }
+    nodeUsed = 1;
+    freeNodes = 0;
+    extraUsed = 0;
+    return 1;
+}
+
+// points every global that holds a node into the table's new place
+static void nodeRebase(uintptr_t from, MemList *table)
+{
+#define REBASE(node) ((node) != NULL ? table + ((uintptr_t) (node) - from) / sizeof(MemList) : NULL)
+    long bucket;
+    int size, k;
+
+    head = REBASE(head);
+    tail = REBASE(tail);
+    next = REBASE(next);
+    if (indexFirst != NULL)
+        for (bucket = 0; bucket < indexBuckets; bucket++)
+            indexFirst[bucket] = REBASE(indexFirst[bucket]);
+    for (size = 1; size <= quickMax; size++)
+        for (k = 0; k < quickDepth[size]; k++)
+            quickLists[size][k] = REBASE(quickLists[size][k]);
+    for (k = 0; k < lifoDepth; k++)
+        lifoStack[k] = REBASE(lifoStack[k]);
+#undef REBASE
+}
+
+/* Makes room for count more nodes from the front of the table, growing both tables if needed;
+ * returns 0 if they cannot grow. The table may move, so no caller may hold a node across it. */
+static int nodeReserve(size_t count)
+{
+    size_t limit = nodeLimit;
+
+    if (nodeTable == NULL || nodeUsed + count <= nodeLimit)
+        return 1;
+    if (nodeLimit == nodeMax)
+        return 0; // released nodes may still do
+    while (limit < nodeUsed + count && limit < nodeMax)
+        limit *= 2;
+    if (limit > nodeMax)
+        limit = nodeMax;
+
+    if (extraLimit < limit) {
+        unsigned short *extra = mremap(nodeExtra, extraLimit * sizeof(unsigned short), limit * sizeof(unsigned short), MREMAP_MAYMOVE);
+        if (extra == MAP_FAILED)
+            return 0;
+        nodeExtra = extra;
+        extraLimit = limit;
+    }
+    MemList *table = mremap(nodeTable, nodeLimit * sizeof(MemList), limit * sizeof(MemList), MREMAP_MAYMOVE);
+    if (table == MAP_FAILED)
+        return 0;
+    if (table != nodeTable)
+        nodeRebase((uintptr_t) nodeTable, table);
+    nodeTable = table;
+    nodeLimit = limit;
+    return 1;
+}
+
+/* For callers that keep MemList pointers across allocateMem and splitBlock (the benchmarks):
+ * grows the node table now so count more nodes can be made without it moving. Returns -1 if
+ * it cannot grow that far. */
+int mem_reserve_nodes(size_t count)
+{
+    return nodeReserve(count) ? 0 : -1;
+}
+
+static MemList *newNode()
+{
+    MemList *node = nodeAt(freeNodes);
+    if (node != NULL)
+        freeNodes = node->next;
+    else if (nodeUsed < nodeLimit)
+        node = nodeTable + nodeUsed++;
+    else
+        return NULL;
+    nodeCount++;
+    return node;
+}
+
+static void deleteNode(MemList *node)
+{
+    node->next = freeNodes;
+    freeNodes = nodeNumber(node);
+    nodeCount--;
+}
+
 /* initmem must be called prior to mymalloc and myfree.
 
    initmem may be called more than once in a given exeuction;
@@ -25,117 +558,1574 @@ static MemList *next;
 		- "worst" (worst-fit)
 		- "first" (first-fit)
 		- "next" (next-fit)
+		- "adaptive" (switches between the above at runtime)
+		- "bitmap" (first-fit over a bitmap of fixed-size granules; see mem_set_granule)
+		- "lifo" (the most recently freed block that fits, else first-fit)
    sz specifies the number of bytes that will be available, in total, for all mymalloc requests.
 */
 
 void initmem(strategies strategy, size_t sz)
 {
 	myStrategy = strategy;
+	mem_stop_maintenance();
+	ownedGeneration = atomic_fetch_add(&poolGeneration, 1) + 1;
+	remoteReset(); // blocks still queued belonged to the old pool
+
+	freeProgramMemory(); // free any existing block of memory and any existing structs/nodes in the linked list
 
 	/* all implementations will need an actual block of memory to use */
 	mySize = sz;
 
-	freeProgramMemory(); // free any existing block of memory and any existing structs/nodes in the linked list
+	myMemory = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (myMemory == MAP_FAILED) {
+	    myMemory = NULL;
+	    mySize = 0;
+	    return; // head stays NULL, so every mymalloc fails
+	}
+    numaApply();
 
-	myMemory = malloc(sz);
+    memset(quickDepth, 0, sizeof(quickDepth));
+    cachedBytes = cachedBlocks = quickPushes = 0;
+    lifoDepth = 0;
+
+    adaptivePolicy = adaptiveCandidate = First;
+    adaptiveVotes = adaptiveDwell = 0;
+    windowAllocs = windowFailures = 0;
+    windowSteps = windowRequested = adaptiveAllocs = 0;
+
+    guardInit();
+    profileReset();
+
+    if (myStrategy == Bitmap) {
+        bitmapInit();
+        if (telemetry != NULL)
+            telemetryRecord(TELEMETRY_NONE);
+        return;
+    }
+
+    if (!nodeInit())
+        return; // head stays NULL, so every mymalloc fails
 
     // create a new MemList struct and make all global pointers point to this at first
-    head = malloc(sizeof (MemList));
+    head = newNode();
     tail = head;
     next = head;
 
     // initialize values
-    head->size = (int) mySize;
-    head->alloc = 0;
+    setNodeSize(head, (int) mySize);
+    setNodeAlloc(head, 0);
+    setNodeSlack(head, 0);
 
     if (myStrategy == Next) {
-        head->next = head;
-        head->prev = head;
+        setNodeNext(head, head);
+        setNodePrev(head, head);
+    } else {
+        setNodeNext(head, NULL);
+        setNodePrev(head, NULL);
+    }
+    setNodePtr(head, myMemory);
+
+    freeBytes = (int) mySize;
+    holeCount = 1;
+
+    if (fitIndexEnabled)
+        indexInit();
+    if (telemetry != NULL)
+        telemetryRecord(TELEMETRY_NONE);
+}
+
+/* Allocate a block of memory with the requested size.
+ *  If the requested block is not available, mymalloc returns NULL.
+ *  Otherwise, it returns a pointer to the newly allocated block.
+ *  Restriction: requested >= 1 
+ */
+
+// returns the block the current strategy would place a request of this size in, or NULL
+static MemList *findFit(size_t requested)
+{
+	switch (myStrategy == Adaptive ? adaptivePolicy : myStrategy)
+	  {
+	  case NotSet:
+	            return NULL;
+	  case First:
+	            return findFirstFit(requested);
+	  case Best:
+	            return findBestFit(requested);
+	  case Worst:
+	            return findWorstFit(requested);
+	  case Next:
+	            return findNextFit(requested);
+	  case Lifo:
+	            return findFirstFit(requested); // once nothing on the stack fits
+	  default:
+	            return NULL;
+	  }
+}
+
+static void adaptiveObserve(size_t requested, void *ptr);
+
+static MemList *quickPop(size_t requested);
+static void *lifoPop(size_t requested);
+
+void *mymalloc(size_t requested)
+{
+	if (maintRunning)
+	    return maintPlace(0, requested);
+	void *ptr = placeBlock(requested);
+	if (profileRate > 0 && ptr != NULL)
+	    profileAlloc(ptr, requested);
+	if (telemetry != NULL)
+	    telemetryRecord(ptr != NULL ? TELEMETRY_MALLOC : TELEMETRY_FAILED);
+	return ptr;
+}
+
+static void *placeBlock(size_t requested)
+{
+	assert((int)myStrategy > 0);
+
+	if (remoteFrees)
+	    mem_drain_remote_frees();
+	if (mmapThreshold > 0 && requested >= mmapThreshold) {
+	    void *direct = directMalloc(1, requested);
+	    lastSearchLength = 0;
+	    if (direct != NULL)
+	        return direct; // otherwise the pool may still have room
+	}
+	if (guardRegion != NULL && --guardCountdown <= 0) {
+	    guardCountdown = guardRate;
+	    void *guarded = guardedMalloc(requested);
+	    if (guarded != NULL)
+	        return guarded;
+	}
+	if (myStrategy == Bitmap)
+	    return bitmapMalloc(1, requested);
+
+	nodeReserve(2); // a split, and one more after a flush
+	MemList *cached = quickPop(requested);
+	void *ptr;
+	if (cached != NULL) {
+	    lastSearchLength = 0;
+	    ptr = nodePtr(cached);
+	} else {
+	    ptr = myStrategy == Lifo ? lifoPop(requested) : NULL;
+	    if (ptr == NULL)
+	        ptr = allocateMem(findFit(requested),requested);
+	    if (ptr == NULL && cachedBlocks > 0) {
+	        mem_flush_quicklists(); // under pressure: give the parked blocks back and try again
+	        ptr = allocateMem(findFit(requested),requested);
+	    }
+	}
+	if (myStrategy == Adaptive)
+	    adaptiveObserve(requested, ptr);
+	return ptr;
+}
+
+// takes a parked block of exactly the requested size off its quick list, or returns NULL
+static MemList *quickPop(size_t requested)
+{
+    if (requested > quickMax || quickDepth[requested] == 0)
+        return NULL;
+
+    MemList *block = quickLists[requested][--quickDepth[requested]];
+    setNodeAlloc(block, 1);
+    setNodeSlack(block, 0);
+    freeBytes -= nodeSize(block);
+    holeCount--;
+    cachedBytes -= nodeSize(block);
+    cachedBlocks--;
+    return block;
+}
+
+// parks a block that is being freed on its quick list; returns 0 if it has to be freed normally
+static int quickPush(MemList *block)
+{
+    int size = nodeSize(block);
+    if (size > quickMax || quickDepth[size] == QUICKLIST_DEPTH)
+        return 0;
+
+    quickLists[size][quickDepth[size]++] = block;
+    setNodeAlloc(block, 2);
+    freeBytes += size;
+    holeCount++;
+    cachedBytes += size;
+    cachedBlocks++;
+
+    if (++quickPushes >= QUICKLIST_FLUSH_PERIOD || cachedBytes > (int) mySize / QUICKLIST_PRESSURE)
+        mem_flush_quicklists();
+    return 1;
+}
+
+// releases the k-th block of the Lifo stack, which has gone cold, and coalesces it
+static void lifoRelease(int k)
+{
+    MemList *block = lifoStack[k];
+
+    memmove(lifoStack + k, lifoStack + k + 1, (lifoDepth - k - 1) * sizeof(MemList *));
+    lifoDepth--;
+    cachedBytes -= nodeSize(block);
+    cachedBlocks--;
+    // undo the parking so releaseBlock sees an allocated block
+    freeBytes -= nodeSize(block);
+    holeCount--;
+    setNodeAlloc(block, 1);
+    releaseBlock(block);
+}
+
+// parks a free block (alloc 0, already counted as free) on top of the Lifo stack
+static void lifoPark(MemList *block)
+{
+    setNodeAlloc(block, 2);
+    if (indexFirst != NULL)
+        indexRefresh(indexBucket(nodePtr(block)));
+    lifoStack[lifoDepth++] = block;
+    cachedBytes += nodeSize(block);
+    cachedBlocks++;
+}
+
+// parks a block that is being freed under Lifo, releasing the coldest ones to make room
+static void lifoPush(MemList *block)
+{
+    if (lifoDepth == LIFO_DEPTH)
+        lifoRelease(0);
+    setNodeAlloc(block, 2);
+    freeBytes += nodeSize(block);
+    holeCount++;
+    lifoStack[lifoDepth++] = block;
+    cachedBytes += nodeSize(block);
+    cachedBlocks++;
+    while (lifoDepth > 0 && cachedBytes > (int) mySize / QUICKLIST_PRESSURE)
+        lifoRelease(0);
+}
+
+// places a request in the most recently freed block that fits; NULL if none on the stack does
+static void *lifoPop(size_t requested)
+{
+    int k = lifoDepth - 1;
+
+    while (k >= 0 && nodeSize(lifoStack[k]) < requested)
+        k--;
+    lastSearchLength = lifoDepth - k;
+    if (k < 0)
+        return NULL;
+
+    MemList *block = lifoStack[k], *after = nodeNext(block);
+    memmove(lifoStack + k, lifoStack + k + 1, (lifoDepth - k - 1) * sizeof(MemList *));
+    lifoDepth--;
+    cachedBytes -= nodeSize(block);
+    cachedBlocks--;
+    setNodeAlloc(block, 0); // a hole as far as allocateMem is concerned
+
+    void *ptr = allocateMem(block, requested);
+    if (ptr == NULL)
+        lifoPark(block); // no node for the rest; leave it parked
+    else if (nodeNext(block) != after)
+        lifoPark(nodeNext(block)); // the rest is as warm as the part handed out
+    return ptr;
+}
+
+/* Returns every parked block (on the quick lists and the Lifo stack) to the general pool,
+ * coalescing it with its free neighbours */
+void mem_flush_quicklists()
+{
+    int size;
+
+    while (lifoDepth > 0)
+        lifoRelease(lifoDepth - 1);
+    for (size = 1; size <= quickMax; size++) {
+        while (quickDepth[size] > 0) {
+            MemList *block = quickLists[size][--quickDepth[size]];
+            // undo the parking so releaseBlock sees an allocated block
+            freeBytes -= nodeSize(block);
+            holeCount--;
+            setNodeAlloc(block, 1);
+            releaseBlock(block);
+        }
+    }
+    cachedBytes = cachedBlocks = quickPushes = 0;
+}
+
+/* Blocks of at most maxSize bytes (capped at QUICKLIST_MAX) are cached on exact-size quick lists
+ * when freed; 0 turns quick lists off. The setting outlives initmem. */
+void mem_set_quicklists(int maxSize)
+{
+    if (myMemory != NULL)
+        mem_flush_quicklists();
+    quickMax = maxSize < 0 ? 0 : maxSize > QUICKLIST_MAX ? QUICKLIST_MAX : maxSize;
+}
+
+/* Average size of the holes that come of frees. The hole at the end of the pool is left out:
+ * it is usually the pool nobody has reached yet, and would hide any fragmentation in front. */
+static int adaptiveAverageHole()
+{
+    int holes = holeCount, bytes = freeBytes;
+
+    if (tail != NULL && nodeAlloc(tail) != 1) {
+        holes--;
+        bytes -= nodeSize(tail);
+    }
+    return holes > 0 ? bytes / holes : 0;
+}
+
+// the policy the window's figures argue for; see the comment at ADAPTIVE_WINDOW
+static strategies adaptiveProposal()
+{
+    long searchCost = adaptivePolicy == Next ? nodeCount / 2 : windowSteps / windowAllocs;
+
+    if (windowFailures > 0)
+        return Best;
+    if (searchCost > ADAPTIVE_SEARCH_LIMIT)
+        return Next;
+    int averageHole = adaptiveAverageHole();
+    if (averageHole > 0 && averageHole < windowRequested / windowAllocs)
+        return Worst;
+    return First;
+}
+
+/* Nodes an address-ordered walk would have visited for the request just placed at ptr. With the
+ * fit index, First scans a single bucket, which says nothing about how long the list has grown,
+ * so the nodes in the buckets before ptr's are counted in. */
+static long adaptiveWalkLength(void *ptr)
+{
+    if (adaptivePolicy != First || indexNodes == NULL)
+        return lastSearchLength; // the search walked the list itself
+    if (ptr == NULL)
+        return nodeCount;
+    if (lastSearchLength == 0)
+        return 0; // a quick-list hit, with no search at all
+    return indexNodesBefore(indexBucket(ptr)) + lastSearchLength;
+}
+
+static void adaptiveObserve(size_t requested, void *ptr)
+{
+    int failed = ptr == NULL;
+
+    adaptiveAllocs++;
+    windowAllocs++;
+    windowSteps += adaptiveWalkLength(ptr);
+    windowRequested += (long) requested;
+    windowFailures += failed;
+    if (windowAllocs < ADAPTIVE_WINDOW)
+        return;
+
+    strategies proposal = adaptiveProposal();
+    if (proposal == adaptiveCandidate)
+        adaptiveVotes++;
+    else {
+        adaptiveCandidate = proposal;
+        adaptiveVotes = 1;
+    }
+    adaptiveDwell++;
+
+    if (proposal != adaptivePolicy && adaptiveVotes >= ADAPTIVE_CONFIRM && adaptiveDwell >= ADAPTIVE_MIN_DWELL) {
+        FILE *log = adaptiveLogSet ? adaptiveLog : stderr;
+        if (log != NULL)
+            fprintf(log, "\tadaptive: %s -> %s after %ld allocations (avg search %.1f nodes, %d failed, avg hole %d bytes, avg request %ld bytes)\n",
+                    strategy_name(adaptivePolicy), strategy_name(proposal), adaptiveAllocs,
+                    (double) windowSteps / windowAllocs, windowFailures,
+                    adaptiveAverageHole(), windowRequested / windowAllocs);
+        adaptivePolicy = proposal;
+        adaptiveDwell = 0;
+    }
+
+    windowAllocs = windowFailures = 0;
+    windowSteps = windowRequested = 0;
+}
+
+/* Where the Adaptive strategy writes its switch decisions; NULL silences it. Defaults to stderr. */
+void mem_set_adaptive_log(FILE *log)
+{
+    adaptiveLog = log;
+    adaptiveLogSet = 1;
+}
+
+/* The fixed policy the Adaptive strategy is currently placing blocks with */
+strategies mem_adaptive_policy()
+{
+    return adaptivePolicy;
+}
+
+/****** Bitmap strategy ******/
+
+static int bitTest(const uint64_t *map, long bit)
+{
+    return (map[bit / BITMAP_WORD_BITS] >> (bit % BITMAP_WORD_BITS)) & 1;
+}
+
+// sets (value 1) or clears (value 0) count bits starting at bit first
+static void bitRange(uint64_t *map, long first, long count, int value)
+{
+    while (count > 0) {
+        int shift = first % BITMAP_WORD_BITS;
+        int span = count < BITMAP_WORD_BITS - shift ? (int) count : BITMAP_WORD_BITS - shift;
+        uint64_t mask = (span == BITMAP_WORD_BITS ? ~0ULL : ((1ULL << span) - 1)) << shift;
+        if (value)
+            map[first / BITMAP_WORD_BITS] |= mask;
+        else
+            map[first / BITMAP_WORD_BITS] &= ~mask;
+        first += span;
+        count -= span;
+    }
+}
+
+// first set bit at or after bit, or limit if there is none before it
+static long nextSetBit(const uint64_t *map, long bit, long limit)
+{
+    long w = bit / BITMAP_WORD_BITS;
+    uint64_t word = map[w] & (~0ULL << (bit % BITMAP_WORD_BITS));
+    while (word == 0) {
+        if (++w * BITMAP_WORD_BITS >= limit)
+            return limit;
+        word = map[w];
+    }
+    bit = w * BITMAP_WORD_BITS + __builtin_ctzll(word);
+    return bit < limit ? bit : limit;
+}
+
+// first clear bit of bitmapUsed at or after bit, or bitmapGranules if there is none
+static long nextFreeGranule(long bit)
+{
+    long w = bit / BITMAP_WORD_BITS;
+    uint64_t word = ~bitmapUsed[w] & (~0ULL << (bit % BITMAP_WORD_BITS));
+    while (word == 0) {
+        if (++w == bitmapWords)
+            return bitmapGranules;
+        word = ~bitmapUsed[w];
+    }
+    return w * BITMAP_WORD_BITS + __builtin_ctzll(word);
+}
+
+// lowest granule starting a run of count free granules, or -1
+static long findRunScalar(long count)
+{
+    long start = nextFreeGranule(bitmapHint * BITMAP_WORD_BITS);
+    bitmapHint = start / BITMAP_WORD_BITS;
+    while (start < bitmapGranules) {
+        long end = nextSetBit(bitmapUsed, start, start + count);
+        if (end - start >= count)
+            return start;
+        start = nextFreeGranule(end);
+    }
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* Words scanned one at a time before the kernel switches to 256-bit loads. Most runs in a
+ * fragmented pool end within a word or two, and for those the scalar loop is faster. */
+#define BITMAP_SCALAR_WORDS 8
+
+/* The same search, but long runs of full (or empty) words are skipped four at a time */
+__attribute__((target("avx2")))
+static long nextUsedGranuleAvx2(long bit, long limit)
+{
+    long w = bit / BITMAP_WORD_BITS;
+    uint64_t word = bitmapUsed[w] & (~0ULL << (bit % BITMAP_WORD_BITS));
+    long scalarEnd = w + BITMAP_SCALAR_WORDS;
+    while (word == 0) {
+        if (++w * BITMAP_WORD_BITS >= limit)
+            return limit;
+        while (w >= scalarEnd && w + 4 <= bitmapWords && (w + 4) * BITMAP_WORD_BITS <= limit) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (bitmapUsed + w));
+            if (!_mm256_testz_si256(v, v))
+                break;
+            w += 4;
+        }
+        if (w * BITMAP_WORD_BITS >= limit)
+            return limit;
+        word = bitmapUsed[w];
+    }
+    bit = w * BITMAP_WORD_BITS + __builtin_ctzll(word);
+    return bit < limit ? bit : limit;
+}
+
+__attribute__((target("avx2")))
+static long nextFreeGranuleAvx2(long bit)
+{
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    long w = bit / BITMAP_WORD_BITS;
+    uint64_t word = ~bitmapUsed[w] & (~0ULL << (bit % BITMAP_WORD_BITS));
+    long scalarEnd = w + BITMAP_SCALAR_WORDS;
+    while (word == 0) {
+        if (++w == bitmapWords)
+            return bitmapGranules;
+        while (w >= scalarEnd && w + 4 <= bitmapWords) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (bitmapUsed + w));
+            if (!_mm256_testc_si256(v, ones))
+                break;
+            w += 4;
+        }
+        if (w == bitmapWords)
+            return bitmapGranules;
+        word = ~bitmapUsed[w];
+    }
+    return w * BITMAP_WORD_BITS + __builtin_ctzll(word);
+}
+
+__attribute__((target("avx2")))
+static long findRunAvx2(long count)
+{
+    long start = nextFreeGranuleAvx2(bitmapHint * BITMAP_WORD_BITS);
+    bitmapHint = start / BITMAP_WORD_BITS;
+    while (start < bitmapGranules) {
+        long end = nextUsedGranuleAvx2(start, start + count);
+        if (end - start >= count)
+            return start;
+        start = nextFreeGranuleAvx2(end);
+    }
+    return -1;
+}
+
+static int haveAvx2()
+{
+    return __builtin_cpu_supports("avx2");
+}
+#else
+static long findRunAvx2(long count) { return findRunScalar(count); }
+static int haveAvx2() { return 0; }
+#endif
+
+static void bitmapInit()
+{
+    bitmapGranules = (long) (mySize / bitmapGranule);
+    bitmapWords = bitmapGranules / BITMAP_WORD_BITS + 1;   // at least one padding bit, so runs always end
+    bitmapUsed = mmap(NULL, 2 * bitmapWords * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bitmapUsed == MAP_FAILED) {
+        bitmapUsed = bitmapLast = NULL;
+        bitmapGranules = bitmapWords = 0;
+        return; // every mymalloc fails
+    }
+    bitmapLast = bitmapUsed + bitmapWords;
+    bitRange(bitmapUsed, bitmapGranules, bitmapWords * BITMAP_WORD_BITS - bitmapGranules, 1);
+    bitmapHint = 0;
+    freeBytes = (int) (bitmapGranules * bitmapGranule);
+}
+
+static void *bitmapMalloc(size_t alignment, size_t requested)
+{
+    long count = (long) ((requested + bitmapGranule - 1) / bitmapGranule);
+    long extra = alignment > bitmapGranule ? (long) (alignment / bitmapGranule) - 1 : 0;
+    if (bitmapUsed == NULL || count == 0 || count + extra > bitmapGranules)
+        return NULL;
+
+    long start = bitmapKernel == MEM_KERNEL_AVX2 ? findRunAvx2(count + extra) : findRunScalar(count + extra);
+    if (start < 0)
+        return NULL;
+
+    // skip to the first granule that is suitably aligned; the granules before and after stay free
+    char *ptr = (char *) myMemory + start * bitmapGranule;
+    start += (long) ((alignment - (uintptr_t) ptr % alignment) % alignment) / bitmapGranule;
+
+    bitRange(bitmapUsed, start, count, 1);
+    bitRange(bitmapLast, start + count - 1, 1, 1);
+    freeBytes -= (int) (count * bitmapGranule);
+    return (char *) myMemory + start * bitmapGranule;
+}
+
+// granule at which the allocated block starting at ptr begins, or -1 if ptr does not start one
+static long bitmapBlockStart(void *ptr)
+{
+    if (bitmapUsed == NULL || (char *) ptr < (char *) myMemory)
+        return -1;
+    size_t offset = (char *) ptr - (char *) myMemory;
+    long first = (long) (offset / bitmapGranule);
+    if (offset % bitmapGranule != 0 || first >= bitmapGranules || !bitTest(bitmapUsed, first))
+        return -1;
+    if (first > 0 && bitTest(bitmapUsed, first - 1) && !bitTest(bitmapLast, first - 1))
+        return -1; // inside a block
+    return first;
+}
+
+static void bitmapFree(void *ptr)
+{
+    long first = bitmapBlockStart(ptr);
+    if (first < 0)
+        return;
+
+    long last = nextSetBit(bitmapLast, first, bitmapGranules);
+    bitRange(bitmapUsed, first, last - first + 1, 0);
+    bitRange(bitmapLast, last, 1, 0);
+    freeBytes += (int) ((last - first + 1) * bitmapGranule);
+    if (first / BITMAP_WORD_BITS < bitmapHint)
+        bitmapHint = first / BITMAP_WORD_BITS;
+}
+
+// end (exclusive) of the block, allocated or free, that starts at granule
+static long bitmapBlockEnd(long granule)
+{
+    if (bitTest(bitmapUsed, granule))
+        return nextSetBit(bitmapLast, granule, bitmapGranules) + 1;
+    return nextSetBit(bitmapUsed, granule, bitmapGranules);
+}
+
+// same figures as mem_snapshot gathers from the list, from one pass over the blocks in the bitmap
+static void bitmapSnapshot(struct mem_stats *stats)
+{
+    long granule, end;
+    for (granule = 0; granule < bitmapGranules; granule = end) {
+        end = bitmapBlockEnd(granule);
+        int size = (int) ((end - granule) * bitmapGranule);
+        if (bitTest(bitmapUsed, granule)) {
+            stats->allocated_bytes += size;
+            stats->alloc_hist[histBucket(size)]++;
+        } else {
+            stats->holes++;
+            stats->free_bytes += size;
+            if (size <= stats->small_size)
+                stats->small_holes++;
+            if (size > stats->largest_free)
+                stats->largest_free = size;
+            stats->hole_hist[histBucket(size)]++;
+        }
+    }
+    stats->metadata_bytes = 2 * bitmapWords * sizeof(uint64_t);
+}
+
+/* Granule size for the Bitmap strategy: a power of two of at least 8 bytes. Takes effect at the
+ * next initmem; returns the granule in effect from then on. */
+int mem_set_granule(int granule)
+{
+    if (granule >= 8 && (granule & (granule - 1)) == 0)
+        bitmapGranule = granule;
+    return bitmapGranule;
+}
+
+/* Picks the free-run search used by the Bitmap strategy. MEM_KERNEL_AVX2 falls back to
+ * MEM_KERNEL_SCALAR on processors without AVX2; returns the kernel in use. */
+int mem_set_bitmap_kernel(int kernel)
+{
+    bitmapKernel = kernel == MEM_KERNEL_AVX2 && haveAvx2() ? MEM_KERNEL_AVX2 : MEM_KERNEL_SCALAR;
+    return bitmapKernel;
+}
+
+/****** Remote frees ******/
+
+static void queueReset(FreeQueue *queue)
+{
+    size_t i;
+    for (i = 0; i < FREE_QUEUE_SIZE; i++)
+        atomic_store_explicit(&queue->slots[i].seq, i, memory_order_relaxed);
+    atomic_store(&queue->tail, 0);
+    queue->head = 0;
+}
+
+// queues ptr; returns 0, or -1 without queueing it if wait is 0 and the queue is full
+static int queuePush(FreeQueue *queue, void *ptr, int wait)
+{
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    FreeSlot *slot;
+
+    for (;;) {
+        slot = &queue->slots[pos % FREE_QUEUE_SIZE];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break; // the slot is ours
+        } else if (seq < pos) {
+            if (!wait)
+                return -1;
+            sched_yield(); // full: the consumer has not drained this slot since its last lap
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        } else
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed); // another producer took it
+    }
+    slot->ptr = ptr;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+// takes the oldest queued pointer into *ptr; returns 0 if there is none yet
+static int queuePop(FreeQueue *queue, void **ptr)
+{
+    FreeSlot *slot = &queue->slots[queue->head % FREE_QUEUE_SIZE];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != queue->head + 1)
+        return 0; // empty, or the next producer has not published yet
+    *ptr = slot->ptr;
+    atomic_store_explicit(&slot->seq, queue->head + FREE_QUEUE_SIZE, memory_order_release);
+    queue->head++;
+    return 1;
+}
+
+static void remoteReset()
+{
+    queueReset(&remoteQueue);
+}
+
+static void remotePush(void *ptr)
+{
+    queuePush(&remoteQueue, ptr, 1);
+}
+
+/* Frees every block other threads have queued for this pool; returns how many there were.
+ * mymalloc does this itself, so only the owner needs to call it, and only to see up to date
+ * statistics. */
+int mem_drain_remote_frees()
+{
+    int drained = 0;
+    void *ptr;
+    while (queuePop(&remoteQueue, &ptr)) {
+        freeLocal(ptr);
+        drained++;
+    }
+    return drained;
+}
+
+/* With on non-zero, myfree from a thread other than the one that called initmem queues the block
+ * for that thread instead of touching the pool, so only the owner ever modifies it. Other threads
+ * may call myfree at any time; mymalloc, mymemalign and every other call stay with the owner.
+ * Off by default; the setting outlives initmem. */
+void mem_set_remote_frees(int on)
+{
+    if (remoteFrees && !on && myMemory != NULL)
+        mem_drain_remote_frees();
+    remoteFrees = on;
+}
+
+/****** Guarded sampling ******/
+
+static char *guardSlotPage(int slot)
+{
+    return guardRegion + (2 * slot + 1) * guardPage;
+}
+
+// the slot whose page, or whose guard page on either side, holds ptr; NULL outside the region
+static GuardSlot *guardSlotOf(void *ptr)
+{
+    if (guardRegion == NULL || (char *) ptr < guardRegion || (char *) ptr >= guardRegion + (2 * guardSlotCount + 1) * guardPage)
+        return NULL;
+    long page = ((char *) ptr - guardRegion) / guardPage;
+    return &guardSlots[page == 2 * guardSlotCount ? guardSlotCount - 1 : page / 2];
+}
+
+/* Fault reports are put together by hand: snprintf is not async-signal-safe */
+typedef struct
+{
+    char text[256];
+    int length;
+} GuardReport;
+
+static void reportText(GuardReport *report, const char *text)
+{
+    while (*text != '\0' && report->length < (int) sizeof(report->text))
+        report->text[report->length++] = *text++;
+}
+
+static void reportNumber(GuardReport *report, unsigned long value, unsigned int base)
+{
+    char digits[24];
+    int count = 0;
+
+    if (base == 16)
+        reportText(report, "0x");
+    do {
+        digits[count++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value != 0);
+    while (count > 0 && report->length < (int) sizeof(report->text))
+        report->text[report->length++] = digits[--count];
+}
+
+// " <offset> bytes <where> block of <size> bytes at <ptr>"
+static void reportBlock(GuardReport *report, unsigned long offset, const char *where, GuardSlot *slot)
+{
+    reportText(report, ", ");
+    reportNumber(report, offset, 10);
+    reportText(report, where);
+    reportNumber(report, (unsigned long) slot->size, 10);
+    reportText(report, " bytes at ");
+    reportNumber(report, (unsigned long) (uintptr_t) slot->ptr, 16);
+}
+
+/* Hands a fault outside the guarded region to the action that was in place before guardInit,
+ * leaving guardFault installed for the faults after it. The default action (or ignoring, which
+ * the kernel does not allow for a fault) is put back instead: the access faults again and ends
+ * the process. */
+static void guardPassOn(int signal, siginfo_t *info, void *context)
+{
+    if (guardPreviousAction.sa_flags & SA_SIGINFO)
+        guardPreviousAction.sa_sigaction(signal, info, context);
+    else if (guardPreviousAction.sa_handler != SIG_DFL && guardPreviousAction.sa_handler != SIG_IGN)
+        guardPreviousAction.sa_handler(signal);
+    else
+        sigaction(SIGSEGV, &guardPreviousAction, NULL);
+}
+
+static void guardFault(int signal, siginfo_t *info, void *context)
+{
+    char *address = info->si_addr;
+    GuardReport report = { .length = 0 };
+
+    if (guardSlotOf(address) == NULL) {
+        guardPassOn(signal, info, context);
+        return;
+    }
+    // ours: put the previous action back, so once we return the access faults again and takes its
+    // normal course; the next guardInit installs guardFault again
+    sigaction(SIGSEGV, &guardPreviousAction, NULL);
+
+    long page = (address - guardRegion) / guardPage;
+    GuardSlot *slot;
+    if (page % 2 == 1 && guardSlots[page / 2].state == 2) {
+        slot = &guardSlots[page / 2]; // a slot page is only inaccessible while the slot is free
+        reportText(&report, "mymem: use after free at ");
+        reportNumber(&report, (unsigned long) (uintptr_t) address, 16);
+        reportBlock(&report, (unsigned long) (address - slot->ptr), " bytes into a freed block of ", slot);
+    } else if (page % 2 == 0 && page > 0 && guardSlots[page / 2 - 1].state != 0) {
+        slot = &guardSlots[page / 2 - 1]; // right behind a block
+        reportText(&report, "mymem: buffer overflow at ");
+        reportNumber(&report, (unsigned long) (uintptr_t) address, 16);
+        reportBlock(&report, (unsigned long) (address - slot->ptr - slot->size),
+                    slot->state == 2 ? " bytes past the end of a freed block of " : " bytes past the end of a block of ", slot);
+    } else if (page % 2 == 0 && page / 2 < guardSlotCount && guardSlots[page / 2].state != 0) {
+        slot = &guardSlots[page / 2];
+        reportText(&report, "mymem: buffer underflow at ");
+        reportNumber(&report, (unsigned long) (uintptr_t) address, 16);
+        reportBlock(&report, (unsigned long) (slot->ptr - address), " bytes before a block of ", slot);
     } else {
-        head->next = NULL;
-        head->prev = NULL;
+        // a slot that was never used, or a guard page with no block on either side
+        reportText(&report, "mymem: wild access at ");
+        reportNumber(&report, (unsigned long) (uintptr_t) address, 16);
+        reportText(&report, " in the guarded sampling region, next to no block");
+    }
+    reportText(&report, "\n");
+    if (write(STDERR_FILENO, report.text, report.length) < 0)
+        return;
+}
+
+static void guardInit()
+{
+    int i;
+
+    if (guardRate <= 0)
+        return;
+    guardPage = (size_t) sysconf(_SC_PAGESIZE);
+    guardRegion = mmap(NULL, (2 * guardSlotsWanted + 1) * guardPage, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (guardRegion == MAP_FAILED) {
+        guardRegion = NULL; // sampling is off for this pool
+        return;
+    }
+    guardSlotCount = guardSlotsWanted;
+    for (i = 0; i < guardSlotCount; i++) {
+        guardSlots[i].state = 0;
+        guardQueue[i] = i;
+    }
+    guardQueueHead = 0;
+    guardQueueLength = guardSlotCount;
+    guardCountdown = guardRate;
+
+    // installed unless it still is: a reported fault, or the program, may have replaced it since
+    struct sigaction action;
+    sigaction(SIGSEGV, NULL, &action);
+    if (!(action.sa_flags & SA_SIGINFO) || action.sa_sigaction != guardFault) {
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = guardFault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &guardPreviousAction);
+    }
+}
+
+static void *guardedMalloc(size_t requested)
+{
+    if (requested == 0 || requested > guardPage || guardQueueLength == 0)
+        return NULL;
+
+    int index = guardQueue[guardQueueHead];
+    char *page = guardSlotPage(index);
+    if (mprotect(page, guardPage, PROT_READ | PROT_WRITE) != 0)
+        return NULL;
+    guardQueueHead = (guardQueueHead + 1) % guardSlotCount;
+    guardQueueLength--;
+
+    GuardSlot *slot = &guardSlots[index];
+    slot->ptr = page + guardPage - requested; // flush against the guard page behind it
+    slot->size = (int) requested;
+    slot->state = 1;
+    return slot->ptr;
+}
+
+// returns 1 if ptr was in the guarded region (freed, or ignored as an invalid free)
+static int guardedFree(void *ptr)
+{
+    GuardSlot *slot = guardSlotOf(ptr);
+    if (slot == NULL)
+        return 0;
+    if (slot->state != 1 || slot->ptr != ptr) {
+        fprintf(stderr, "mymem: invalid free of %p in the guarded region (%s)\n", ptr,
+                slot->state == 2 && slot->ptr == ptr ? "double free" : "not the start of a block");
+        return 1;
+    }
+
+    mprotect(guardSlotPage(slot - guardSlots), guardPage, PROT_NONE);
+    slot->state = 2;
+    guardQueue[(guardQueueHead + guardQueueLength) % guardSlotCount] = slot - guardSlots;
+    guardQueueLength++;
+    return 1;
+}
+
+/* Every rate-th mymalloc of at most a page goes to one of slots guarded slots (at most 256), where
+ * an overflow, underflow or use after free faults and is reported on stderr. 0 turns sampling off.
+ * Takes effect at the next initmem. */
+void mem_set_guarded_sampling(int rate, int slots)
+{
+    guardRate = rate < 0 ? 0 : rate;
+    guardSlotsWanted = slots < 1 ? 1 : slots > GUARD_MAX_SLOTS ? GUARD_MAX_SLOTS : slots;
+}
+
+/* Number of guarded blocks currently allocated */
+int mem_guarded_blocks()
+{
+    int i, count = 0;
+    for (i = 0; i < guardSlotCount; i++)
+        count += guardSlots[i].state == 1;
+    return count;
+}
+
+/****** Direct mappings ******/
+
+static unsigned long directHash(void *ptr)
+{
+    // direct blocks start on page boundaries, so the low bits say nothing
+    return (((uintptr_t) ptr >> 12) * 0x9E3779B97F4A7C15UL) >> 20;
+}
+
+// puts a block in the table, which has room for it
+static void directInsert(DirectBlock block)
+{
+    unsigned long slot = directHash(block.ptr) & (directCapacity - 1);
+    while (directTable[slot].ptr != NULL)
+        slot = (slot + 1) & (directCapacity - 1);
+    directTable[slot] = block;
+}
+
+// doubles the table (or makes the first one); returns 0 if there is no memory for it
+static int directGrow()
+{
+    long oldCapacity = directCapacity, i;
+    DirectBlock *old = directTable;
+    long capacity = oldCapacity > 0 ? 2 * oldCapacity : DIRECT_MIN_CAPACITY;
+
+    DirectBlock *table = mmap(NULL, capacity * sizeof(DirectBlock), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED)
+        return 0;
+    directTable = table;
+    directCapacity = capacity;
+    for (i = 0; i < oldCapacity; i++)
+        if (old[i].ptr != NULL)
+            directInsert(old[i]);
+    if (old != NULL)
+        munmap(old, oldCapacity * sizeof(DirectBlock));
+    return 1;
+}
+
+// a mapping of its own for the request, aligned to alignment; NULL if the kernel has none
+static void *directMalloc(size_t alignment, size_t requested)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t mapped = (requested + page - 1) & ~(page - 1);
+    size_t extra = alignment > page ? alignment - page : 0;
+
+    if (requested == 0 || ((directCount + 1) * 2 > directCapacity && !directGrow()))
+        return NULL;
+    char *base = mmap(NULL, mapped + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    if (extra > 0) {
+        // over-mapped to find an aligned start; the pages on either side go back
+        char *ptr = (char *) (((uintptr_t) base + alignment - 1) & ~(uintptr_t) (alignment - 1));
+        if (ptr > base)
+            munmap(base, ptr - base);
+        if (ptr + mapped < base + mapped + extra)
+            munmap(ptr + mapped, base + mapped + extra - (ptr + mapped));
+        base = ptr;
+    }
+
+    directInsert((DirectBlock) { base, mapped });
+    directCount++;
+    directBytes += mapped;
+    return base;
+}
+
+// the direct block starting at ptr, or with inside set the one holding ptr; NULL if none
+static DirectBlock *directOf(void *ptr, int inside)
+{
+    long i;
+
+    if (directTable == NULL)
+        return NULL;
+    if (inside) {
+        // mem_is_alloc only: there are few direct blocks, so a scan is fine
+        for (i = 0; i < directCapacity; i++)
+            if (directTable[i].ptr != NULL && (char *) ptr >= directTable[i].ptr && (char *) ptr < directTable[i].ptr + directTable[i].mapped)
+                return &directTable[i];
+        return NULL;
+    }
+
+    unsigned long slot = directHash(ptr) & (directCapacity - 1);
+    while (directTable[slot].ptr != NULL) {
+        if (directTable[slot].ptr == ptr)
+            return &directTable[slot];
+        slot = (slot + 1) & (directCapacity - 1);
+    }
+    return NULL;
+}
+
+// returns 1 if ptr was a direct block, which is now unmapped
+static int directFree(void *ptr)
+{
+    DirectBlock *block = directOf(ptr, 0);
+    unsigned long slot, next, home;
+
+    if (block == NULL)
+        return 0;
+    munmap(block->ptr, block->mapped);
+    directCount--;
+    directBytes -= block->mapped;
+
+    // entries after it move back, as in profileFree, so lookups never need a tombstone
+    slot = block - directTable;
+    for (next = (slot + 1) & (directCapacity - 1); directTable[next].ptr != NULL; next = (next + 1) & (directCapacity - 1)) {
+        home = directHash(directTable[next].ptr) & (directCapacity - 1);
+        if (slot <= next ? (home <= slot || home > next) : (home <= slot && home > next)) {
+            directTable[slot] = directTable[next];
+            slot = next;
+        }
+    }
+    directTable[slot].ptr = NULL;
+    return 1;
+}
+
+// unmaps every direct block and the table
+static void directReset()
+{
+    long i;
+
+    for (i = 0; i < directCapacity; i++)
+        if (directTable[i].ptr != NULL)
+            munmap(directTable[i].ptr, directTable[i].mapped);
+    if (directTable != NULL)
+        munmap(directTable, directCapacity * sizeof(DirectBlock));
+    directTable = NULL;
+    directCapacity = directCount = 0;
+    directBytes = 0;
+}
+
+/* Requests of at least bytes bytes (mymalloc and mymemalign) are served from an mmap of their own
+ * and unmapped by myfree; they take no room in the pool and no node in its list. mem_allocated and
+ * the other mem_* queries count the pool only; mem_snapshot reports direct blocks in direct_blocks
+ * and direct_bytes, and mem_is_alloc and mem_block_size know them. Direct blocks are not part
+ * of checkpoints. 0 (the default) turns the bypass off; the setting outlives initmem. */
+void mem_set_mmap_threshold(size_t bytes)
+{
+    mmapThreshold = bytes;
+}
+
+/****** Heap profile ******/
+
+// bytes to the next sample: exponentially distributed with mean profileRate
+static long profileGap()
+{
+    profileRandom ^= profileRandom << 13;
+    profileRandom ^= profileRandom >> 7;
+    profileRandom ^= profileRandom << 17;
+    double uniform = ((profileRandom >> 11) + 1) / 9007199254740992.0;   // (0, 1]
+    long gap = (long) (-log(uniform) * profileRate);
+    return gap > 0 ? gap : 1;
+}
+
+static unsigned long profileHash(void *ptr)
+{
+    return ((uintptr_t) ptr >> 4) * 0x9E3779B97F4A7C15UL;
+}
+
+// index of the site for this stack, added if it is new; -1 if the table is full
+static int profileSite(void **stack, int depth)
+{
+    unsigned long hash = 14695981039346656037UL;
+    int i, probe;
+    for (i = 0; i < depth; i++)
+        hash = (hash ^ (uintptr_t) stack[i]) * 1099511628211UL;
+
+    for (probe = 0; probe < PROFILE_SITES; probe++) {
+        int index = (hash + probe) % PROFILE_SITES;
+        ProfileSite *site = &profileSites[index];
+        if (site->depth == 0) {
+            site->depth = depth;
+            memcpy(site->stack, stack, depth * sizeof(void *));
+            return index;
+        }
+        if (site->depth == depth && memcmp(site->stack, stack, depth * sizeof(void *)) == 0)
+            return index;
     }
-    head->ptr = myMemory;
+    return -1;
+}
+
+__attribute__((noinline)) // the two frames dropped from every stack are this one and mymalloc's
+static void profileAlloc(void *ptr, size_t requested)
+{
+    void *stack[PROFILE_DEPTH + 2];
+
+    profileCountdown -= (long) requested;
+    if (profileCountdown > 0 || profileBusy || profileSites == NULL)
+        return;
+    profileCountdown = profileGap();
+
+    profileBusy = 1;
+    int depth = backtrace(stack, PROFILE_DEPTH + 2) - 2;
+    profileBusy = 0;
+    int site = depth > 0 ? profileSite(stack + 2, depth) : -1;
+    if (site < 0 || profileLiveCount >= PROFILE_LIVE / 2)
+        return; // no room: the sample is dropped
+
+    unsigned long slot = profileHash(ptr) % PROFILE_LIVE;
+    while (profileLive[slot].ptr != NULL)
+        slot = (slot + 1) % PROFILE_LIVE;
+    profileLive[slot] = (ProfileSample) { ptr, site, (int) requested };
+    profileLiveCount++;
+
+    profileSites[site].liveCount++;
+    profileSites[site].liveBytes += (long) requested;
+    profileSites[site].totalCount++;
+    profileSites[site].totalBytes += (long) requested;
+}
+
+// forgets ptr if it was sampled; entries after it move back so no lookup ever needs a tombstone
+static void profileFree(void *ptr)
+{
+    unsigned long slot = profileHash(ptr) % PROFILE_LIVE, next;
+    while (profileLive[slot].ptr != ptr) {
+        if (profileLive[slot].ptr == NULL)
+            return; // not sampled
+        slot = (slot + 1) % PROFILE_LIVE;
+    }
+
+    ProfileSite *site = &profileSites[profileLive[slot].site];
+    site->liveCount--;
+    site->liveBytes -= profileLive[slot].size;
+    profileLiveCount--;
+
+    for (next = (slot + 1) % PROFILE_LIVE; profileLive[next].ptr != NULL; next = (next + 1) % PROFILE_LIVE) {
+        unsigned long home = profileHash(profileLive[next].ptr) % PROFILE_LIVE;
+        // move the entry back unless its home lies cyclically in (slot, next]
+        if (slot <= next ? (home <= slot || home > next) : (home <= slot && home > next)) {
+            profileLive[slot] = profileLive[next];
+            slot = next;
+        }
+    }
+    profileLive[slot].ptr = NULL;
+}
+
+// a new pool starts a new profile
+static void profileReset()
+{
+    if (profileSites == NULL)
+        return;
+    memset(profileSites, 0, PROFILE_SITES * sizeof(ProfileSite));
+    memset(profileLive, 0, PROFILE_LIVE * sizeof(ProfileSample));
+    profileLiveCount = 0;
+    profileCountdown = profileGap();
+}
+
+/* Samples one allocation per rate bytes requested, on average, for the heap profile; 0 stops
+ * sampling (the figures gathered so far stay until the next initmem). Returns -1 if the tables
+ * could not be mapped. */
+int mem_set_heap_profile(long rate)
+{
+    void *stack[1];
+
+    profileRate = rate > 0 ? rate : 0;
+    if (profileRate == 0)
+        return 0;
+    if (profileSites == NULL) {
+        profileSites = mmap(NULL, PROFILE_SITES * sizeof(ProfileSite) + PROFILE_LIVE * sizeof(ProfileSample),
+                            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (profileSites == MAP_FAILED) {
+            profileSites = NULL;
+            profileRate = 0;
+            return -1;
+        }
+        profileLive = (ProfileSample *) (profileSites + PROFILE_SITES);
+        // the first backtrace loads the unwinder, which allocates; get that over with now
+        profileBusy = 1;
+        backtrace(stack, 1);
+        profileBusy = 0;
+    }
+    profileCountdown = profileGap();
+    return 0;
+}
+
+/* Writes the heap profile to fd in pprof's heap_v2 format: per call stack, the sampled blocks
+ * still live and all sampled blocks, followed by the process's mappings for symbolization.
+ * Uses no malloc, so it is safe to call from inside the shim. Returns -1 if there is no profile. */
+int mem_write_heap_profile(int fd)
+{
+    long liveCount = 0, liveBytes = 0, totalCount = 0, totalBytes = 0;
+    char buffer[4096];
+    ssize_t length;
+    int i, frame;
+
+    if (profileSites == NULL || fd < 0)
+        return -1;
+    for (i = 0; i < PROFILE_SITES; i++) {
+        liveCount += profileSites[i].liveCount;
+        liveBytes += profileSites[i].liveBytes;
+        totalCount += profileSites[i].totalCount;
+        totalBytes += profileSites[i].totalBytes;
+    }
+
+    dprintf(fd, "heap profile: %ld: %ld [%ld: %ld] @ heap_v2/%ld\n", liveCount, liveBytes, totalCount, totalBytes, profileRate);
+    for (i = 0; i < PROFILE_SITES; i++) {
+        ProfileSite *site = &profileSites[i];
+        if (site->totalCount == 0)
+            continue;
+        dprintf(fd, "%ld: %ld [%ld: %ld] @", site->liveCount, site->liveBytes, site->totalCount, site->totalBytes);
+        for (frame = 0; frame < site->depth; frame++)
+            dprintf(fd, " %p", site->stack[frame]);
+        dprintf(fd, "\n");
+    }
+
+    dprintf(fd, "\nMAPPED_LIBRARIES:\n");
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0) {
+        while ((length = read(maps, buffer, sizeof(buffer))) > 0)
+            if (write(fd, buffer, length) != length)
+                break;
+        close(maps);
+    }
+    return 0;
+}
+
+/****** Fit index ******/
+
+// the index's one mapping: first nodes, then the max tree and the node count tree
+static size_t indexBytes()
+{
+    return indexBuckets * sizeof(MemList *) + 4 * indexLeaves * sizeof(int);
+}
+
+/* Adaptive counts the nodes starting in each bucket, so that what an address-ordered walk would
+ * visit to reach a block can be told without walking: the nodes before its bucket, then the
+ * ones its bucket scan passed. The counts are kept in a tree like indexMax's. */
+static void indexCount(long bucket, int delta)
+{
+    long i;
+    for (i = indexLeaves + bucket; i > 0; i /= 2)
+        indexNodes[i] += delta;
+}
+
+static long indexNodesBefore(long bucket)
+{
+    long i, count = 0;
+    for (i = indexLeaves + bucket; i > 1; i /= 2)
+        if (i & 1)
+            count += indexNodes[i - 1]; // the left sibling's subtree lies wholly before bucket
+    return count;
+}
+
+static void indexInit()
+{
+    indexShift = INDEX_MIN_SHIFT;
+    while (((mySize - 1) >> indexShift) + 1 > INDEX_MAX_BUCKETS)
+        indexShift++;
+    indexBuckets = (long) ((mySize - 1) >> indexShift) + 1;
+    for (indexLeaves = 1; indexLeaves < indexBuckets; indexLeaves *= 2)
+        ;
+
+    // zero-filled, so every bucket starts out empty
+    indexFirst = mmap(NULL, indexBytes(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (indexFirst == MAP_FAILED) {
+        indexFirst = NULL; // fall back to walking the list
+        return;
+    }
+    indexMax = (int *) (indexFirst + indexBuckets);
+    indexNodes = myStrategy == Adaptive ? indexMax + 2 * indexLeaves : NULL;
+    indexFirst[0] = head;
+    indexRefresh(0);
+    if (indexNodes != NULL)
+        indexCount(0, 1);
+}
+
+// builds the index again for a list that was put in place wholesale (see mem_restore)
+static void indexRebuild()
+{
+    MemList *node = head;
+    long bucket;
+
+    memset(indexFirst, 0, indexBytes());
+    do {
+        bucket = indexBucket(nodePtr(node));
+        if (indexFirst[bucket] == NULL)
+            indexFirst[bucket] = node;
+        if (indexNodes != NULL)
+            indexCount(bucket, 1);
+        node = nodeNext(node);
+    } while (node != NULL && node != head);
+    for (bucket = 0; bucket < indexBuckets; bucket++)
+        if (indexFirst[bucket] != NULL)
+            indexRefresh(bucket);
+}
+
+static long indexBucket(void *ptr)
+{
+    return (long) (((char *) ptr - (char *) myMemory) >> indexShift);
+}
+
+// node's successor if it also starts in bucket, otherwise NULL (the list may be circular)
+static MemList *indexNextInBucket(MemList *node, long bucket)
+{
+    MemList *after = nodeNext(node);
+    return after != NULL && after != head && indexBucket(nodePtr(after)) == bucket ? after : NULL;
+}
+
+// recomputes the largest free block starting in bucket and pushes it up the tree
+static void indexRefresh(long bucket)
+{
+    MemList *node;
+    int largest = 0;
+    for (node = indexFirst[bucket]; node != NULL; node = indexNextInBucket(node, bucket))
+        if (nodeAlloc(node) == 0 && nodeSize(node) > largest)
+            largest = nodeSize(node);
+
+    long i = indexLeaves + bucket;
+    indexMax[i] = largest;
+    for (i /= 2; i > 0; i /= 2) {
+        int biggest = indexMax[2 * i] > indexMax[2 * i + 1] ? indexMax[2 * i] : indexMax[2 * i + 1];
+        if (indexMax[i] == biggest)
+            break; // nothing above changes either
+        indexMax[i] = biggest;
+    }
+}
+
+// leftmost bucket at or after from that holds a free block of at least requested bytes, or -1
+static long indexFindFrom(long from, size_t requested)
+{
+    long i = indexLeaves + from;
+    if (from >= indexBuckets)
+        return -1;
+    // climb right until a subtree has room, then descend to its leftmost fitting leaf
+    while (indexMax[i] < requested) {
+        while (i & 1)
+            i /= 2;
+        if (i == 0)
+            return -1;
+        i++;
+    }
+    while (i < indexLeaves)
+        i = indexMax[2 * i] >= requested ? 2 * i : 2 * i + 1;
+    return i - indexLeaves;
+}
+
+// first fitting block in bucket, starting the scan at from (a node in the bucket)
+static MemList *indexScan(MemList *from, long bucket, size_t requested)
+{
+    MemList *node;
+    for (node = from; node != NULL; node = indexNextInBucket(node, bucket)) {
+        lastSearchLength++;
+        if (nodeAlloc(node) == 0 && nodeSize(node) >= requested)
+            return node;
+    }
+    return NULL;
+}
+
+static MemList *indexFirstFit(long from, size_t requested)
+{
+    long bucket = indexFindFrom(from, requested);
+    return bucket < 0 ? NULL : indexScan(indexFirst[bucket], bucket, requested);
+}
+
+/* With on non-zero (the default), First, Next and getStructPtr use the fit index; with 0 they
+ * walk the list. Placement is the same either way. Takes effect at the next initmem. */
+void mem_set_fit_index(int on)
+{
+    fitIndexEnabled = on;
 }
 
-/* Allocate a block of memory with the requested size.
- *  If the requested block is not available, mymalloc returns NULL.
- *  Otherwise, it returns a pointer to the newly allocated block.
- *  Restriction: requested >= 1 
+/* Like mymalloc, but the returned block starts at a multiple of alignment (a power of two).
+ * A block with room for any misalignment is placed by the current strategy, then the
+ * unused bytes in front of and behind the aligned block are given back to the pool.
  */
+void *mymemalign(size_t alignment, size_t requested)
+{
+    if (maintRunning)
+        return maintPlace(alignment, requested);
+    void *ptr = placeAligned(alignment, requested);
+    if (profileRate > 0 && ptr != NULL)
+        profileAlloc(ptr, requested);
+    if (telemetry != NULL)
+        telemetryRecord(ptr != NULL ? TELEMETRY_MALLOC : TELEMETRY_FAILED);
+    return ptr;
+}
 
-void *mymalloc(size_t requested)
+static void *placeAligned(size_t alignment, size_t requested)
 {
-	assert((int)myStrategy > 0);
-	
-	switch (myStrategy)
-	  {
-	  case NotSet: 
-	            return NULL;
-	  case First:
-	            return allocateMem(findFirstFit(requested),requested);
-	  case Best:
-	            return allocateMem(findBestFit(requested),requested);
-	  case Worst:
-	            return allocateMem(findWorstFit(requested),requested);
-	  case Next:
-                return allocateMem(findNextFit(requested),requested);
-	  }
-	return NULL;
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    if (remoteFrees)
+        mem_drain_remote_frees();
+    if (mmapThreshold > 0 && requested >= mmapThreshold) {
+        void *direct = directMalloc(alignment, requested);
+        lastSearchLength = 0;
+        if (direct != NULL)
+            return direct;
+    }
+    if (myStrategy == Bitmap)
+        return bitmapMalloc(alignment, requested);
+
+    nodeReserve(3); // the block, the lead before it and the rest after it
+    size_t padded = requested + alignment - 1;
+    MemList *block = findFit(padded);
+    void *ptr = allocateMem(block, padded);
+    if (ptr == NULL && cachedBlocks > 0) {
+        mem_flush_quicklists(); // parked blocks (quick lists, Lifo stack) may coalesce into room
+        block = findFit(padded);
+        ptr = allocateMem(block, padded);
+    }
+    if (ptr == NULL)
+        return NULL;
+
+    size_t lead = (alignment - (uintptr_t) ptr % alignment) % alignment;
+    if (lead > 0) {
+        MemList *aligned = splitBlock(block, lead);
+        if (aligned == NULL) {
+            releaseBlock(block);
+            return NULL;
+        }
+        setNodeAlloc(aligned, 1);
+        if (indexFirst != NULL)
+            indexRefresh(indexBucket(nodePtr(aligned)));
+        releaseBlock(block); // the leading bytes become (part of) a hole
+        block = aligned;
+    }
+
+    size_t keep = splitKeep(nodeSize(block), requested);
+    if (nodeSize(block) > keep) {
+        MemList *trailing = splitBlock(block, keep);
+        if (trailing != NULL) {
+            setNodeAlloc(trailing, 1);
+            releaseBlock(trailing);
+        }
+    }
+    setNodeSlack(block, (unsigned short) (nodeSize(block) - requested));
+    return nodePtr(block);
 }
 
 // returns NULL if memory cannot be allocated, otherwise returns ptr to memory location (void*) of allocated block
 void* allocateMem(MemList *allocatedBlock, size_t requestedSize) {
-    if(allocatedBlock == NULL || allocatedBlock->size < requestedSize)
+    if(allocatedBlock == NULL || nodeSize(allocatedBlock) < requestedSize)
         return NULL; // return null if block does not exit or if search algorithm found a too small block (should not happen)
+    if (nodeUsed >= nodeLimit) { // called directly rather than from mymalloc
+        unsigned int number = nodeNumber(allocatedBlock);
+        nodeReserve(1);
+        allocatedBlock = nodeAt(number);
+    }
 
-    allocatedBlock->alloc = 1; // repurpose the found block by changing its alloc status. We will change its size later
-
-    if(allocatedBlock->size > requestedSize) {
-        // if requested size < block size, there will be a block of left-over memory, so we need a new struct
-        MemList *newBlock = malloc(sizeof(MemList)); // newblock will store information about the left-over chunk
-
-        // update pointers in the linked list (insert newBlock after allocatedBlock)
-        newBlock->next = allocatedBlock->next;
-        newBlock->prev = allocatedBlock;
-        if (allocatedBlock->next != NULL)
-            allocatedBlock->next->prev = newBlock;
-        allocatedBlock->next = newBlock;
-
-        // initialize newBlock data
-        newBlock->size = allocatedBlock->size - (int) requestedSize;
-        newBlock->alloc = 0;
-        newBlock->ptr = allocatedBlock->ptr + requestedSize; // the new block's starting location is oldBlockLocation + requested size
-
-        // update the size of the allocatedBlock
-        allocatedBlock->size = (int) requestedSize;
-
-        // update global tail pointer if the new block is at the end of the list
-        if (tail == allocatedBlock) {
-            tail = newBlock;
-            // for NextFit, we use a circular linked list. When we update the tail, these linkages must also be updated
-            if(myStrategy == Next) {
-                tail->next = head;
-                head->prev = tail;
-            }
+    size_t keep = splitKeep(nodeSize(allocatedBlock), requestedSize);
+    if(nodeSize(allocatedBlock) > keep) {
+        // if the block is bigger than what we keep, there will be a block of left-over memory, so we need a new struct
+        if(splitBlock(allocatedBlock, keep) == NULL)
+            return NULL; // no node available for the left-over chunk
+    } else
+        holeCount--; // the hole is used up
+    freeBytes -= (int) keep;
+
+    setNodeAlloc(allocatedBlock, 1); // repurpose the found block by changing its alloc status
+    setNodeSlack(allocatedBlock, (unsigned short) (keep - requestedSize));
+    next = nodeNext(allocatedBlock);
+    if (indexFirst != NULL)
+        indexRefresh(indexBucket(nodePtr(allocatedBlock)));
+
+    return nodePtr(allocatedBlock);
+}
+
+// how much of a free block of blockSize bytes a request keeps under the split policy
+static size_t splitKeep(size_t blockSize, size_t requested)
+{
+    size_t keep = (requested + splitGranule - 1) / splitGranule * splitGranule;
+    if (keep > blockSize || blockSize - keep < (size_t) splitMinRemainder)
+        keep = blockSize; // too small a leftover to be worth a node of its own
+    return keep;
+}
+
+/* Allocated blocks are rounded up to a multiple of granule bytes (a power of two), and a leftover
+ * of less than minRemainder bytes is handed out with the block instead of being split off.
+ * The extra bytes are reported as slack_bytes by mem_snapshot. (1, 0) restores plain splitting.
+ * Slack per block is limited to 64KB; settings that could exceed that are refused (returns -1).
+ * The settings outlive initmem. */
+int mem_set_split_policy(int granule, int minRemainder)
+{
+    if (granule < 1 || (granule & (granule - 1)) != 0 || minRemainder < 0
+        || granule - 1 + minRemainder > SPLIT_MAX_SLACK)
+        return -1;
+    splitGranule = granule;
+    splitMinRemainder = minRemainder;
+    return 0;
+}
+
+// shrinks block to size bytes and inserts a free node for the rest right after it
+// returns the new node, or NULL if no node could be allocated (block is then left untouched)
+MemList* splitBlock(MemList *block, size_t size) {
+    if (nodeUsed >= nodeLimit) { // called directly rather than from mymalloc
+        unsigned int number = nodeNumber(block);
+        nodeReserve(1);
+        block = nodeAt(number);
+    }
+    MemList *newBlock = newNode(); // newblock will store information about the left-over chunk
+    if (newBlock == NULL)
+        return NULL;
+
+    // update pointers in the linked list (insert newBlock after block)
+    setNodeNext(newBlock, nodeNext(block));
+    setNodePrev(newBlock, block);
+    if (nodeNext(block) != NULL)
+        setNodePrev(nodeNext(block), newBlock);
+    setNodeNext(block, newBlock);
+
+    // initialize newBlock data
+    setNodeSize(newBlock, nodeSize(block) - (int) size);
+    setNodeAlloc(newBlock, 0);
+    setNodeSlack(newBlock, 0);
+    setNodePtr(newBlock, nodePtr(block) + size); // the new block's starting location is oldBlockLocation + size
+
+    // update the size of the block
+    setNodeSize(block, (int) size);
+
+    // update global tail pointer if the new block is at the end of the list
+    if (tail == block) {
+        tail = newBlock;
+        // for NextFit, we use a circular linked list. When we update the tail, these linkages must also be updated
+        if(myStrategy == Next) {
+            setNodeNext(tail, head);
+            setNodePrev(head, tail);
         }
     }
-    next = allocatedBlock->next;
 
-    return allocatedBlock->ptr;
+    if (indexFirst != NULL) {
+        long bucket = indexBucket(nodePtr(newBlock));
+        if (indexFirst[bucket] == NULL || nodePtr(indexFirst[bucket]) > nodePtr(newBlock))
+            indexFirst[bucket] = newBlock;
+        if (indexNodes != NULL)
+            indexCount(bucket, 1);
+        indexRefresh(bucket);
+        if (indexBucket(nodePtr(block)) != bucket)
+            indexRefresh(indexBucket(nodePtr(block)));
+    }
+    return newBlock;
 }
 
 // returns NULL pointer if no eligible block is found, otherwise returns pointer to the block to allocate
 MemList* findWorstFit(size_t requested) {
     MemList *biggestBlockPtr = NULL, *current = head;
     int biggestBlockSize = 0;  // initialize to the smallest possible size
+    int steps = 0;
     while(current != NULL) { // iterate over the whole list - save the largest eligible block found thus far
-        if(current->alloc == 0 && current->size >= requested && current->size > biggestBlockSize) {
+        steps++;
+        if(nodeAlloc(current) == 0 && nodeSize(current) >= requested && nodeSize(current) > biggestBlockSize) {
             biggestBlockPtr = current;
-            biggestBlockSize = current->size;
+            biggestBlockSize = nodeSize(current);
         }
-        current = current->next;
+        current = nodeNext(current);
     }
+    lastSearchLength = steps;
     return biggestBlockPtr;
 }
 
@@ -143,13 +2133,16 @@ MemList* findWorstFit(size_t requested) {
 MemList* findBestFit(size_t requested) {
     MemList *current = head, *bestBlockPtr = NULL;
     size_t smallestFeasibleBlock = mySize; // initialize to the largest possible value
+    int steps = 0;
     while(current != NULL) {  // iterate over the whole list - save the smallest eligible block found thus far
-        if(current->alloc == 0 && current->size >= requested && (current->size < smallestFeasibleBlock || current->size == mySize)) {
+        steps++;
+        if(nodeAlloc(current) == 0 && nodeSize(current) >= requested && (nodeSize(current) < smallestFeasibleBlock || nodeSize(current) == mySize)) {
             bestBlockPtr = current;
-            smallestFeasibleBlock = current->size;
+            smallestFeasibleBlock = nodeSize(current);
         }
-        current = current->next;
+        current = nodeNext(current);
     }
+    lastSearchLength = steps;
     return bestBlockPtr;
 }
 
@@ -158,25 +2151,43 @@ MemList* findFirstFit(size_t requested) {
     MemList *firstBlockPtr = NULL;
     MemList *current = head;
 
+    lastSearchLength = 0;
+    if (indexFirst != NULL)
+        return indexFirstFit(0, requested);
     while(current != NULL) {
-        if (current->alloc == 0 && current->size >= requested) {
+        lastSearchLength++;
+        if (nodeAlloc(current) == 0 && nodeSize(current) >= requested) {
             firstBlockPtr = current;
             return firstBlockPtr;
         }
-        current = current->next;
+        current = nodeNext(current);
     }
     return NULL;
 }
 
 MemList* findNextFit(size_t requested) {
-    MemList *current = next;
+    MemList *start = next != NULL ? next : head;
+    MemList *current = start;
+
+    lastSearchLength = 0;
+    if (indexFirst != NULL && start != NULL) {
+        // the rest of the rover's bucket, then later buckets, then from the start of the pool
+        long bucket = indexBucket(nodePtr(start));
+        MemList *found = indexScan(start, bucket, requested);
+        if (found == NULL)
+            found = indexFirstFit(bucket + 1, requested);
+        return found != NULL ? found : indexFirstFit(0, requested);
+    }
     while(current != NULL) {
-        if (current->alloc == 0 && current->size >= requested)
+        lastSearchLength++;
+        if (nodeAlloc(current) == 0 && nodeSize(current) >= requested)
             return current;
-        current = current->next;
+        current = nodeNext(current);
 
-        if (current == next)
-            break;  // this will only happen when we have a circular list and have looped back to where we started from
+        if (current == NULL)
+            current = head;  // the list is only circular for Next; Adaptive wraps around explicitly
+        if (current == start)
+            break;  // we have looped back to where we started from
     }
     return NULL;
 }
@@ -184,47 +2195,126 @@ MemList* findNextFit(size_t requested) {
 /* Frees a block of memory previously allocated by mymalloc. */
 void myfree(void *block)
 {
+    if (remoteFrees && ownedGeneration != atomic_load_explicit(&poolGeneration, memory_order_relaxed)) {
+        if (block != NULL)
+            remotePush(block); // not our pool: the owner frees it on its next mymalloc
+        return;
+    }
+    if (maintRunning) {
+        maintDefer(block);
+        return;
+    }
+    freeLocal(block);
+}
+
+// frees a block of the calling thread's own pool
+static void freeLocal(void *block)
+{
+    freeOwned(block);
+    if (telemetry != NULL)
+        telemetryRecord(TELEMETRY_FREE);
+}
+
+static void freeOwned(void *block)
+{
+    if (profileLiveCount > 0)
+        profileFree(block);
+    if (guardRegion != NULL && guardedFree(block))
+        return;
+    if (directCount > 0 && directFree(block))
+        return;
+    if (myStrategy == Bitmap) {
+        bitmapFree(block);
+        return;
+    }
+
     MemList *freeing = getStructPtr(block); //Get the pointer for the struct corresponding to the mem location ptr
-    if (freeing == NULL || freeing->alloc == 0) //If the block is null or if it isn't in use, return
+    if (freeing == NULL || nodeAlloc(freeing) != 1) //If the block is null or if it isn't in use, return
         return;
 
-    freeing->alloc = 0;
+    if (quickPush(freeing))
+        return;
+    if (myStrategy == Lifo)
+        lifoPush(freeing);
+    else
+        releaseBlock(freeing);
+}
+
+// marks an allocated block as free and merges it with free neighbours
+void releaseBlock(MemList *freeing)
+{
+    long startBucket = indexFirst != NULL ? indexBucket(nodePtr(freeing)) : 0;
+    long rightBucket = startBucket;
 
-    if (freeing->prev != NULL && freeing != head && freeing->prev->alloc == 0) { //If there is a previous, free block in a non-circular manner, combine them
-        MemList *left = freeing->prev;
+    setNodeAlloc(freeing, 0);
+    setNodeSlack(freeing, 0);
+    freeBytes += nodeSize(freeing);
+    holeCount++;
+
+    if (nodePrev(freeing) != NULL && freeing != head && nodeAlloc(nodePrev(freeing)) == 0) { //If there is a previous, free block in a non-circular manner, combine them
+        MemList *left = nodePrev(freeing);
 
         //Update linkages (to remove the block called "left")
-        if (left->prev != NULL)
-            left->prev->next = freeing;
-        freeing->prev = left->prev;
+        if (nodePrev(left) != NULL)
+            setNodeNext(nodePrev(left), freeing);
+        setNodePrev(freeing, nodePrev(left));
 
-        freeing->ptr = left->ptr; //Update memory location ptr
-        freeing->size += left->size; //Add the size of the joined blocks
+        setNodePtr(freeing, nodePtr(left)); //Update memory location ptr
+        setNodeSize(freeing, nodeSize(freeing) + nodeSize(left)); //Add the size of the joined blocks
+        holeCount--;
 
         if (left == head)  //If the global head pointer is pointing at the link about to be deleted, update it
             head = freeing;
         if (left == next) //If the global next pointer is pointing at the link about to be deleted, update it
             next = freeing;
 
-        free(left);
+        if (indexFirst != NULL) { // freeing now starts where left did, possibly in an earlier bucket
+            long leftBucket = indexBucket(nodePtr(left));
+            if (indexFirst[startBucket] == freeing)
+                indexFirst[startBucket] = indexNextInBucket(freeing, startBucket);
+            if (indexFirst[leftBucket] == left)
+                indexFirst[leftBucket] = freeing;
+            if (indexNodes != NULL)
+                indexCount(startBucket, -1); // left's bucket keeps one node, freeing
+        }
+
+        deleteNode(left);
     }
 
-    if ((freeing->next != NULL) && (freeing != tail) && (freeing->next->alloc == 0)) { //If there is a next, free block in a non-circular manner, combine them
-        MemList *right = freeing->next;
+    if ((nodeNext(freeing) != NULL) && (freeing != tail) && (nodeAlloc(nodeNext(freeing)) == 0)) { //If there is a next, free block in a non-circular manner, combine them
+        MemList *right = nodeNext(freeing);
 
         //Update linkages (to remove the block called "right")
-        if (right->next != NULL)
-            right->next->prev = freeing;
-        freeing->next = right->next;
+        if (nodeNext(right) != NULL)
+            setNodePrev(nodeNext(right), freeing);
+        setNodeNext(freeing, nodeNext(right));
 
-        freeing->size += right->size; //Add the size of the joined blocks
+        setNodeSize(freeing, nodeSize(freeing) + nodeSize(right)); //Add the size of the joined blocks
+        holeCount--;
 
         if (right == tail) //If the global head pointer is pointing at the link about to be deleted, update it
             tail = freeing;
         if (right == next)  //If the global next pointer is pointing at the link about to be deleted, update it
             next = freeing;
 
-        free(right);
+        if (indexFirst != NULL) {
+            rightBucket = indexBucket(nodePtr(right));
+            if (indexFirst[rightBucket] == right)
+                indexFirst[rightBucket] = indexNextInBucket(right, rightBucket);
+            if (indexNodes != NULL)
+                indexCount(rightBucket, -1);
+        }
+
+        deleteNode(right);
+    }
+
+    if (indexFirst != NULL) {
+        long bucket = indexBucket(nodePtr(freeing));
+        indexRefresh(bucket);
+        if (startBucket != bucket)
+            indexRefresh(startBucket);
+        if (rightBucket != bucket && rightBucket != startBucket)
+            indexRefresh(rightBucket);
     }
 }
 
@@ -234,11 +2324,22 @@ MemList* getStructPtr(void *memLocation) {
     if(memLocation == NULL || head == NULL)
         return NULL;
 
+    if (indexFirst != NULL) {
+        if (memLocation < myMemory || memLocation >= myMemory + mySize)
+            return NULL;
+        long bucket = indexBucket(memLocation);
+        MemList *node;
+        for (node = indexFirst[bucket]; node != NULL; node = indexNextInBucket(node, bucket))
+            if (nodePtr(node) == memLocation)
+                return node;
+        return NULL;
+    }
+
     MemList *memStruct = head;
     while(memStruct != NULL) { // traverse the list to find the relevant block whose ptr = *memLocation
-        if(memStruct->ptr == memLocation)
+        if(nodePtr(memStruct) == memLocation)
             return memStruct;
-        memStruct = memStruct->next;
+        memStruct = nodeNext(memStruct);
         if(memStruct == head) // in this case, we have a circular list and have looped all the way back to the start without finding a struct
             return NULL; // thus should return null
     }
@@ -247,18 +2348,681 @@ MemList* getStructPtr(void *memLocation) {
 
 void freeProgramMemory() {
     if (myMemory != NULL)
-        free(myMemory); /* in case this is not the first time initmem2 is called */
-
-    // release memory used to store each of the nodes in the linked list
-    if (head != NULL) {
-        MemList *current = head->next, *temp;
-        while(current != NULL && current != head) { // use the head as a sentinel in the loop (in case of a circular list)
-            temp = current;
-            current = current->next;
-            free(temp);
+        munmap(myMemory, mySize); /* in case this is not the first time initmem2 is called */
+    myMemory = NULL;
+
+    // release memory used to store the nodes in the linked list; every node lives in the node table
+    if (nodeTable != NULL) {
+        munmap(nodeTable, nodeLimit * sizeof(MemList));
+        munmap(nodeExtra, extraLimit * sizeof(unsigned short));
+    }
+    nodeTable = NULL;
+    nodeExtra = NULL;
+    freeNodes = 0;
+    nodeCount = 0;
+    head = tail = next = NULL;
+
+    if (guardRegion != NULL)
+        munmap(guardRegion, (2 * guardSlotCount + 1) * guardPage);
+    guardRegion = NULL;
+    guardSlotCount = 0;
+
+    directReset();
+
+    if (indexFirst != NULL)
+        munmap(indexFirst, indexBytes());
+    indexFirst = NULL;
+    indexMax = indexNodes = NULL;
+
+    if (bitmapUsed != NULL)
+        munmap(bitmapUsed, 2 * bitmapWords * sizeof(uint64_t));
+    bitmapUsed = bitmapLast = NULL;
+    bitmapGranules = bitmapWords = 0;
+}
+
+/****** NUMA placement ******/
+
+// reads the online node list ("0-1,3") into mask; returns the highest node, or -1 if unknown
+static int numaOnline(unsigned long *mask)
+{
+    char list[256];
+    int first, last, highest = -1, node;
+    char *cursor = list;
+
+    int fd = open("/sys/devices/system/node/online", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t length = read(fd, list, sizeof(list) - 1);
+    close(fd);
+    if (length <= 0)
+        return -1;
+    list[length] = '\0';
+
+    memset(mask, 0, NUMA_MAX_NODES / 8);
+    while (sscanf(cursor, "%d", &first) == 1) {
+        last = first;
+        while (*cursor >= '0' && *cursor <= '9')
+            cursor++;
+        if (*cursor == '-' && sscanf(++cursor, "%d", &last) == 1)
+            while (*cursor >= '0' && *cursor <= '9')
+                cursor++;
+        for (node = first; node <= last && node < NUMA_MAX_NODES; node++)
+            mask[node / 64] |= 1UL << (node % 64);
+        if (last > highest)
+            highest = last < NUMA_MAX_NODES ? last : NUMA_MAX_NODES - 1;
+        if (*cursor != ',')
+            break;
+        cursor++;
+    }
+    return highest;
+}
+
+static void numaApply()
+{
+    unsigned long mask[NUMA_MAX_NODES / 64];
+    unsigned cpu, node = numaNode;
+    int mode;
+
+    numaApplied = MEM_NUMA_DEFAULT;
+    if (numaPolicy == MEM_NUMA_DEFAULT || numaOnline(mask) < 0)
+        return;
+
+    if (numaPolicy == MEM_NUMA_INTERLEAVE) {
+        mode = MPOL_INTERLEAVE;
+    } else {
+        if (numaPolicy == MEM_NUMA_LOCAL && syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+            return;
+        if (node >= NUMA_MAX_NODES)
+            return;
+        memset(mask, 0, sizeof(mask));
+        mask[node / 64] = 1UL << (node % 64);
+        mode = MPOL_BIND;
+    }
+    // maxnode counts one past the last bit the kernel reads
+    if (syscall(SYS_mbind, myMemory, mySize, mode, mask, NUMA_MAX_NODES + 1, 0) == 0)
+        numaApplied = numaPolicy;
+}
+
+/* Places the pages of pools set up by later initmem calls: MEM_NUMA_BIND puts them all on node,
+ * MEM_NUMA_INTERLEAVE spreads them over every online node, MEM_NUMA_LOCAL binds them to the
+ * node of the CPU that calls initmem, and MEM_NUMA_DEFAULT leaves them to first touch. Returns
+ * -1 for an unknown policy or a node that is out of range; a policy the machine cannot honour
+ * quietly falls back to first touch (see mem_numa_policy). */
+int mem_set_numa_policy(int policy, int node)
+{
+    if (policy < MEM_NUMA_DEFAULT || policy > MEM_NUMA_LOCAL || node < 0 || node >= NUMA_MAX_NODES)
+        return -1;
+    numaPolicy = policy;
+    numaNode = node;
+    return 0;
+}
+
+/* The policy the current pool actually got */
+int mem_numa_policy()
+{
+    return numaApplied;
+}
+
+/* Counts the pool's pages per node in pagesPerNode[0..maxNodes-1], pages that were never touched
+ * and pages on later nodes left out. Returns the number of nodes seen (1 + the highest node a
+ * page is on), 0 if no page has been touched, or -1 if the kernel cannot tell. */
+int mem_numa_placement(int *pagesPerNode, int maxNodes)
+{
+    void *pages[1024];
+    int status[1024];
+    long page = sysconf(_SC_PAGESIZE), total, done, i;
+    int nodes = 0;
+
+    if (myMemory == NULL)
+        return -1;
+    memset(pagesPerNode, 0, maxNodes * sizeof(int));
+    total = (long) ((mySize + page - 1) / page);
+    for (done = 0; done < total; done += 1024) {
+        long batch = total - done < 1024 ? total - done : 1024;
+        for (i = 0; i < batch; i++)
+            pages[i] = (char *) myMemory + (done + i) * page;
+        // with no target nodes, move_pages only reports where each page is
+        if (syscall(SYS_move_pages, 0, batch, pages, NULL, status, 0) != 0)
+            return -1;
+        for (i = 0; i < batch; i++) {
+            if (status[i] < 0)
+                continue; // not touched yet
+            if (status[i] < maxNodes)
+                pagesPerNode[status[i]]++;
+            if (status[i] >= nodes)
+                nodes = status[i] + 1;
+        }
+    }
+    return nodes;
+}
+
+/****** Telemetry ******/
+
+// counts op and copies the pool's gauges into the segment, as one seqlock write
+static void telemetryRecord(int op)
+{
+    struct mem_telemetry *t = telemetry;
+
+    __atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // readers that see the new fields see an odd seq
+
+    if (op == TELEMETRY_MALLOC || op == TELEMETRY_FAILED) {
+        t->mallocs++;
+        t->failed += op == TELEMETRY_FAILED;
+        if (myStrategy != Bitmap) {
+            t->search_hist[histBucket(lastSearchLength > 0 ? lastSearchLength : 1)]++;
+            t->search_steps += lastSearchLength;
+        }
+    } else if (op == TELEMETRY_FREE)
+        t->frees++;
+
+    t->strategy = myStrategy;
+    t->pool_bytes = (long) mySize;
+    t->free_bytes = freeBytes;
+    if (myStrategy == Bitmap) {
+        t->allocated_bytes = bitmapGranules * bitmapGranule - freeBytes;
+        t->holes = -1;
+        t->largest_free = -1;
+    } else {
+        t->allocated_bytes = (long) mySize - freeBytes;
+        t->holes = holeCount;
+        t->largest_free = indexFirst != NULL ? indexMax[1] : -1;
+    }
+    t->direct_blocks = directCount;
+    t->direct_bytes = (long) directBytes;
+
+    __atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* A child of fork shares the parent's mapping: it stops publishing, so its pool does not overwrite
+ * the parent's counters, and leaves the segment to its owner. */
+static void telemetryAfterFork(void)
+{
+    if (telemetry == NULL)
+        return;
+    munmap(telemetry, sizeof(struct mem_telemetry));
+    telemetry = NULL;
+}
+
+static void telemetryRegisterFork(void)
+{
+    pthread_atfork(NULL, NULL, telemetryAfterFork);
+}
+
+/* Publishes the pool's counters in the POSIX shared memory segment name ("/mymem.<pid>" if name
+ * is NULL), created or truncated here, until mem_stop_telemetry; mymemstat reads it. Every
+ * mymalloc, mymemalign and myfree then updates it, for the cost of a few stores; nothing walks
+ * the list. Counters run on across initmem; a forked child does not publish. Returns 0, or -1 if
+ * the segment cannot be set up. */
+int mem_start_telemetry(const char *name)
+{
+    static pthread_once_t forkHandler = PTHREAD_ONCE_INIT;
+    struct mem_telemetry *t;
+    int fd;
+
+    mem_stop_telemetry();
+    if (name != NULL)
+        snprintf(telemetryName, sizeof(telemetryName), "%s", name);
+    else
+        snprintf(telemetryName, sizeof(telemetryName), "/mymem.%d", (int) getpid());
+
+    fd = shm_open(telemetryName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, sizeof(struct mem_telemetry)) != 0) {
+        close(fd);
+        shm_unlink(telemetryName);
+        return -1;
+    }
+    t = mmap(NULL, sizeof(struct mem_telemetry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (t == MAP_FAILED) {
+        shm_unlink(telemetryName);
+        return -1;
+    }
+
+    t->version = MEM_TELEMETRY_VERSION;
+    t->pid = (int) getpid();
+    telemetryOwner = getpid();
+    telemetry = t;
+    pthread_once(&forkHandler, telemetryRegisterFork);
+    telemetryRecord(TELEMETRY_NONE);
+    __atomic_store_n(&t->magic, MEM_TELEMETRY_MAGIC, __ATOMIC_RELEASE); // last: the segment is ready
+    return 0;
+}
+
+/* Stops publishing and removes the segment, unless it belongs to another process */
+void mem_stop_telemetry()
+{
+    if (telemetry == NULL)
+        return;
+    munmap(telemetry, sizeof(struct mem_telemetry));
+    telemetry = NULL;
+    if (getpid() == telemetryOwner)
+        shm_unlink(telemetryName);
+}
+
+/****** Maintenance thread ******/
+
+// the caller's half of the pool lock, taken only while the maintenance thread runs
+static void maintEnter()
+{
+    if (maintRunning)
+        pthread_mutex_lock(&maintLock);
+}
+
+static void maintLeave()
+{
+    if (maintRunning)
+        pthread_mutex_unlock(&maintLock);
+}
+
+// applies up to budget queued frees, oldest first; returns how many. Needs maintLock.
+static int maintApply(int budget)
+{
+    int applied = 0;
+    void *ptr;
+    while (applied < budget && queuePop(&maintDeferred, &ptr)) {
+        freeLocal(ptr);
+        applied++;
+    }
+    return applied;
+}
+
+// mymalloc (alignment 0) and mymemalign while the thread runs
+static void *maintPlace(size_t alignment, size_t requested)
+{
+    pthread_mutex_lock(&maintLock);
+    void *ptr = alignment == 0 ? placeBlock(requested) : placeAligned(alignment, requested);
+    if (ptr == NULL && maintApply(INT_MAX) > 0) {
+        ptr = alignment == 0 ? placeBlock(requested) : placeAligned(alignment, requested);
+    }
+    if (profileRate > 0 && ptr != NULL)
+        profileAlloc(ptr, requested);
+    if (telemetry != NULL)
+        telemetryRecord(ptr != NULL ? TELEMETRY_MALLOC : TELEMETRY_FAILED);
+    pthread_mutex_unlock(&maintLock);
+    return ptr;
+}
+
+// myfree while the thread runs: no lock unless the thread has fallen a whole queue behind
+static void maintDefer(void *ptr)
+{
+    if (queuePush(&maintDeferred, ptr, 0) == 0)
+        return;
+    pthread_mutex_lock(&maintLock);
+    maintApply(INT_MAX);
+    freeLocal(ptr);
+    pthread_mutex_unlock(&maintLock);
+}
+
+// gives back the whole pages inside large free blocks, visiting at most budget buckets
+static void maintTrim(int budget)
+{
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    MemList *node;
+
+    while (budget-- > 0) {
+        long bucket = indexFindFrom(maintCursor, MAINT_TRIM_MIN);
+        if (bucket < 0) {
+            maintCursor = 0; // start the next sweep on the next tick
+            return;
+        }
+        for (node = indexFirst[bucket]; node != NULL; node = indexNextInBucket(node, bucket)) {
+            if (nodeAlloc(node) != 0 || nodeSize(node) < MAINT_TRIM_MIN || nodeExtra[nodeNumber(node)] == NODE_TRIMMED)
+                continue;
+            uintptr_t start = ((uintptr_t) nodePtr(node) + page - 1) & ~(page - 1);
+            uintptr_t end = ((uintptr_t) nodePtr(node) + nodeSize(node)) & ~(page - 1);
+            if (end > start && madvise((void *) start, end - start, MADV_DONTNEED) == 0)
+                maintTrimmed += end - start;
+            setNodeExtra(node, NODE_TRIMMED); // until the block is allocated or merged
+        }
+        maintCursor = bucket + 1;
+    }
+}
+
+// statistics that the counters and the fit index give without a walk
+static void maintPublish()
+{
+    struct mem_stats stats = { .small_size = 0 };
+
+    stats.free_bytes = freeBytes;
+    stats.cached_blocks = cachedBlocks;
+    stats.cached_bytes = cachedBytes;
+    if (myStrategy == Bitmap) {
+        stats.allocated_bytes = (int) (bitmapGranules * bitmapGranule) - freeBytes;
+        stats.metadata_bytes = 2 * bitmapWords * sizeof(uint64_t);
+    } else {
+        stats.allocated_bytes = (int) mySize - freeBytes;
+        stats.nodes = nodeCount;
+        stats.holes = holeCount;
+        stats.largest_free = indexFirst != NULL ? indexMax[1] : 0;
+        stats.metadata_bytes = nodeCount * (sizeof(MemList) + (extraUsed ? sizeof(unsigned short) : 0));
+    }
+    stats.direct_blocks = (int) directCount;
+    stats.direct_bytes = directBytes;
+    if (stats.free_bytes > 0 && stats.largest_free > 0)
+        stats.fragmentation = 1.0 - (double) stats.largest_free / stats.free_bytes;
+
+    pthread_mutex_lock(&maintPublishLock);
+    maintStats = stats;
+    maintShownTrimmed = maintTrimmed;
+    maintTicks++;
+    pthread_mutex_unlock(&maintPublishLock);
+}
+
+static void *maintMain(void *unused)
+{
+    struct timespec tick = { maintTickNs / 1000000000L, maintTickNs % 1000000000L };
+
+    while (!atomic_load(&maintStop)) {
+        nanosleep(&tick, NULL);
+        pthread_mutex_lock(&maintLock);
+        int budget = maintBudget - maintApply(maintBudget);
+        if (budget > 0 && indexFirst != NULL && myStrategy != Bitmap)
+            maintTrim(budget);
+        maintPublish();
+        pthread_mutex_unlock(&maintLock);
+    }
+    return NULL;
+}
+
+/* Starts a maintenance thread for the current pool that wakes every tickMicros microseconds and
+ * does at most budget units of work (a queued free applied, or a bucket of the fit index looked
+ * through for holes to trim) per tick. While it runs, freed blocks stay allocated in every
+ * statistic until a tick applies them. initmem stops the thread. Returns -1 if there is no pool,
+ * a thread is already running, or it cannot be started. */
+int mem_start_maintenance(int tickMicros, int budget)
+{
+    static int lockReady;
+    pthread_mutexattr_t recursive;
+
+    if (myMemory == NULL || maintRunning || tickMicros <= 0 || budget <= 0)
+        return -1;
+    if (!lockReady) {
+        pthread_mutexattr_init(&recursive);
+        pthread_mutexattr_settype(&recursive, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&maintLock, &recursive);
+        pthread_mutexattr_destroy(&recursive);
+        lockReady = 1;
+    }
+    maintTickNs = tickMicros * 1000L;
+    maintBudget = budget;
+    maintCursor = 0;
+    maintTicks = 0;
+    maintTrimmed = 0;
+    queueReset(&maintDeferred);
+    atomic_store(&maintStop, 0);
+    if (pthread_create(&maintThread, NULL, maintMain, NULL) != 0)
+        return -1;
+    maintRunning = 1;
+    return 0;
+}
+
+/* Stops the maintenance thread, if any, and applies the frees it had not got to */
+void mem_stop_maintenance()
+{
+    if (!maintRunning)
+        return;
+    atomic_store(&maintStop, 1);
+    pthread_join(maintThread, NULL);
+    maintRunning = 0;
+    maintApply(INT_MAX);
+}
+
+/* Copies the statistics the maintenance thread last published: the counters, and largest_free
+ * from the fit index (0 without it); the histograms, small_holes and slack_bytes are not kept.
+ * Safe to call from any thread. Returns the number of ticks so far, or -1 if no thread runs. */
+long mem_maintenance_stats(struct mem_stats *stats, size_t *trimmedBytes)
+{
+    if (!maintRunning)
+        return -1;
+    pthread_mutex_lock(&maintPublishLock);
+    *stats = maintStats;
+    long ticks = maintTicks;
+    if (trimmedBytes != NULL)
+        *trimmedBytes = maintShownTrimmed;
+    pthread_mutex_unlock(&maintPublishLock);
+    return ticks;
+}
+
+/****** Checkpoints ******/
+
+/* Bytes mem_checkpoint needs for the current pool, or 0 if there is none */
+size_t mem_checkpoint_size()
+{
+    if (myMemory == NULL)
+        return 0;
+    if (myStrategy == Bitmap)
+        return sizeof(Checkpoint) + mySize + 2 * bitmapWords * sizeof(uint64_t);
+    return sizeof(Checkpoint) + mySize + nodeUsed * (sizeof(MemList) + (extraUsed ? sizeof(unsigned short) : 0));
+}
+
+/* Saves the pool and its bookkeeping to buffer, to be put back by mem_restore. Parked
+ * quick-list blocks are returned to the pool and queued remote frees applied first; guarded
+ * blocks live outside the pool and are not saved. Returns the bytes written, or -1 if there is
+ * no pool or buffer is smaller than mem_checkpoint_size(). */
+long mem_checkpoint(void *buffer, size_t size)
+{
+    Checkpoint *saved = buffer;
+    char *payload = (char *) (saved + 1);
+
+    if (remoteFrees)
+        mem_drain_remote_frees();
+    if (cachedBlocks > 0)
+        mem_flush_quicklists();
+    if (myMemory == NULL || size < mem_checkpoint_size())
+        return -1;
+
+    *saved = (Checkpoint) {
+        .magic = CHECKPOINT_MAGIC, .strategy = myStrategy, .poolSize = mySize, .bytes = mem_checkpoint_size(),
+        .freeBytes = freeBytes, .holeCount = holeCount, .nodeCount = nodeCount, .extraUsed = extraUsed,
+        .nodeUsed = nodeUsed, .freeNodes = freeNodes,
+        .head = nodeNumber(head), .tail = nodeNumber(tail), .next = nodeNumber(next),
+        .bitmapGranule = bitmapGranule, .bitmapHint = bitmapHint,
+    };
+    memcpy(payload, myMemory, mySize);
+    payload += mySize;
+    if (myStrategy == Bitmap) {
+        memcpy(payload, bitmapUsed, 2 * bitmapWords * sizeof(uint64_t));
+    } else {
+        memcpy(payload, nodeTable, nodeUsed * sizeof(MemList));
+        if (extraUsed)
+            memcpy(payload + nodeUsed * sizeof(MemList), nodeExtra, nodeUsed * sizeof(unsigned short));
+    }
+    return (long) saved->bytes;
+}
+
+/* Whether a checkpoint header describes a pool this process could have written: its size
+ * matches what mem_checkpoint_size() would have returned, and its node numbers stay inside the
+ * saved node table. */
+static int checkpointValid(const Checkpoint *saved)
+{
+    size_t expected, words;
+
+    if (saved->poolSize == 0 || saved->poolSize > INT32_MAX)
+        return 0;
+    expected = sizeof(Checkpoint) + saved->poolSize;
+    if (saved->strategy == Bitmap) {
+        if (saved->bitmapGranule <= 0)
+            return 0;
+        words = saved->poolSize / saved->bitmapGranule / BITMAP_WORD_BITS + 1;
+        return saved->bytes == expected + 2 * words * sizeof(uint64_t)
+            && saved->bitmapHint >= 0 && saved->bitmapHint <= (long) words;
+    }
+    if (saved->nodeUsed > saved->poolSize + 2)
+        return 0;
+    if (saved->head == 0 || saved->tail == 0 || saved->head >= saved->nodeUsed
+        || saved->tail >= saved->nodeUsed || saved->next >= saved->nodeUsed)
+        return 0;
+    expected += saved->nodeUsed * (sizeof(MemList) + (saved->extraUsed ? sizeof(unsigned short) : 0));
+    return saved->bytes == expected;
+}
+
+/* Whether the node table just copied in holds together: a list from head to tail through numbers
+ * in the table whose links agree both ways, blocks that follow each other from offset 0 to the
+ * end of the pool, free bytes and holes as the header counts them, next on the list, and the
+ * rest of the table on the chain of released nodes. Walked once, before anything follows a link. */
+static int restoredListValid(const Checkpoint *saved)
+{
+    unsigned int number = saved->head, before = 0, visited = 0, released = 0, holes = 0;
+    size_t offset = 0;
+    long free = 0;
+    int sawNext = saved->next == 0;
+
+    while (visited < nodeUsed) {
+        MemList *node = nodeTable + number;
+        size_t size = (size_t) nodeSize(node);
+        // a Next pool was saved circular: head's prev is the tail
+        if ((node->prev != before && !(before == 0 && node->prev == saved->tail))
+            || node->offset != offset || size == 0 || size > saved->poolSize - offset)
+            return 0;
+        if (nodeAlloc(node) == 1) {
+            if ((size_t) nodeSlack(node) > size)
+                return 0;
+        } else if (nodeAlloc(node) == 0) {
+            free += (long) size;
+            holes++;
+        } else
+            return 0; // parked blocks are flushed before a checkpoint
+        sawNext |= number == saved->next;
+        offset += size;
+        visited++;
+        before = number;
+        if (number == saved->tail)
+            break;
+        number = node->next;
+        if (number == 0 || number >= nodeUsed)
+            return 0;
+    }
+    if (before != saved->tail || (nodeTable[before].next != 0 && nodeTable[before].next != saved->head)
+        || offset != saved->poolSize || !sawNext || visited != (unsigned int) saved->nodeCount
+        || free != saved->freeBytes || holes != (unsigned int) saved->holeCount)
+        return 0;
+
+    for (number = saved->freeNodes; number != 0; number = nodeTable[number].next)
+        if (number >= nodeUsed || ++released > nodeUsed - 1 - visited)
+            return 0;
+    return released == nodeUsed - 1 - visited;
+}
+
+/* Replaces the pool with the one saved in buffer, as initmem would replace it with an empty one.
+ * A list strategy's checkpoint can be restored under any list strategy (Best, Worst, First, Next,
+ * Adaptive or Lifo), so all of them can start from the same heap; pass NotSet for the strategy it was
+ * saved with. A Bitmap checkpoint needs Bitmap and the same granule. The new pool is at a new
+ * address: blocks are where they were relative to mem_pool(). Returns -1 if buffer does not hold
+ * a checkpoint that can be restored. Its header is checked before the old pool is discarded; a
+ * node table that does not hold together is found once it is copied in, and leaves an empty pool. */
+int mem_restore(const void *buffer, size_t size, strategies strategy)
+{
+    const Checkpoint *saved = buffer;
+    const char *payload = (const char *) (saved + 1);
+
+    if (size < sizeof(Checkpoint) || saved->magic != CHECKPOINT_MAGIC || size < saved->bytes)
+        return -1;
+    if (strategy == NotSet)
+        strategy = saved->strategy;
+    if ((strategy == Bitmap) != (saved->strategy == Bitmap)
+        || (strategy == Bitmap && saved->bitmapGranule != bitmapGranule))
+        return -1;
+    if (!checkpointValid(saved))
+        return -1;
+
+    initmem(strategy, saved->poolSize);
+    if (myMemory == NULL || (strategy == Bitmap ? bitmapUsed == NULL : head == NULL))
+        return -1;
+    memcpy(myMemory, payload, mySize);
+    payload += mySize;
+    freeBytes = saved->freeBytes;
+    holeCount = saved->holeCount;
+
+    if (strategy == Bitmap) {
+        memcpy(bitmapUsed, payload, 2 * bitmapWords * sizeof(uint64_t));
+        bitmapHint = saved->bitmapHint;
+        return 0;
+    }
+
+    if (saved->nodeUsed > nodeUsed && !nodeReserve(saved->nodeUsed - nodeUsed)) {
+        initmem(strategy, saved->poolSize);
+        return -1;
+    }
+    memcpy(nodeTable, payload, saved->nodeUsed * sizeof(MemList));
+    if (saved->extraUsed)
+        memcpy(nodeExtra, payload + saved->nodeUsed * sizeof(MemList), saved->nodeUsed * sizeof(unsigned short));
+    extraUsed = saved->extraUsed;
+    nodeUsed = saved->nodeUsed;
+    freeNodes = saved->freeNodes;
+    nodeCount = saved->nodeCount;
+    head = nodeAt(saved->head);
+    tail = nodeAt(saved->tail);
+    next = nodeAt(saved->next);
+    if (!restoredListValid(saved)) {
+        initmem(strategy, saved->poolSize);
+        return -1;
+    }
+
+    // only Next keeps the list circular
+    setNodeNext(tail, strategy == Next ? head : NULL);
+    setNodePrev(head, strategy == Next ? tail : NULL);
+    if (next == NULL && strategy == Next)
+        next = head;
+
+    if (indexFirst != NULL)
+        indexRebuild();
+    return 0;
+}
+
+/* mem_checkpoint to a file; returns -1 if it cannot be written */
+int mem_checkpoint_file(const char *path)
+{
+    size_t size = mem_checkpoint_size();
+    long written = -1;
+    void *buffer;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    if (size > 0 && ftruncate(fd, size) == 0) {
+        buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (buffer != MAP_FAILED) {
+            written = mem_checkpoint(buffer, size);
+            munmap(buffer, size);
+        }
+    }
+    // flushing the quick lists may have left the checkpoint a little shorter than its estimate
+    if (written < 0 || ftruncate(fd, written) != 0)
+        written = -1;
+    close(fd);
+    return written < 0 ? -1 : 0;
+}
+
+/* mem_restore from a file written by mem_checkpoint_file */
+int mem_restore_file(const char *path, strategies strategy)
+{
+    struct stat info;
+    int result = -1;
+    void *buffer;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        buffer = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer != MAP_FAILED) {
+            result = mem_restore(buffer, info.st_size, strategy);
+            munmap(buffer, info.st_size);
         }
-        free(head); // free the head last
     }
+    close(fd);
+    return result;
+}
+
+// the Bitmap strategy keeps no list to walk, so the queries below are answered from a snapshot
+static struct mem_stats bitmapStats(int smallSize)
+{
+    struct mem_stats stats = { .small_size = smallSize };
+    mem_snapshot(&stats);
+    return stats;
 }
 
 /****** Memory status/property functions ******
@@ -270,92 +3034,216 @@ void freeProgramMemory() {
 /* Get the number of contiguous areas of free space in memory. */
 int mem_holes()
 {
+    if (myStrategy == Bitmap)
+        return bitmapStats(0).holes;
+
+    maintEnter();
     MemList *current = head;
     int count = 0;
     while ( current != NULL ) {
-        if ((int)current->alloc == 0) // traverse the list and add to the counter if alloc is 0
+        if ((int)nodeAlloc(current) != 1) // traverse the list and add to the counter if the block is free or parked on a quick list
             count++;
-        current = current->next;
+        current = nodeNext(current);
         if(current == head)
             break;  // this will only happen if we have a circular list and have looped back to the beginning - so we should exit the loop
     }
+    maintLeave();
 	return count;
 }
 
 /* Get the number of bytes allocated */
 int mem_allocated()
 {
+    if (myStrategy == Bitmap)
+        return bitmapStats(0).allocated_bytes;
+
+    maintEnter();
     MemList *current = head;
     int countBytes = 0;
     while ( current != NULL) {
-        if ((int)current->alloc == 1) // traverse the list and add size if alloc is 1
-            countBytes += current->size;
-        current = current->next;
+        if ((int)nodeAlloc(current) == 1) // traverse the list and add size if alloc is 1
+            countBytes += nodeSize(current);
+        current = nodeNext(current);
         if(current == head)
             break;  // this will only happen if we have a circular list and have looped back to the beginning - so we should exit the loop
     }
+    maintLeave();
     return countBytes;
 }
 
 /* Number of non-allocated bytes */
 int mem_free()
 {
+    if (myStrategy == Bitmap)
+        return bitmapStats(0).free_bytes;
+
+    maintEnter();
     MemList *current = head;
     int countBytes = 0;
     while ( current != NULL) {
-        if ((int)current->alloc == 0) // traverse the list and add size if alloc is 0
-            countBytes += current->size;
-        current = current->next;
+        if ((int)nodeAlloc(current) != 1) // traverse the list and add size if the block is free or parked on a quick list
+            countBytes += nodeSize(current);
+        current = nodeNext(current);
         if(current == head)
             break;  // this will only happen if we have a circular list and have looped back to the beginning - so we should exit the loop
     }
+    maintLeave();
 	return countBytes;
 }
 
 /* Number of bytes in the largest contiguous area of unallocated memory */
 int mem_largest_free()
 {
+    if (myStrategy == Bitmap)
+        return bitmapStats(0).largest_free;
+
+    maintEnter();
     MemList *current = head;
     int biggestBlockSize = 0;  // initialize to the smallest possible size
     while(current != NULL) { // iterate over the whole list - save the largest free block's size
-        if(current->alloc == 0 && current->size > biggestBlockSize)
-            biggestBlockSize = current->size;
-        current = current->next;
+        if(nodeAlloc(current) != 1 && nodeSize(current) > biggestBlockSize)
+            biggestBlockSize = nodeSize(current);
+        current = nodeNext(current);
         if(current == head)
             break;  // this will only happen if we have a circular list and have looped back to the beginning - so we should exit the loop
     }
+    maintLeave();
     return biggestBlockSize;
 }
 
 /* Number of free blocks smaller than or equal to "size" bytes. */
 int mem_small_free(int size)
 {
+    if (myStrategy == Bitmap)
+        return bitmapStats(size).small_holes;
+
+    maintEnter();
     int count = 0;
     MemList *current = head;
     while(current != NULL) {
-        if(current->alloc == 0 && current->size <= size)
+        if(nodeAlloc(current) != 1 && nodeSize(current) <= size)
             count++;
-        current = current->next;
+        current = nodeNext(current);
         if(current == head)
             break;  // this will only happen if we have a circular list and have looped back to the beginning - so we should exit the loop
     }
+    maintLeave();
     return count;
 }
 
 /* Allocation status of a particular byte. */
 char mem_is_alloc(void *ptr)
 {
+    maintEnter();
+    char alloc = isAlloc(ptr);
+    maintLeave();
+    return alloc;
+}
+
+static char isAlloc(void *ptr)
+{
+    GuardSlot *slot = guardSlotOf(ptr);
+    if (slot != NULL)
+        return slot->state == 1 && (char *) ptr >= slot->ptr && (char *) ptr < slot->ptr + slot->size;
+    if (directCount > 0 && directOf(ptr, 1) != NULL)
+        return 1;
+
+    if (myStrategy == Bitmap)
+        return bitmapUsed != NULL && ptr >= myMemory && ptr < myMemory + bitmapGranules * bitmapGranule
+               && bitTest(bitmapUsed, (ptr - myMemory) / bitmapGranule);
+
     MemList *current = head;
     while(current != NULL) {
-        if(ptr >= current->ptr && ptr < (current->ptr + current->size))
-            return current->alloc;
-        current = current->next;
+        if(ptr >= nodePtr(current) && ptr < (nodePtr(current) + nodeSize(current)))
+            return nodeAlloc(current) == 1;
+        current = nodeNext(current);
         if(current == head) // this should not happen
             break; // it would mean that we have looped thru the whole (circular) list without finding the ptr anywhere
     }
     return 0;
 }
 
+/* Size of the allocated block starting at ptr (rounded up to whole granules with Bitmap),
+ * or 0 if ptr is not the start of an allocated block. */
+int mem_block_size(void *ptr)
+{
+    maintEnter();
+    int size = blockSize(ptr);
+    maintLeave();
+    return size;
+}
+
+static int blockSize(void *ptr)
+{
+    GuardSlot *slot = guardSlotOf(ptr);
+    if (slot != NULL)
+        return slot->state == 1 && slot->ptr == ptr ? slot->size : 0;
+    DirectBlock *direct = directCount > 0 ? directOf(ptr, 0) : NULL;
+    if (direct != NULL)
+        return direct->mapped < INT32_MAX ? (int) direct->mapped : INT32_MAX;
+
+    if (myStrategy == Bitmap) {
+        long first = bitmapBlockStart(ptr);
+        return first < 0 ? 0 : (int) ((nextSetBit(bitmapLast, first, bitmapGranules) - first + 1) * bitmapGranule);
+    }
+
+    MemList *block = getStructPtr(ptr);
+    return block != NULL && nodeAlloc(block) == 1 ? nodeSize(block) : 0;
+}
+
+// index of the log2 histogram bucket for a block of the given size (size >= 1)
+static int histBucket(int size) {
+    int bucket = 31 - __builtin_clz((unsigned) size);
+    return bucket < MEM_HIST_BUCKETS ? bucket : MEM_HIST_BUCKETS - 1;
+}
+
+/* Fill in all pool statistics with a single traversal of the list.
+ * The caller sets stats->small_size before the call; every other field is overwritten.
+ */
+void mem_snapshot(struct mem_stats *stats)
+{
+    maintEnter();
+    int smallSize = stats->small_size;
+    memset(stats, 0, sizeof(*stats));
+    stats->small_size = smallSize;
+
+    if (myStrategy == Bitmap)
+        bitmapSnapshot(stats);
+
+    MemList *current = head;
+    while(current != NULL) {
+        stats->nodes++;
+        if(nodeAlloc(current) != 1) {
+            if(nodeAlloc(current) == 2) {
+                stats->cached_blocks++;
+                stats->cached_bytes += nodeSize(current);
+            }
+            stats->holes++;
+            stats->free_bytes += nodeSize(current);
+            if(nodeSize(current) <= smallSize)
+                stats->small_holes++;
+            if(nodeSize(current) > stats->largest_free)
+                stats->largest_free = nodeSize(current);
+            stats->hole_hist[histBucket(nodeSize(current))]++;
+        } else {
+            stats->allocated_bytes += nodeSize(current);
+            stats->slack_bytes += nodeSlack(current);
+            stats->alloc_hist[histBucket(nodeSize(current))]++;
+        }
+        current = nodeNext(current);
+        if(current == head)
+            break;  // this will only happen if we have a circular list and have looped back to the beginning - so we should exit the loop
+    }
+
+    if (myStrategy != Bitmap)
+        stats->metadata_bytes = stats->nodes * (sizeof(MemList) + (extraUsed ? sizeof(unsigned short) : 0));
+    stats->direct_blocks = (int) directCount;
+    stats->direct_bytes = directBytes;
+    if(stats->free_bytes > 0)
+        stats->fragmentation = 1.0 - (double) stats->largest_free / stats->free_bytes;
+    maintLeave();
+}
+
 
 /* 
  * Feel free to use these functions, but do not modify them.  
@@ -387,6 +3275,12 @@ char *strategy_name(strategies strategy)
 			return "first";
 		case Next:
 			return "next";
+		case Adaptive:
+			return "adaptive";
+		case Bitmap:
+			return "bitmap";
+		case Lifo:
+			return "lifo";
 		default:
 			return "unknown";
 	}
@@ -411,6 +3305,18 @@ strategies strategyFromString(char * strategy)
 	{
 		return Next;
 	}
+	else if (!strcmp(strategy,"adaptive"))
+	{
+		return Adaptive;
+	}
+	else if (!strcmp(strategy,"bitmap"))
+	{
+		return Bitmap;
+	}
+	else if (!strcmp(strategy,"lifo"))
+	{
+		return Lifo;
+	}
 	else
 	{
 		return 0;
@@ -425,12 +3331,23 @@ strategies strategyFromString(char * strategy)
 /* Use this function to print out the current contents of memory. */
 void print_memory()
 {
+    if (myStrategy == Bitmap) {
+        long granule, end;
+        printf("The blocks in memory (%d byte granules) are:\n", bitmapGranule);
+        for (granule = 0; granule < bitmapGranules; granule = end) {
+            end = bitmapBlockEnd(granule);
+            printf("allocStatus : %d\tsize: %ld\n", bitTest(bitmapUsed, granule), (end - granule) * bitmapGranule);
+        }
+        printf("\n");
+        return;
+    }
+
     MemList *current = head;
     /* Print all the elements in the linked list */
     printf("The blocks in memory are:\n");
     while ( current != NULL) {
-        printf("allocStatus : %d\tsize: %d\n", current->alloc,current->size);
-        current = current->next;
+        printf("allocStatus : %d\tsize: %d\n", nodeAlloc(current),nodeSize(current));
+        current = nodeNext(current);
         if(current == head) // break in case we have looped all the way through a circular list
             break;
     }
@@ -441,7 +3358,7 @@ void print_memory()
     current = head;
     while ( current != NULL) {
         count++;
-        current = current->next;
+        current = nodeNext(current);
         if(current == head) // break in case we have looped all the way through a circular list
             break;
     }
@@ -454,9 +3371,12 @@ void print_memory()
  */ 
 void print_memory_status()
 {
-	printf("%d out of %d bytes allocated.\n",mem_allocated(),mem_total());
-	printf("%d bytes are free in %d holes; maximum allocatable block is %d bytes.\n",mem_free(),mem_holes(),mem_largest_free());
-	printf("Average hole size is %f.\n\n",((float)mem_free())/mem_holes());
+	struct mem_stats stats = { .small_size = 0 };
+	mem_snapshot(&stats);
+	printf("%d out of %d bytes allocated.\n",stats.allocated_bytes,mem_total());
+	printf("%d bytes are free in %d holes; maximum allocatable block is %d bytes.\n",stats.free_bytes,stats.holes,stats.largest_free);
+	printf("Average hole size is %f.\n",((float)stats.free_bytes)/stats.holes);
+	printf("External fragmentation is %f; %d nodes use %zu bytes of metadata.\n\n",stats.fragmentation,stats.nodes,stats.metadata_bytes);
 }
 
 /* Use this function to see what happens when your malloc and free
@@ -1,15 +1,23 @@
 #include <stddef.h>
+#include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A block of the pool: 16 bytes, with 32-bit node numbers for the links and a 32-bit offset
+ * into the pool, so pools are limited to 2GB. mymem.c reads and writes the fields through
+ * accessors (nodeNext, nodeSize, nodeAlloc, ...), which also know where the slack and the
+ * quick-list state of a block are kept.
+ */
 typedef struct memoryList
 {
-    // doubly-linked list
-    struct memoryList *prev;
-    struct memoryList *next;
-
-    int size;            // How many bytes in this block?
-    char alloc;          // 1 if this block is allocated,
-    // 0 if this block is free.
-    void *ptr;           // location of block in memory pool.
+    // doubly-linked list, by node number (0 for none)
+    unsigned int prev;
+    unsigned int next;
+
+    unsigned int offset;     // location of block in memory pool, from its start
+    unsigned int sizeAlloc;  // How many bytes in this block, with the top bit set if it is allocated
 } MemList;
 
 typedef enum strategies_enum
@@ -18,14 +26,82 @@ typedef enum strategies_enum
 	Best = 1,
 	Worst = 2,
 	First = 3,
-	Next = 4
+	Next = 4,
+	Adaptive = 5,
+	Bitmap = 6,
+	Lifo = 7
 } strategies;
 
+/* free-run search kernels for the Bitmap strategy (see mem_set_bitmap_kernel) */
+#define MEM_KERNEL_SCALAR 0
+#define MEM_KERNEL_AVX2 1
+
+/* pool page placement (see mem_set_numa_policy) */
+#define MEM_NUMA_DEFAULT 0
+#define MEM_NUMA_BIND 1
+#define MEM_NUMA_INTERLEAVE 2
+#define MEM_NUMA_LOCAL 3
+
+#define MEM_HIST_BUCKETS 32
+
+/* Summary of the pool, filled in by a single walk of the list (see mem_snapshot).
+ * small_size is an input: free blocks of at most small_size bytes are counted in small_holes.
+ * Histogram bucket k counts blocks whose size is in [2^k, 2^(k+1)).
+ */
+struct mem_stats
+{
+    int small_size;
+    int nodes;           // number of MemList nodes in the list (0 with Bitmap)
+    int holes;
+    int small_holes;
+    int free_bytes;
+    int allocated_bytes;     // including slack_bytes
+    int slack_bytes;         // allocated beyond the requests by the split policy
+    int largest_free;
+    int cached_blocks;       // free blocks parked on quick lists or Lifo's stack; included in holes and free_bytes
+    int cached_bytes;
+    size_t metadata_bytes;   // bytes spent on MemList nodes, or on the bitmaps
+    int direct_blocks;       // blocks mapped on their own (see mem_set_mmap_threshold); not in the figures above
+    size_t direct_bytes;     // bytes mapped for them
+    double fragmentation;    // external fragmentation index: 1 - largest_free / free_bytes
+    int hole_hist[MEM_HIST_BUCKETS];
+    int alloc_hist[MEM_HIST_BUCKETS];
+};
+
+/* Live counters of a pool, published in shared memory (see mem_start_telemetry) and read by
+ * mymemstat. The writer makes seq odd while it updates the rest; a reader copies the struct
+ * and keeps the copy if seq was even before and unchanged after.
+ */
+#define MEM_TELEMETRY_MAGIC 0x54454d4d   // "MMET"
+#define MEM_TELEMETRY_VERSION 1
+
+struct mem_telemetry
+{
+    unsigned int magic;      // set once the segment is filled in
+    unsigned int version;
+    unsigned long seq;
+    int pid;
+    int strategy;
+    long pool_bytes;
+    long allocated_bytes;
+    long free_bytes;
+    long holes;              // -1 with Bitmap, which keeps no count of them
+    long largest_free;       // -1 without the fit index
+    long direct_blocks;
+    long direct_bytes;
+    long mallocs;            // mymalloc and mymemalign calls, failed ones included
+    long frees;
+    long failed;
+    long search_steps;       // nodes visited by all fit searches
+    long search_hist[MEM_HIST_BUCKETS];   // fit searches by nodes visited, in log2 buckets (0 and 1 in bucket 0)
+};
+
 char *strategy_name(strategies strategy);
 strategies strategyFromString(char * strategy);
 
 void initmem(strategies strategy, size_t sz);
 void *mymalloc(size_t requested);
+void *mymemalign(size_t alignment, size_t requested);
 void myfree(void* block);
 
 int mem_holes();
@@ -35,14 +111,59 @@ int mem_total();
 int mem_largest_free();
 int mem_small_free(int size);
 char mem_is_alloc(void *ptr);
+void mem_snapshot(struct mem_stats *stats);
+void mem_set_adaptive_log(FILE *log);
+strategies mem_adaptive_policy();
+void mem_set_quicklists(int maxSize);
+void mem_flush_quicklists();
+int mem_set_granule(int granule);
+int mem_set_bitmap_kernel(int kernel);
+int mem_block_size(void *ptr);
+void mem_set_fit_index(int on);
+int mem_set_split_policy(int granule, int minRemainder);
+void mem_set_remote_frees(int on);
+int mem_drain_remote_frees();
+void mem_set_guarded_sampling(int rate, int slots);
+int mem_guarded_blocks();
+void mem_set_mmap_threshold(size_t bytes);
+int mem_start_telemetry(const char *name);
+void mem_stop_telemetry();
+int mem_set_heap_profile(long rate);
+int mem_write_heap_profile(int fd);
+size_t mem_checkpoint_size();
+long mem_checkpoint(void *buffer, size_t size);
+int mem_restore(const void *buffer, size_t size, strategies strategy);
+int mem_checkpoint_file(const char *path);
+int mem_restore_file(const char *path, strategies strategy);
+int mem_set_numa_policy(int policy, int node);
+int mem_numa_policy();
+int mem_numa_placement(int *pagesPerNode, int maxNodes);
+int mem_start_maintenance(int tickMicros, int budget);
+void mem_stop_maintenance();
+long mem_maintenance_stats(struct mem_stats *stats, size_t *trimmedBytes);
 void* mem_pool();
 void print_memory();
 void print_memory_status();
 void try_mymem(int argc, char **argv);
+
+/* The list underneath mymalloc and myfree, for tests and benchmarks. MemList nodes live in a
+ * node table that grows with mremap, so allocateMem and splitBlock, which may need a new node,
+ * can move it: every MemList* held from before the call, including what find*Fit and
+ * getStructPtr returned, is then stale. A caller that keeps such pointers across these calls
+ * reserves the nodes first with mem_reserve_nodes (0, or -1 if the table cannot grow that far),
+ * or looks them up again afterwards. releaseBlock and the find*Fit searches never move it.
+ */
 void* allocateMem(MemList *blockToAllocate, size_t requestedSize);
+MemList* splitBlock(MemList *block, size_t size);
+int mem_reserve_nodes(size_t count);
+void releaseBlock(MemList *freeing);
 MemList* findFirstFit(size_t requested);
 MemList* findWorstFit(size_t requested);
 MemList* findBestFit(size_t requested);
 MemList* findNextFit(size_t requested);
 MemList* getStructPtr(void *memLocation);
-void freeProgramMemory();
\ No newline at end of file
+void freeProgramMemory();
+
+#ifdef __cplusplus
+}
+#endif
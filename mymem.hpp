@@ -0,0 +1,86 @@
+/* C++ access to the pool: mymem::resource is a std::pmr::memory_resource that allocates with
+ * mymalloc/mymemalign and frees with myfree, so pmr containers can live in the pool unchanged:
+ *
+ *   initmem(Best, 64 << 20);
+ *   mymem::resource pool;
+ *   std::pmr::vector<int> numbers(&pool);
+ *
+ * mymem::allocator<T> does the same for containers that take an allocator type instead.
+ * Like arenas and object pools, both use the one pool initmem set up, so every resource and
+ * allocator compares equal to every other; a container must not outlive the next initmem.
+ * The pool is not thread-safe, and neither are these.
+ */
+#ifndef MYMEM_HPP
+#define MYMEM_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "mymem.h"
+
+namespace mymem {
+
+/* a block of at least bytes bytes aligned to alignment; throws std::bad_alloc if nothing fits */
+inline void *allocate(std::size_t bytes, std::size_t alignment)
+{
+    void *ptr;
+
+    if (bytes == 0)
+        bytes = 1;
+    // every byte offset is a block start in the list strategies, so only alignment 1 needs no padding
+    ptr = alignment <= 1 ? mymalloc(bytes) : mymemalign(alignment, bytes);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+class resource : public std::pmr::memory_resource
+{
+public:
+    resource() = default;
+
+    // starts a fresh pool, as initmem does, and wraps it
+    resource(strategies strategy, std::size_t size) { initmem(strategy, size); }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return mymem::allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override { myfree(ptr); }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const resource *>(&other) != nullptr;
+    }
+};
+
+template <class T>
+struct allocator
+{
+    typedef T value_type;
+
+    allocator() noexcept = default;
+    template <class U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t count)
+    {
+        if (count > static_cast<std::size_t>(-1) / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast<T *>(mymem::allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t) noexcept { myfree(ptr); }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept { return true; }
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept { return false; }
+
+} // namespace mymem
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Reads the counters a process publishes with mem_start_telemetry and prints them as
+ * Prometheus text, once or every few seconds:
+ *
+ *   make mymemstat
+ *   ./mymemstat <pid | /segment-name> [interval-seconds]
+ *
+ * A pid stands for the default segment, /mymem.<pid>. The segment is only read: the process
+ * is not stopped or attached to, and the pool's list is not walked. With an interval, it keeps
+ * printing until the process exits.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mymem.h"
+
+static const char *strategyNames[] = { "none", "best", "worst", "first", "next", "adaptive", "bitmap", "lifo" };
+
+/* a consistent copy of the segment, taken when no update is under way */
+static void readTelemetry(const struct mem_telemetry *shared, struct mem_telemetry *copy)
+{
+	unsigned long before, after;
+
+	for (;;) {
+		before = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+		if (before % 2 == 0) {
+			memcpy(copy, (const void *) shared, sizeof(*copy));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			after = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+			if (after == before)
+				return;
+		}
+		sched_yield();
+	}
+}
+
+static void metric(const char *name, const char *type, const char *help, const char *labels, long value)
+{
+	printf("# HELP mymem_%s %s\n# TYPE mymem_%s %s\n", name, help, name, type);
+	printf("mymem_%s{%s} %ld\n", name, labels, value);
+}
+
+static void printTelemetry(const struct mem_telemetry *t)
+{
+	char labels[128], bucketLabels[160];
+	const char *strategy = t->strategy >= 0 && t->strategy <= 7 ? strategyNames[t->strategy] : "unknown";
+	long cumulative = 0, searches = 0;
+	int k;
+
+	snprintf(labels, sizeof(labels), "pid=\"%d\",strategy=\"%s\"", t->pid, strategy);
+	metric("pool_bytes", "gauge", "Size of the pool.", labels, t->pool_bytes);
+	metric("allocated_bytes", "gauge", "Bytes of the pool in allocated blocks.", labels, t->allocated_bytes);
+	metric("free_bytes", "gauge", "Bytes of the pool in free blocks.", labels, t->free_bytes);
+	if (t->holes >= 0)
+		metric("holes", "gauge", "Free blocks in the pool.", labels, t->holes);
+	if (t->largest_free >= 0)
+		metric("largest_free_bytes", "gauge", "Largest free block.", labels, t->largest_free);
+	metric("direct_blocks", "gauge", "Blocks mapped on their own above the mmap threshold.", labels, t->direct_blocks);
+	metric("direct_bytes", "gauge", "Bytes mapped for direct blocks.", labels, t->direct_bytes);
+	metric("mallocs_total", "counter", "mymalloc and mymemalign calls.", labels, t->mallocs);
+	metric("frees_total", "counter", "myfree calls.", labels, t->frees);
+	metric("failed_mallocs_total", "counter", "Allocations that returned NULL.", labels, t->failed);
+
+	for (k = 0; k < MEM_HIST_BUCKETS; k++)
+		searches += t->search_hist[k];
+	if (searches == 0)
+		return; // Bitmap, or nothing searched yet
+	printf("# HELP mymem_search_length Nodes visited by a fit search.\n# TYPE mymem_search_length histogram\n");
+	for (k = 0; k < MEM_HIST_BUCKETS - 1; k++) {
+		cumulative += t->search_hist[k];
+		snprintf(bucketLabels, sizeof(bucketLabels), "%s,le=\"%ld\"", labels, (2L << k) - 1);
+		printf("mymem_search_length_bucket{%s} %ld\n", bucketLabels, cumulative);
+	}
+	printf("mymem_search_length_bucket{%s,le=\"+Inf\"} %ld\n", labels, searches);
+	printf("mymem_search_length_sum{%s} %ld\n", labels, t->search_steps);
+	printf("mymem_search_length_count{%s} %ld\n", labels, searches);
+}
+
+int main(int argc, char **argv)
+{
+	struct mem_telemetry copy;
+	const struct mem_telemetry *shared;
+	char name[64];
+	int interval = 0, fd;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: mymemstat <pid | /segment-name> [interval-seconds]\n");
+		return 2;
+	}
+	if (argv[1][0] == '/')
+		snprintf(name, sizeof(name), "%s", argv[1]);
+	else
+		snprintf(name, sizeof(name), "/mymem.%d", atoi(argv[1]));
+	if (argc > 2)
+		interval = atoi(argv[2]);
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "mymemstat: cannot open %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+	shared = mmap(NULL, sizeof(struct mem_telemetry), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shared == MAP_FAILED || __atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != MEM_TELEMETRY_MAGIC
+	    || shared->version != MEM_TELEMETRY_VERSION) {
+		fprintf(stderr, "mymemstat: %s is not a mymem telemetry segment of this version\n", name);
+		return 1;
+	}
+
+	for (;;) {
+		readTelemetry(shared, &copy);
+		printTelemetry(&copy);
+		fflush(stdout);
+		if (interval <= 0 || (kill(copy.pid, 0) != 0 && errno == ESRCH))
+			return 0;
+		sleep(interval);
+		printf("\n");
+	}
+}
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mymem.h"
+#include "objpool.h"
+
+#define OBJ_ALIGN sizeof(void *)   // objects hold the free list's next pointer
+
+static size_t headerBytes()
+{
+    return (sizeof(ObjSlab) + OBJ_ALIGN - 1) & ~(OBJ_ALIGN - 1);
+}
+
+/* A pool of objects of objSize bytes, taken from the pool in slabs of at least objsPerSlab
+ * objects; NULL if the pool cannot hold the pool's own header */
+ObjPool *objpool_create(size_t objSize, int objsPerSlab)
+{
+    if (objSize == 0 || objsPerSlab <= 0)
+        return NULL;
+
+    ObjPool *pool = mymalloc(sizeof(ObjPool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->objSize = objSize < OBJ_ALIGN ? OBJ_ALIGN : (objSize + OBJ_ALIGN - 1) & ~(OBJ_ALIGN - 1);
+    pool->slabBytes = OBJ_ALIGN;
+    while (pool->slabBytes < headerBytes() + objsPerSlab * pool->objSize)
+        pool->slabBytes *= 2;
+    // rounding up to a power of two leaves room for more objects than asked for
+    pool->perSlab = (pool->slabBytes - headerBytes()) / pool->objSize;
+    pool->slabs = pool->last = NULL;
+    pool->slabCount = pool->emptySlabs = 0;
+    return pool;
+}
+
+static void unlinkSlab(ObjPool *pool, ObjSlab *slab)
+{
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        pool->slabs = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+    else
+        pool->last = slab->prev;
+}
+
+static void pushFront(ObjPool *pool, ObjSlab *slab)
+{
+    slab->prev = NULL;
+    slab->next = pool->slabs;
+    if (pool->slabs != NULL)
+        pool->slabs->prev = slab;
+    else
+        pool->last = slab;
+    pool->slabs = slab;
+}
+
+static void pushBack(ObjPool *pool, ObjSlab *slab)
+{
+    slab->next = NULL;
+    slab->prev = pool->last;
+    if (pool->last != NULL)
+        pool->last->next = slab;
+    else
+        pool->slabs = slab;
+    pool->last = slab;
+}
+
+static ObjSlab *newSlab(ObjPool *pool)
+{
+    ObjSlab *slab = mymemalign(pool->slabBytes, pool->slabBytes);
+    char *obj;
+    int i;
+
+    if (slab == NULL)
+        return NULL;
+
+    // thread the free list through the objects in address order
+    obj = (char *) slab + headerBytes();
+    slab->free = obj;
+    for (i = 0; i < pool->perSlab - 1; i++, obj += pool->objSize)
+        *(void **) obj = obj + pool->objSize;
+    *(void **) obj = NULL;
+
+    slab->used = 0;
+    pushFront(pool, slab);
+    pool->slabCount++;
+    pool->emptySlabs++;
+    return slab;
+}
+
+/* An unused object, or NULL if a new slab was needed and the pool had no room for it */
+void *objpool_alloc(ObjPool *pool)
+{
+    ObjSlab *slab = pool->slabs;
+    if (slab == NULL || slab->free == NULL) {
+        slab = newSlab(pool);
+        if (slab == NULL)
+            return NULL;
+    }
+
+    void *obj = slab->free;
+    slab->free = *(void **) obj;
+    if (slab->used++ == 0)
+        pool->emptySlabs--;
+    if (slab->free == NULL) {
+        unlinkSlab(pool, slab);
+        pushBack(pool, slab);
+    }
+    return obj;
+}
+
+/* Returns obj, which objpool_alloc handed out from this pool, to its slab */
+void objpool_free(ObjPool *pool, void *obj)
+{
+    ObjSlab *slab = (ObjSlab *) ((uintptr_t) obj & ~(uintptr_t) (pool->slabBytes - 1));
+
+    if (slab->free == NULL) {
+        // was full: back among the slabs allocations are taken from
+        unlinkSlab(pool, slab);
+        pushFront(pool, slab);
+    }
+    *(void **) obj = slab->free;
+    slab->free = obj;
+
+    if (--slab->used == 0) {
+        if (pool->emptySlabs > 0) {
+            unlinkSlab(pool, slab);
+            pool->slabCount--;
+            myfree(slab);
+        } else
+            pool->emptySlabs++;
+    }
+}
+
+/* Releases every slab, objects still in use included, and the pool itself */
+void objpool_destroy(ObjPool *pool)
+{
+    ObjSlab *slab, *next;
+
+    if (pool == NULL)
+        return;
+    for (slab = pool->slabs; slab != NULL; slab = next) {
+        next = slab->next;
+        myfree(slab);
+    }
+    myfree(pool);
+}
@@ -0,0 +1,31 @@
+/* Object pools: fixed-size objects carved out of slabs taken from the pool with mymemalign.
+ * Each slab keeps a free list threaded through its unused objects, so objpool_alloc and
+ * objpool_free are a pointer pop and push with no search and no MemList node per object.
+ * Slabs are a power of two in size and aligned to it, so an object's slab is its address
+ * with the low bits cleared. Slabs with free objects sit at the front of the pool's slab list,
+ * full ones at the back; one empty slab is kept for reuse and any other goes back to the pool.
+ *
+ * Include mymem.h first; like an arena, an object pool lives in the pool initmem set up.
+ */
+typedef struct objSlab
+{
+    struct objSlab *prev, *next;
+    void *free;            // first unused object, each holding a pointer to the next; NULL when full
+    int used;
+} ObjSlab;
+
+typedef struct objPool
+{
+    ObjSlab *slabs;        // slabs with free objects first, then the full ones
+    ObjSlab *last;
+    size_t objSize;
+    size_t slabBytes;      // size and alignment of every slab
+    int perSlab;           // objects that fit in a slab after its header
+    int slabCount;
+    int emptySlabs;        // slabs with no object in use (at most one is kept)
+} ObjPool;
+
+ObjPool *objpool_create(size_t objSize, int objsPerSlab);
+void *objpool_alloc(ObjPool *pool);
+void objpool_free(ObjPool *pool, void *obj);
+void objpool_destroy(ObjPool *pool);
@@ -0,0 +1,131 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfcount.h"
+
+static const char *eventNames[PERF_EVENTS] = { "cycles", "instructions", "L1d misses", "LLC misses", "branch misses" };
+
+// the perf_event_attr config of each event
+static const struct { unsigned int type; unsigned long long config; } events[PERF_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int openEvent(int event, int leader)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.disabled = leader < 0;       // members follow the leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // if the PMU has to share out its counters, the count is scaled by the time it ran
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+/* Opens the events for this thread, stopped and at zero; returns how many were opened, or -1
+ * with errno set if the kernel gives none (then every count stays -1) */
+int perfcount_open(PerfCounters *counters)
+{
+    int event, opened = 1;
+
+    for (event = 0; event < PERF_EVENTS; event++) {
+        counters->fds[event] = -1;
+        counters->counts[event] = -1;
+    }
+    counters->fds[PERF_CYCLES] = openEvent(PERF_CYCLES, -1);
+    if (counters->fds[PERF_CYCLES] < 0)
+        return -1;
+    for (event = PERF_CYCLES + 1; event < PERF_EVENTS; event++) {
+        counters->fds[event] = openEvent(event, counters->fds[PERF_CYCLES]);
+        if (counters->fds[event] >= 0)
+            opened++;
+    }
+    return opened;
+}
+
+void perfcount_reset(PerfCounters *counters)
+{
+    if (counters->fds[PERF_CYCLES] >= 0)
+        ioctl(counters->fds[PERF_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+void perfcount_resume(PerfCounters *counters)
+{
+    if (counters->fds[PERF_CYCLES] >= 0)
+        ioctl(counters->fds[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perfcount_pause(PerfCounters *counters)
+{
+    if (counters->fds[PERF_CYCLES] >= 0)
+        ioctl(counters->fds[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* Fills in counts; an event that never got onto the PMU reads as -1 */
+void perfcount_read(PerfCounters *counters)
+{
+    unsigned long long values[3]; // count, time enabled, time running
+    int event;
+
+    for (event = 0; event < PERF_EVENTS; event++) {
+        counters->counts[event] = -1;
+        if (counters->fds[event] < 0 || read(counters->fds[event], values, sizeof(values)) != sizeof(values))
+            continue;
+        if (values[2] == 0)
+            counters->counts[event] = values[1] == 0 ? 0 : -1;
+        else if (values[2] < values[1])
+            counters->counts[event] = (long long) ((double) values[0] * values[1] / values[2]);
+        else
+            counters->counts[event] = (long long) values[0];
+    }
+}
+
+void perfcount_close(PerfCounters *counters)
+{
+    int event;
+
+    // members first, so the leader goes last
+    for (event = PERF_EVENTS - 1; event >= 0; event--) {
+        if (counters->fds[event] >= 0)
+            close(counters->fds[event]);
+        counters->fds[event] = -1;
+    }
+}
+
+/* An event's count per operation, or -1 if it was not counted */
+double perfcount_per_op(PerfCounters *counters, enum perfEvent event, long operations)
+{
+    if (counters->counts[event] < 0 || operations <= 0)
+        return -1;
+    return (double) counters->counts[event] / operations;
+}
+
+/* "812.0 cycles, 1020.3 instructions, ..." per operation, with n/a for an event not counted */
+void perfcount_format(PerfCounters *counters, long operations, char *buffer, size_t size)
+{
+    size_t used = 0;
+    int event;
+
+    buffer[0] = '\0';
+    for (event = 0; event < PERF_EVENTS && used < size; event++) {
+        double value = perfcount_per_op(counters, event, operations);
+        const char *separator = event == 0 ? "" : ", ";
+        if (value < 0)
+            used += snprintf(buffer + used, size - used, "%sn/a %s", separator, eventNames[event]);
+        else
+            used += snprintf(buffer + used, size - used, "%s%.2f %s", separator, value, eventNames[event]);
+    }
+}
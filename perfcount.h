@@ -0,0 +1,26 @@
+/* Hardware counters around a timed loop: cycles, instructions, L1 data cache read misses,
+ * last-level cache misses and branch misses of the calling thread, in user space only, read
+ * with perf_event_open. They are optional. Where the kernel refuses them (perf_event_paranoid,
+ * a container or VM without a PMU), perfcount_open returns -1 with the reason in errno and every
+ * count stays -1, so callers print "n/a" and time the loop as before. An event the CPU lacks is
+ * left out on its own.
+ *
+ * perfcount_resume and perfcount_pause bracket just the calls to count, so a loop's own
+ * bookkeeping can be left out; each is one ioctl on the group.
+ */
+enum perfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS };
+
+typedef struct perfCounters
+{
+    int fds[PERF_EVENTS];           // -1 for an event that is not counted; fds[PERF_CYCLES] leads the group
+    long long counts[PERF_EVENTS];  // since perfcount_reset, as of the last perfcount_read; -1 if not counted
+} PerfCounters;
+
+int perfcount_open(PerfCounters *counters);
+void perfcount_reset(PerfCounters *counters);
+void perfcount_resume(PerfCounters *counters);
+void perfcount_pause(PerfCounters *counters);
+void perfcount_read(PerfCounters *counters);
+void perfcount_close(PerfCounters *counters);
+double perfcount_per_op(PerfCounters *counters, enum perfEvent event, long operations);
+void perfcount_format(PerfCounters *counters, long operations, char *buffer, size_t size);
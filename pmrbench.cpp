@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory_resource>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "mymem.hpp"
+#include "testrunner.h"
+
+/* Benchmarks for the C++ adapters in mymem.hpp: standard containers on each strategy's pool
+ * against the default resource (operator new). Run "pmrbench <benchmark> <strategy>" like
+ * membench; "resource" checks the adapters before anything is timed.
+ */
+
+#define POOL_SIZE (16 << 20)
+#define VECTOR_ROUNDS 500
+#define VECTOR_LENGTH 10000
+#define MAP_LIVE 10000
+#define MAP_STEPS 50000
+
+static double now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/* vectors grown one push_back at a time and dropped, so every growth step is an allocate of
+ * twice the size and a deallocate; ns per push_back */
+template <class Vector, class... Args>
+static double time_vector(Args &&...args)
+{
+	double start = now_ns();
+	for (int round = 0; round < VECTOR_ROUNDS; round++)
+	{
+		Vector numbers(args...);
+		for (int i = 0; i < VECTOR_LENGTH; i++)
+			numbers.push_back(i);
+	}
+	return (now_ns() - start) / ((double) VECTOR_ROUNDS * VECTOR_LENGTH);
+}
+
+/* a map of MAP_LIVE random keys in which one key is erased and another inserted at each step,
+ * so every step frees one node and allocates one; ns per step */
+template <class Map, class... Args>
+static double time_map(Args &&...args)
+{
+	Map map(args...);
+	int keys[MAP_LIVE];
+
+	srand(1);
+	for (int i = 0; i < MAP_LIVE; i++)
+	{
+		keys[i] = rand();
+		map[keys[i]] = i;
+	}
+	double start = now_ns();
+	for (int step = 0; step < MAP_STEPS; step++)
+	{
+		int i = rand() % MAP_LIVE;
+		map.erase(keys[i]);
+		keys[i] = rand();
+		map[keys[i]] = step;
+	}
+	return (now_ns() - start) / MAP_STEPS;
+}
+
+typedef std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           mymem::allocator<std::pair<const int, int>>> PoolMap;
+
+int bench_resource(int argc, char **argv)
+{
+	for (int strategy = 1; strategy <= 7; strategy++)
+	{
+		mymem::resource pool((strategies) strategy, 1 << 20);
+
+		for (std::size_t alignment = 1; alignment <= 4096; alignment *= 2)
+		{
+			void *ptr = pool.allocate(100, alignment);
+			if ((std::uintptr_t) ptr % alignment != 0 || !mem_is_alloc(ptr))
+			{
+				printf("Block for alignment %zu is at %p with %s\n", alignment, ptr, strategy_name((strategies) strategy));
+				return 1;
+			}
+			pool.deallocate(ptr, 100, alignment);
+		}
+
+		{
+			std::pmr::vector<long> numbers(&pool);
+			PoolMap map;
+			for (int i = 0; i < 1000; i++)
+			{
+				numbers.push_back(i);
+				map[i] = i;
+			}
+			if (mem_allocated() < (int) (1000 * sizeof(long)) || map.size() != 1000 || map[999] != 999)
+			{
+				printf("Containers did not place their elements in the pool with %s\n", strategy_name((strategies) strategy));
+				return 1;
+			}
+		}
+		if (mem_allocated() != 0)
+		{
+			printf("Containers left %d bytes allocated with %s\n", mem_allocated(), strategy_name((strategies) strategy));
+			return 1;
+		}
+
+		mymem::resource other;
+		bool threw = false;
+		try {
+			(void) pool.allocate(2 << 20);
+		} catch (const std::bad_alloc &) {
+			threw = true;
+		}
+		if (!threw || !pool.is_equal(other) || pool.is_equal(*std::pmr::new_delete_resource()))
+		{
+			printf("Resource did not throw or compare as expected with %s\n", strategy_name((strategies) strategy));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int bench_containers(int argc, char **argv)
+{
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv+1))>0)
+		lbound=ubound=strategyFromString(*(argv+1));
+
+	printf("\n%10s %14s %14s %16s\n", "resource", "vector ns/op", "map ns/op", "allocator ns/op");
+	for (int strategy = lbound; strategy <= ubound; strategy++)
+	{
+		mymem::resource pool((strategies) strategy, POOL_SIZE);
+		double vector = time_vector<std::pmr::vector<int>>(&pool);
+		double map = time_map<std::pmr::unordered_map<int, int>>(&pool);
+		double allocator = time_map<PoolMap>();
+		printf("%10s %14.1f %14.1f %16.1f\n", strategy_name((strategies) strategy), vector, map, allocator);
+	}
+
+	double vector = time_vector<std::pmr::vector<int>>(std::pmr::new_delete_resource());
+	double map = time_map<std::pmr::unordered_map<int, int>>(std::pmr::new_delete_resource());
+	double allocator = time_map<std::unordered_map<int, int>>();
+	printf("%10s %14.1f %14.1f %16.1f\n", "default", vector, map, allocator);
+	printf("\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	testentry_t benches[] = {
+		{(char *) "resource", (char *) "check", bench_resource},
+		{(char *) "containers", (char *) "strategy", bench_containers},
+	};
+
+	if (argc < 3)
+	{
+		printf("Usage: pmrbench [-j N] <benchmark> <strategy>\n");
+		return 0;
+	}
+	set_testrunner_default_timeout(600);
+	return run_testrunner(argc,argv,benches,sizeof(benches)/sizeof(testentry_t));
+}
@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mymem.h"
+#include "sharedpool.h"
+
+#define SHARED_MAGIC 0x4c4f4f50   // "POOL"
+#define SHARED_VERSION 1
+#define NODE_ALLOC 0x80000000u     // sizeAlloc bit of an allocated block, as in mymem.c
+
+static size_t roundUp(size_t bytes, size_t unit)
+{
+    return (bytes + unit - 1) / unit * unit;
+}
+
+static MemList *node(SharedPool *pool, unsigned int number)
+{
+    return &pool->nodes[number];
+}
+
+static unsigned int nodeSize(MemList *block)
+{
+    return block->sizeAlloc & ~NODE_ALLOC;
+}
+
+static int nodeAlloc(MemList *block)
+{
+    return (block->sizeAlloc & NODE_ALLOC) != 0;
+}
+
+// a node for a new block: a released one if there is one, else the next unused one in the table
+static unsigned int newNode(SharedPool *pool)
+{
+    SharedHeader *header = pool->header;
+    unsigned int number = header->freeNodes;
+
+    if (number != 0)
+        header->freeNodes = node(pool, number)->next;
+    else
+        number = header->nodeUsed++; // the table has a node for every unit, so it cannot run out
+    return number;
+}
+
+static void deleteNode(SharedPool *pool, unsigned int number)
+{
+    node(pool, number)->next = pool->header->freeNodes;
+    pool->header->freeNodes = number;
+}
+
+/* Puts the list right after a process died holding the lock, perhaps halfway through a split or
+ * a merge. The forward links and offsets are trusted, as both are written before a block is
+ * resized: the walk from head must visit blocks at rising offsets from 0. Everything else is
+ * rebuilt from it: block sizes (up to the next block's offset), back links, the blockNode table,
+ * freeBytes and holes, a merge that was cut short, and the chain of released nodes, which also
+ * takes any node the walk does not reach. Returns 0, changing nothing, if the list cannot be
+ * followed. */
+static int repairPool(SharedPool *pool)
+{
+    SharedHeader *header = pool->header;
+    unsigned int number, before = 0, visited = 0;
+    long lastOffset = -1;
+
+    if (header->nodeUsed < 2 || header->nodeUsed > header->nodeLimit || header->head == 0
+        || header->head >= header->nodeUsed || node(pool, header->head)->offset != 0)
+        return 0;
+    for (number = header->head; number != 0; number = node(pool, number)->next) {
+        MemList *block = node(pool, number);
+        if (number >= header->nodeUsed || ++visited >= header->nodeUsed || block->offset % SHARED_ALIGN != 0
+            || block->offset >= header->dataBytes || (long) block->offset <= lastOffset)
+            return 0;
+        lastOffset = block->offset;
+    }
+
+    memset(pool->blockNode, 0, header->dataBytes / SHARED_ALIGN * sizeof(unsigned int));
+    header->freeBytes = 0;
+    header->holes = 0;
+    for (number = header->head; number != 0; ) {
+        MemList *block = node(pool, number);
+        unsigned int after = block->next;
+        size_t end = after != 0 ? node(pool, after)->offset : header->dataBytes;
+        block->sizeAlloc = (block->sizeAlloc & NODE_ALLOC) | (unsigned int) (end - block->offset);
+        if (before != 0 && !nodeAlloc(block) && !nodeAlloc(node(pool, before))) {
+            // two free neighbours: finish the merge; this node is released below
+            node(pool, before)->sizeAlloc += nodeSize(block);
+            node(pool, before)->next = after;
+            header->freeBytes += nodeSize(block);
+        } else {
+            block->prev = before;
+            pool->blockNode[block->offset / SHARED_ALIGN] = number;
+            if (!nodeAlloc(block)) {
+                header->freeBytes += nodeSize(block);
+                header->holes++;
+            }
+            before = number;
+        }
+        number = after;
+    }
+
+    header->freeNodes = 0;
+    for (number = header->nodeUsed - 1; number > 0; number--) {
+        MemList *block = node(pool, number);
+        if (block->offset >= header->dataBytes || block->offset % SHARED_ALIGN != 0
+            || pool->blockNode[block->offset / SHARED_ALIGN] != number)
+            deleteNode(pool, number);
+    }
+    return 1;
+}
+
+// 0 once the lock is held, -1 if the pool cannot be used
+static int lockPool(SharedPool *pool)
+{
+    int error = pthread_mutex_lock(&pool->header->lock);
+
+    if (error == EOWNERDEAD) {
+        if (!repairPool(pool)) {
+            // left inconsistent: this and every later lock fails with ENOTRECOVERABLE
+            pthread_mutex_unlock(&pool->header->lock);
+            return -1;
+        }
+        pool->header->ownerDeaths++;
+        pthread_mutex_consistent(&pool->header->lock);
+        return 0;
+    }
+    return error == 0 ? 0 : -1;
+}
+
+static void unlockPool(SharedPool *pool)
+{
+    pthread_mutex_unlock(&pool->header->lock);
+}
+
+// a process-local handle on a mapped segment
+static SharedPool *attach(SharedHeader *header)
+{
+    SharedPool *pool = malloc(sizeof(SharedPool));
+    if (pool == NULL)
+        return NULL;
+    pool->header = header;
+    pool->nodes = (MemList *) ((char *) header + roundUp(sizeof(SharedHeader), SHARED_ALIGN));
+    pool->blockNode = (unsigned int *) ((char *) header + header->blockNodeOffset);
+    pool->data = (char *) header + header->dataOffset;
+    return pool;
+}
+
+/* Creates the segment name (which must not exist yet) with a pool of size bytes, rounded down to
+ * whole SHARED_ALIGN units (at most 2GB), and maps it; NULL if that fails. The tables are sized
+ * for one block per unit, but their pages, like the data's, only take memory once touched. */
+SharedPool *sharedpool_create(const char *name, size_t size)
+{
+    size_t units = size / SHARED_ALIGN, nodesOffset = roundUp(sizeof(SharedHeader), SHARED_ALIGN);
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    SharedHeader *header;
+    pthread_mutexattr_t attributes;
+    SharedPool *pool;
+    int fd;
+
+    if (units == 0 || units * SHARED_ALIGN > INT32_MAX)
+        return NULL;
+
+    size_t blockNodeOffset = nodesOffset + roundUp((units + 1) * sizeof(MemList), SHARED_ALIGN);
+    size_t dataOffset = roundUp(blockNodeOffset + units * sizeof(unsigned int), page);
+    size_t segmentBytes = dataOffset + units * SHARED_ALIGN;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, segmentBytes) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    header = mmap(NULL, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    header->version = SHARED_VERSION;
+    header->segmentBytes = segmentBytes;
+    header->blockNodeOffset = blockNodeOffset;
+    header->dataOffset = dataOffset;
+    header->dataBytes = units * SHARED_ALIGN;
+    header->nodeLimit = (unsigned int) units + 1;
+    header->freeNodes = 0;
+    header->freeBytes = (long) header->dataBytes;
+    header->holes = 1;
+    header->ownerDeaths = 0;
+
+    pool = attach(header);
+    if (pool == NULL) {
+        munmap(header, segmentBytes);
+        shm_unlink(name);
+        return NULL;
+    }
+    // one free block covering the data; the segment is zero-filled, so every other unit maps to node 0
+    header->head = 1;
+    header->nodeUsed = 2;
+    *node(pool, 1) = (MemList) { 0, 0, 0, (unsigned int) header->dataBytes };
+    pool->blockNode[0] = 1;
+    __atomic_store_n(&header->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+    return pool;
+}
+
+/* Maps the existing segment name; NULL if there is none or it holds no shared pool */
+SharedPool *sharedpool_open(const char *name)
+{
+    struct stat status;
+    SharedHeader *header;
+    SharedPool *pool;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &status) != 0 || (size_t) status.st_size < sizeof(SharedHeader)) {
+        close(fd);
+        return NULL;
+    }
+    header = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+        return NULL;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHARED_MAGIC || header->version != SHARED_VERSION
+        || header->segmentBytes != (size_t) status.st_size || (pool = attach(header)) == NULL) {
+        munmap(header, status.st_size);
+        return NULL;
+    }
+    return pool;
+}
+
+/* Unmaps the pool from this process; its blocks stay as they are for the others */
+void sharedpool_close(SharedPool *pool)
+{
+    if (pool == NULL)
+        return;
+    munmap(pool->header, pool->header->segmentBytes);
+    free(pool);
+}
+
+/* Removes the segment's name; processes that have it mapped keep using it */
+int sharedpool_unlink(const char *name)
+{
+    return shm_unlink(name);
+}
+
+/* Offset of a new block of at least size bytes, from the start of the data; -1 if nothing fits
+ * or the pool cannot be used (see sharedpool.h) */
+long sharedpool_alloc(SharedPool *pool, size_t size)
+{
+    SharedHeader *header = pool->header;
+    unsigned int number, rest;
+    MemList *block;
+
+    if (size == 0 || size > header->dataBytes)
+        return -1;
+    size = roundUp(size, SHARED_ALIGN);
+
+    if (lockPool(pool) != 0)
+        return -1;
+    for (number = header->head; number != 0; number = block->next) {
+        block = node(pool, number);
+        if (!nodeAlloc(block) && nodeSize(block) >= size)
+            break;
+    }
+    if (number == 0) {
+        unlockPool(pool);
+        return -1;
+    }
+
+    if (nodeSize(block) > size) {
+        // the left-over part becomes a free block right after this one
+        rest = newNode(pool);
+        MemList *after = node(pool, rest);
+        after->offset = block->offset + (unsigned int) size;
+        after->sizeAlloc = nodeSize(block) - (unsigned int) size;
+        after->prev = number;
+        after->next = block->next;
+        if (block->next != 0)
+            node(pool, block->next)->prev = rest;
+        block->next = rest;
+        block->sizeAlloc = (unsigned int) size;
+        pool->blockNode[after->offset / SHARED_ALIGN] = rest;
+    } else
+        header->holes--;
+    block->sizeAlloc |= NODE_ALLOC;
+    header->freeBytes -= (long) size;
+    long offset = block->offset;
+    unlockPool(pool);
+    return offset;
+}
+
+// merges the free block right of number into it
+static void mergeRight(SharedPool *pool, unsigned int number)
+{
+    MemList *block = node(pool, number);
+    unsigned int right = block->next;
+    MemList *gone = node(pool, right);
+
+    block->sizeAlloc += nodeSize(gone);
+    block->next = gone->next;
+    if (gone->next != 0)
+        node(pool, gone->next)->prev = number;
+    pool->blockNode[gone->offset / SHARED_ALIGN] = 0;
+    deleteNode(pool, right);
+    pool->header->holes--;
+}
+
+/* Frees the block at offset, which any process may have allocated; -1 if there is no allocated
+ * block there or the pool cannot be used */
+int sharedpool_free(SharedPool *pool, long offset)
+{
+    SharedHeader *header = pool->header;
+
+    if (offset < 0 || (size_t) offset >= header->dataBytes || offset % SHARED_ALIGN != 0)
+        return -1;
+
+    if (lockPool(pool) != 0)
+        return -1;
+    unsigned int number = pool->blockNode[offset / SHARED_ALIGN];
+    MemList *block = node(pool, number);
+    if (number == 0 || !nodeAlloc(block)) {
+        unlockPool(pool);
+        return -1;
+    }
+
+    block->sizeAlloc &= ~NODE_ALLOC;
+    header->freeBytes += nodeSize(block);
+    header->holes++;
+    if (block->next != 0 && !nodeAlloc(node(pool, block->next)))
+        mergeRight(pool, number);
+    if (block->prev != 0 && !nodeAlloc(node(pool, block->prev)))
+        mergeRight(pool, block->prev);
+    unlockPool(pool);
+    return 0;
+}
+
+/* This process's address of the block at offset */
+void *sharedpool_ptr(SharedPool *pool, long offset)
+{
+    return pool->data + offset;
+}
+
+/* Offset of a block from this process's address of it, to hand to another process */
+long sharedpool_offset(SharedPool *pool, void *ptr)
+{
+    return (char *) ptr - pool->data;
+}
+
+long sharedpool_free_bytes(SharedPool *pool)
+{
+    return __atomic_load_n(&pool->header->freeBytes, __ATOMIC_RELAXED);
+}
+
+int sharedpool_holes(SharedPool *pool)
+{
+    return __atomic_load_n(&pool->header->holes, __ATOMIC_RELAXED);
+}
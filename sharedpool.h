@@ -0,0 +1,57 @@
+/* Shared pools: a pool in a POSIX shared memory segment that several processes map, so one
+ * process can allocate a buffer, fill it and pass its offset to another, which reads it in place
+ * and frees it. Each process maps the segment wherever it lands, so everything the pool keeps
+ * lives in the segment and names blocks by offset, never by address: a header, a table of
+ * MemList nodes (16 bytes, linked by node number as in mymem.c), a table from each
+ * SHARED_ALIGN-byte unit to the node of the block starting there (for O(1) frees), and the data.
+ * Blocks are placed first-fit in address order, rounded up to SHARED_ALIGN bytes so each starts
+ * on its own cache line, and merged with free neighbours when freed.
+ *
+ * One process-shared robust mutex guards the segment. If a process dies holding it, the next
+ * one to lock it rebuilds the list from its forward links and offsets before going on, and
+ * counts it in ownerDeaths; a block the dead process was allocating may be lost. If the list
+ * cannot be followed, the lock is left unrecoverable and every later alloc and free fails.
+ *
+ * Include mymem.h first. Unlike arenas and object pools, a shared pool does not use the pool
+ * initmem sets up.
+ */
+#include <pthread.h>
+
+#define SHARED_ALIGN 64
+
+typedef struct sharedHeader
+{
+    unsigned int magic;        // set last, once the segment is ready
+    unsigned int version;
+    pthread_mutex_t lock;      // process-shared and robust
+    size_t segmentBytes;
+    size_t blockNodeOffset;    // where the tables and the data start, from the start of the segment
+    size_t dataOffset;
+    size_t dataBytes;
+    unsigned int nodeLimit;    // nodes the table holds, node 0 (none) included
+    unsigned int nodeUsed;     // nodes handed out from the front of the table so far
+    unsigned int freeNodes;    // released nodes, chained through next
+    unsigned int head;         // first block in address order
+    long freeBytes;
+    int holes;
+    int ownerDeaths;           // times the lock was taken over from a process that died holding it
+} SharedHeader;
+
+typedef struct sharedPool
+{
+    SharedHeader *header;      // start of this process's mapping of the segment
+    MemList *nodes;
+    unsigned int *blockNode;   // node of the block starting at each unit, 0 if none does
+    char *data;
+} SharedPool;
+
+SharedPool *sharedpool_create(const char *name, size_t size);
+SharedPool *sharedpool_open(const char *name);
+void sharedpool_close(SharedPool *pool);
+int sharedpool_unlink(const char *name);
+long sharedpool_alloc(SharedPool *pool, size_t size);
+int sharedpool_free(SharedPool *pool, long offset);
+void *sharedpool_ptr(SharedPool *pool, long offset);
+long sharedpool_offset(SharedPool *pool, void *ptr);
+long sharedpool_free_bytes(SharedPool *pool);
+int sharedpool_holes(SharedPool *pool);
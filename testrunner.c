@@ -11,6 +11,7 @@ Original Author: L. Angrave
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "testrunner.h"
@@ -40,7 +41,7 @@ static int eql( char*s1, char*s2) {return s1&&s2&&!strcmp(s1,s2);}
 
 /* Callback function for qsort on strings */
 static int mystrcmp( const void *p1, const void *p2) {
-	return eql( ( char*)p1, ( char*)p2);
+	return strcmp( *(char* const*)p1, *(char* const*)p2);
 }
 
 /* Stats of all tests run so far */
@@ -49,43 +50,59 @@ typedef struct
   int ran, passed, failed;
 } stats_t;
 
-/* -- Signal handlers -- */
-static pid_t child_pid;
-static int sent_child_timeout_kill_signal;
+/* A test that has been matched on the command line, and the forked child running it */
+typedef struct
+{
+  testentry_t *test;
+  pid_t pid;          /* 0 until started */
+  double deadline;    /* CLOCK_MONOTONIC seconds */
+  int killed;
+  int result;         /* -1 until finished, then 0 pass, 1 fail, test_killed */
+} job_t;
+
+static char log_file[255]="tests.log";
+
+static double monotonic_seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return now.tv_sec+now.tv_nsec/1e9;
+}
 
-static void kill_child_signal_handler(intsigno) {
-	if(!child_pid) return;
-	char m[]="-Timeout(Killing test process)-";
-	write(0,m,sizeof(m)-1);
-	kill(child_pid,SIGKILL);
-	sent_child_timeout_kill_signal=1;
+/* Log file for the test running in this process. Each test gets its own, merged into tests.log at the end */
+const char *get_testrunner_log_file() {
+	return log_file;
 }
 
+static void test_log_file(char *fname,size_t size,testentry_t *test) {
+	snprintf(fname,size,"tests-%s.log",test->name);
+	fname[size-1]=0;
+}
 
-/* Internal function to run a test as a forked child. The child process is terminated if it runs for more than a few seconds */
+/* Internal function to start a test as a forked child. The parent enforces the time limit in wait_for_jobs */
 
-static int invoke_test_with_timelimit(testentry_t* test, int redirect_stdouterr,int argc, char **argv)
+static void start_test(job_t *job, int redirect_stdouterr,int argc, char **argv)
 {
 	char fname[255];
-	int wait_status;
-	pid_t wait_val;
-	struct sigaction action;
+	testentry_t *test=job->test;
 
-
-	assert(!child_pid);
 	assert(test && test->test_function && test->name);
 
 	set_testrunner_timeout(default_timeout_seconds);
+	test_log_file(log_file,sizeof(log_file),test);
+	unlink(log_file);
 
+	fflush(stdout);
+	fflush(stderr);
 	errno=0;
-    child_pid = fork ();
-      if (child_pid == -1) {
+	job->pid = fork ();
+	if (job->pid == -1) {
 		fprintf(stderr,"-fork failed so running test inline-");
-		return test->test_function (argc, argv);
+		job->pid=0;
+		job->result=test->test_function (argc, argv)==0 ? 0 : 1;
+		return;
 	}
 
-
-    if (child_pid == 0)
+	if (job->pid == 0)
 	{
 		if(redirect_stdouterr) {
 			snprintf(fname,(int)sizeof(fname),"stdout-%s.txt",test->name);
@@ -95,69 +112,138 @@ static int invoke_test_with_timelimit(testentry_t* test, int redirect_stdouterr,
 			freopen(fname, "w", stderr);
 		}
 	  	exit(test->test_function(argc,argv));
-	}else {
-
-		wait_status=-1;
-		sigemptyset(&action.sa_mask);
-
-		action.sa_handler=kill_child_signal_handler;
-		sigaction(SIGALRM,&action,NULL);
-		sent_child_timeout_kill_signal=0;
-		alarm(timeout_seconds);
+	}
+	job->deadline=monotonic_seconds()+timeout_seconds;
+}
 
-		wait_val = waitpid (child_pid, &wait_status, 0);
-		int child_exited_normally= WIFEXITED (wait_status);
-		int child_exit_value=WEXITSTATUS (wait_status);
-		int child_term_by_signal=WIFSIGNALED(wait_status);
-		int child_term_signal=WTERMSIG(wait_status);
+/* Reaps finished children and kills the ones past their deadline. Returns once at least one running job has finished */
+static void wait_for_jobs(job_t *jobs, int count)
+{
+	const struct timespec poll_interval={0,1000000};
+	int wait_status,i;
+	pid_t wait_val;
 
-		if(child_term_by_signal) {
-			fprintf(stderr,"testrunner:Test terminated by signal %d\n",child_term_signal);
-			fprintf(stderr,"testrunner:waitpid returned %d (child_pid=%d,wait_status=%d)",wait_val,child_pid,wait_status);
+	while(true) {
+		wait_val=waitpid(-1,&wait_status,WNOHANG);
+		if(wait_val>0) {
+			for(i=0;i<count && jobs[i].pid!=wait_val;i++);
+			if(i==count) continue;
+
+			int child_exited_normally= WIFEXITED (wait_status);
+			int child_exit_value=WEXITSTATUS (wait_status);
+			int child_term_by_signal=WIFSIGNALED(wait_status);
+			int child_term_signal=WTERMSIG(wait_status);
+
+			if(child_term_by_signal && !jobs[i].killed) {
+				fprintf(stderr,"testrunner:Test %s terminated by signal %d\n",jobs[i].test->name,child_term_signal);
+				fprintf(stderr,"testrunner:waitpid returned %d (child_pid=%d,wait_status=%d)",wait_val,jobs[i].pid,wait_status);
+			}
+
+			int passed= (child_exit_value==0) && (child_exited_normally!=0);
+			jobs[i].result= jobs[i].killed ? test_killed :  passed ? 0 : 1;
+			jobs[i].pid=0;
+			return;
 		}
+		if(wait_val==-1 && errno==ECHILD)
+			return;
+
+		double now=monotonic_seconds();
+		for(i=0;i<count;i++)
+			if(jobs[i].pid>0 && !jobs[i].killed && now>=jobs[i].deadline) {
+				kill(jobs[i].pid,SIGKILL);
+				jobs[i].killed=1;
+			}
+		nanosleep(&poll_interval,NULL);
+	}
+}
 
-		if(child_pid != wait_val)
-			fprintf(stderr,"testrunner: strange... wait_val != child_pid\n");
-
-		int passed= (child_pid == wait_val) && (child_exit_value==0) && (child_exited_normally!=0);
-
-		alarm(0);
-		kill(child_pid,SIGKILL);
-		child_pid=0;
+/* Appends the per-test logs to tests.log in test order, so the result does not depend on which test finished first */
+static void merge_logs(job_t *jobs, int count)
+{
+	char fname[255],buffer[4096];
+	FILE *merged=NULL,*in;
+	size_t n;
+	int i;
 
-		return sent_child_timeout_kill_signal ? test_killed :  passed ? 0 : 1;
+	for(i=0;i<count;i++) {
+		test_log_file(fname,sizeof(fname),jobs[i].test);
+		in=fopen(fname,"r");
+		if(in==NULL) continue;
+		if(merged==NULL && (merged=fopen("tests.log","w"))==NULL) {
+			perror("Can't write tests.log");
+			fclose(in);
+			return;
+		}
+		while((n=fread(buffer,1,sizeof(buffer),in))>0)
+			fwrite(buffer,1,n,merged);
+		fclose(in);
+		unlink(fname);
 	}
+	if(merged!=NULL)
+		fclose(merged);
 }
 
+static void print_result(int result)
+{
+  printf(":%s\n", (result == 0 ? "pass" : result ==
+	   2 ? "TIMEOUT * " : "FAIL *"));
+}
 
   /*
-   * run a test and update the stats. The main guts of this functionality is provided by invoke_test_with_timelimit
-   * This outer wrapper updates thes output and statistics before and after running the test.
+   * run the matched tests, at most max_jobs at a time, and update the stats.
+   * With one job the test's own output appears right after its name, as it always has;
+   * with more, each child's stdout/stderr go to stdout-<name>.txt/stderr-<name>.txt and the
+   * results are printed in test order as soon as every earlier test has finished.
    */
-static int
-run_one_test (stats_t * stats, testentry_t * test, int redirect_stdouterr,int argc, char **argv)
+static void
+run_jobs (stats_t * stats, job_t *jobs, int count, int max_jobs, int max_errors_before_quit, int redirect_stdouterr,int argc, char **argv)
 {
-  int test_result;
-
-
-  assert (stats && test->name && argc > 0 && argv && *argv);
-  stats->ran++;
-  stats->failed++;
-
-  printf ("%2d.%-20s:", stats->ran, test->name);
-
-  fflush(stdout);
-	test_result=invoke_test_with_timelimit(test,redirect_stdouterr,argc,argv);
-
+  int started=0, reported=0, running=0, failed=0, i;
+
+  assert (stats && jobs && argc > 0 && argv && *argv);
+  if (max_jobs > 1)
+    redirect_stdouterr=1;
+
+  while (true) {
+    while (started < count && running < max_jobs && (max_errors_before_quit<1 || failed < max_errors_before_quit)) {
+      if (max_jobs == 1) {
+        printf ("%2d.%-20s:", started+1, jobs[started].test->name);
+        fflush(stdout);
+      }
+      start_test(&jobs[started], redirect_stdouterr, argc, argv);
+      if (jobs[started].pid > 0)
+        running++;
+      else if (jobs[started].result != 0)
+        failed++;
+      started++;
+    }
+    if (running == 0 && reported == started)
+      break;
+
+    if (running > 0) {
+      wait_for_jobs(jobs, started);
+      running=failed=0;
+      for (i=0;i<started;i++) {
+        if (jobs[i].pid > 0) running++;
+        else if (jobs[i].result > 0) failed++;
+      }
+    }
 
-if (test_result == 0)
-    {
-      stats->failed--;
-      stats->passed++;
+    /* report every finished test that has no unfinished test before it */
+    while (reported < started && jobs[reported].result >= 0) {
+      job_t *job=&jobs[reported++];
+      stats->ran++;
+      if (job->result == 0)
+        stats->passed++;
+      else
+        stats->failed++;
+      if (max_jobs > 1)
+        printf ("%2d.%-20s:", stats->ran, job->test->name);
+      print_result(job->result);
     }
-  printf(":%s\n", (test_result == 0 ? "pass" : test_result ==
-	   2 ? "TIMEOUT * " : "FAIL *"));
-	return test_result!=0;
+  }
+
+  merge_logs(jobs, started);
 }
 
 /* Help functionality to print out sorted list of test names and suite names */
@@ -185,7 +271,7 @@ static void print_targets(testentry_t tests[], int count) {
 	for(i=0,previous="";i<count; i++) if(!eql(previous,array[i])) printf(" %s",(previous=array[i]));
 	printf("\nValid strategies: all ");
 
-	for(i=1;i<5;i++)
+	for(i=1;i<8;i++)
 	  printf("%s ",strategy_name(i));
 	printf("\n");
 
@@ -200,13 +286,15 @@ int
 run_testrunner(int argc, char **argv,testentry_t tests[],int test_count)
 {
 	char *test_name, *target;
-	int i;
+	int i,count;
 	stats_t stats;
-	int target_matched,max_errors_before_quit,redirect_stdouterr;
+	job_t *jobs;
+	int max_errors_before_quit,redirect_stdouterr,max_jobs;
 	memset (&stats, 0, sizeof (stats));
 
 	max_errors_before_quit=1;
 	redirect_stdouterr=0;
+	max_jobs=1;
 
 	assert (tests != NULL);
 	assert(test_count>0);
@@ -220,32 +308,44 @@ run_testrunner(int argc, char **argv,testentry_t tests[],int test_count)
 		max_errors_before_quit=atoi(target+1);
 	else if(target[1]=='r')
 		redirect_stdouterr=1;
+	else if(target[1]=='j') {
+		if(!target[2] && argc > 1) {
+			target=argv[1];
+			argc--;argv++;
+		} else
+			target+=2;
+		max_jobs=atoi(target);
+		if(max_jobs<1) max_jobs=1;
+	}
 	}
 
-	target_matched = false;
-
-	for (i=0;i<test_count && (max_errors_before_quit<1 || stats.failed != max_errors_before_quit);i++) {
+	jobs=(job_t*)calloc(sizeof(job_t),test_count);
+	for (i=0,count=0;i<test_count;i++) {
 	  test_name = tests[i].name;
 
 	  assert(test_name);
 	  assert(tests[i].suite);
 	  assert(tests[i].test_function);
 	  if (eql(target,test_name)||eql(target,"all") || eql (target,tests[i].suite) ) {
-		if(!target_matched) printf("Running tests...\n");
-	  target_matched = true;
-	  run_one_test (&stats, &tests[i],redirect_stdouterr, argc - 1,argv + 1);
+		jobs[count].test=&tests[i];
+		jobs[count].result=-1;
+		count++;
+	  }
 	}
-	}
-	if (!target_matched)
+
+	if (count == 0)
 	{
 	  fprintf (stderr, "Test '%s' not found", (strlen(target)>0?target : "(empty)"));
 	print_targets(tests,test_count);
 	}
 	else {
+	  printf("Running tests...\n");
+	  run_jobs (&stats, jobs, count, max_jobs, max_errors_before_quit, redirect_stdouterr, argc - 1, argv + 1);
 	  printf ("\nTest Results:%d tests,%d passed,%d failed.\n", stats.ran,
 	  stats.passed, stats.failed);
 	}
+	free(jobs);
 
-	return stats.passed == stats.ran && target_matched ? 0 : 1;
+	return stats.passed == stats.ran && count > 0 ? 0 : 1;
 
 }
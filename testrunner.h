@@ -1,3 +1,7 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef int (*test_fp) (int, char **);
 
 typedef struct
@@ -11,4 +15,8 @@ typedef struct
 int run_testrunner(int argc, char **argv, testentry_t *entries,int entry_count);
 void set_testrunner_default_timeout(int s);
 void set_testrunner_timeout(int s);
+const char *get_testrunner_log_file();
 
+#ifdef __cplusplus
+}
+#endif